@@ -0,0 +1,180 @@
+// Commandline tool measuring how time and memory of training and decoding of
+// MoveHMM grow with length of kmers. Reads are simulated from a random walk
+// over kmers so no input files are needed.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "src/hmm.h"
+#include "src/kmers.h"
+#include "src/move_hmm.h"
+
+DEFINE_int32(k_low, 4, "Lower bound for length of kmer.");
+DEFINE_int32(k_upper, 7, "Upper bound for length of kmer.");
+DEFINE_int32(events, 2000, "Number of events of the simulated read.");
+DEFINE_int32(samples, 10, "Number of samples from posterior probability.");
+DEFINE_int32(move_threshold, 2, "Move threshold used for training.");
+DEFINE_int32(seed, 47, "Seed of the simulation.");
+DEFINE_bool(viterbi_checkpointing, false,
+            "Use Viterbi with O(sqrt(T)) memory. See ViterbiParams.");
+DEFINE_bool(compressed_transitions, false,
+            "Decode with transitions compressed to a default probability of "
+            "every state. See CompressedTransitions.");
+DEFINE_bool(basecaller_band, false,
+            "Decode only kmers near the simulated basecalled kmers. See "
+            "basecallerBand.");
+DEFINE_int32(emission_table_rows, 4096,
+             "Emission table as in sample_move_hmm. Zero turns it off. Not "
+             "used with --basecaller_band.");
+DEFINE_int32(emission_table_max_mb, 64,
+             "Memory of one tile of the emission table in MB.");
+DEFINE_int32(band_window, 5,
+             "Basecalled kmers of events at most this many events away are "
+             "in the band of an event.");
+
+using std::chrono::system_clock;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+namespace {
+
+long long millisecondsSince(const system_clock::time_point& start) {
+  return duration_cast<milliseconds>(system_clock::now() - start).count();
+}
+
+// Random walk over kmers of length @k. Moves have the distribution usual for
+// basecalled reads.
+std::vector<MoveKmer> simulateRead(int k, int events, std::mt19937* gen) {
+  std::discrete_distribution<int> move_dist({0.2, 0.7, 0.1});
+  std::uniform_int_distribution<int> base_dist(0, kNumBases - 1);
+  std::string kmer;
+  for (int i = 0; i < k; i++) kmer += kBases[base_dist(*gen)];
+
+  std::vector<MoveKmer> read = {{0, kmer}};
+  for (int i = 1; i < events; i++) {
+    int move = std::min(move_dist(*gen), std::min(k, FLAGS_move_threshold));
+    for (int j = 0; j < move; j++) kmer += kBases[base_dist(*gen)];
+    kmer = kmer.substr(move);
+    read.push_back({move, kmer});
+  }
+  return read;
+}
+
+// Trains the model on a simulated read and decodes another one. Prints one
+// line of the table.
+void benchmark(int k) {
+  std::mt19937 gen(FLAGS_seed);
+  auto start = system_clock::now();
+  TransitionConstructor transition_constructor(FLAGS_move_threshold);
+  transition_constructor.addRead(simulateRead(k, FLAGS_events, &gen));
+  ::HMM<double> hmm(0, transition_constructor.calculateTransitions(1, k));
+  hmm.setKmerLength(k);
+  long long train_ms = millisecondsSince(start);
+  long long transitions = 0;
+  for (const std::vector<Transition>& from : hmm.transitions()) {
+    transitions += from.size();
+  }
+
+  std::uniform_real_distribution<double> mu_dist(40, 90);
+  std::uniform_real_distribution<double> sigma_dist(1, 2.5);
+  std::vector<GaussianParamsKmer> gaussians;
+  for (int pos = 1; pos <= numKmersOf(k); pos++) {
+    gaussians.push_back(
+        {kmerInLexicographicPos(pos, k), mu_dist(gen), sigma_dist(gen)});
+  }
+  std::vector<std::unique_ptr<State<double>>> states =
+      constructEmissions(k, gaussians);
+  std::vector<MoveKmer> read = simulateRead(k, FLAGS_events, &gen);
+  std::vector<double> emissions;
+  for (const MoveKmer& event : read) {
+    const GaussianParamsKmer& gaussian =
+        gaussians[kmerToLexicographicPos(event.kmer_) - 1];
+    emissions.push_back(
+        std::normal_distribution<double>(gaussian.mu_, gaussian.sigma_)(gen));
+  }
+  hmm.compile(states);
+
+  ViterbiParams viterbi_params;
+  viterbi_params.checkpointing_ = FLAGS_viterbi_checkpointing;
+  SamplingParams sampling_params;
+  viterbi_params.compressed_transitions_ = FLAGS_compressed_transitions;
+  sampling_params.compressed_transitions_ = FLAGS_compressed_transitions;
+  StateBand band;
+  if (FLAGS_basecaller_band) {
+    band = basecallerBand(read, FLAGS_move_threshold, FLAGS_band_window);
+    viterbi_params.band_ = &band;
+    sampling_params.band_ = &band;
+  }
+
+  // Tiles are computed lazily so their time is a part of the decoding.
+  std::unique_ptr<EmissionTable<double>> table;
+  if (FLAGS_emission_table_rows > 0 && !FLAGS_basecaller_band) {
+    table.reset(new EmissionTable<double>(
+        emissions, states,
+        EmissionTable<double>::tileRowsForBudget(
+            states.size(), FLAGS_emission_table_rows,
+            (size_t)FLAGS_emission_table_max_mb << 20)));
+  }
+
+  start = system_clock::now();
+  hmm.runViterbiReturnStateIds(emissions, states, viterbi_params, table.get());
+  long long viterbi_ms = millisecondsSince(start);
+  start = system_clock::now();
+  if (FLAGS_samples > 0) {
+    hmm.posteriorProbSample(FLAGS_samples, FLAGS_seed, emissions, states,
+                            sampling_params, table.get());
+  }
+  long long sampling_ms = millisecondsSince(start);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << k << "," << hmm.transitions().size() << "," << transitions
+            << "," << train_ms << "," << viterbi_ms << "," << sampling_ms
+            << "," << usage.ru_maxrss / 1024 << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::SetUsageMessage(
+      "Commandline tool measuring time and memory of MoveHMM for different "
+      "lengths of kmers.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK(FLAGS_k_low >= 1 && FLAGS_k_upper <= kMaxKmerLength)
+      << "Lengths of kmers have to be from 1 to " << kMaxKmerLength << ".";
+  CHECK(!FLAGS_compressed_transitions || !FLAGS_basecaller_band)
+      << "--compressed_transitions cannot be combined with --basecaller_band.";
+
+  std::cout << "k,states,transitions,train_ms,viterbi_ms,sampling_ms,"
+               "peak_rss_mb\n" << std::flush;
+  for (int k = FLAGS_k_low; k <= FLAGS_k_upper; k++) {
+    // Every length runs in its own process so that the peak memory belongs
+    // only to it.
+    pid_t pid = fork();
+    CHECK(pid >= 0) << "Cannot fork.";
+    if (pid == 0) {
+      benchmark(k);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      LOG(ERROR) << "Benchmark for k=" << k << " failed.";
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Transitions compressed to a default log2 probability of every source state
+// and a list of exceptions. Transitions of trained MoveHMM which were never
+// observed have only the pseudocount so all of them going from one state have
+// the same probability, which becomes the default of the state. Exception is
+// every distinct pair of a source state and a probability other than its
+// default.
+//
+// Decoders do not read probabilities of transitions at all. Before a column
+// is computed expandRow adds them to the previous column:
+// values[u] = prev[u] + default of u for every state u and
+// values[numStates() + e] = prev[source of e] + log2 probability of e for
+// every exception e. Transition i reads values[valueIdx()[i]] which is
+// exactly the same number as prev[from[i]] + log2_probs[i]. So instead of the
+// source and the probability of every transition only one index is read.
+template <typename Score>
+class CompressedTransitions {
+ public:
+  CompressedTransitions() : num_states_(0) {}
+  // @from[i] and @log2_probs[i] are the source state and log2 of probability
+  // of transition i. States are numbered from 0 to @num_states-1.
+  CompressedTransitions(int num_states, const std::vector<int>& from,
+                        const std::vector<Score>& log2_probs);
+
+  // @prev has numStates() numbers and @values valuesSize() numbers.
+  void expandRow(const Score* prev, Score* values) const;
+
+  const int* valueIdx() const { return value_idx_.data(); }
+  int numStates() const { return num_states_; }
+  int numExceptions() const { return exception_from_.size(); }
+  int valuesSize() const { return num_states_ + numExceptions(); }
+  Score defaultLog2Prob(int state) const { return default_log2_probs_[state]; }
+  // Bytes of all arrays read when a column is computed, including the values.
+  size_t memoryUsage() const;
+
+ private:
+  int num_states_;
+  std::vector<Score> default_log2_probs_;
+  // Exceptions of every state are consecutive and sorted by probability.
+  std::vector<int> exception_from_;
+  std::vector<Score> exception_log2_probs_;
+  std::vector<int> value_idx_;
+};
+
+// Implementation of template class.
+#include "compressed_transitions.tcc"
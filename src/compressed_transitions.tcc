@@ -0,0 +1,77 @@
+// Implementation of templated class CompressedTransitions.
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+template <typename Score>
+CompressedTransitions<Score>::CompressedTransitions(
+    int num_states, const std::vector<int>& from,
+    const std::vector<Score>& log2_probs)
+    : num_states_(num_states), default_log2_probs_(num_states, 0) {
+  std::vector<std::vector<Score>> probs_from(num_states);
+  for (size_t idx = 0; idx < from.size(); idx++) {
+    probs_from[from[idx]].push_back(log2_probs[idx]);
+  }
+
+  // The most frequent probability is the default. Ties are broken by the
+  // smaller probability.
+  std::vector<int> exception_begin(num_states + 1, 0);
+  for (int state = 0; state < num_states; state++) {
+    std::vector<Score>& probs = probs_from[state];
+    std::sort(probs.begin(), probs.end());
+    int best_count = 0;
+    for (size_t begin = 0, end; begin < probs.size(); begin = end) {
+      end = std::upper_bound(probs.begin() + begin, probs.end(),
+                             probs[begin]) - probs.begin();
+      if ((int)(end - begin) > best_count) {
+        best_count = end - begin;
+        default_log2_probs_[state] = probs[begin];
+      }
+    }
+
+    exception_begin[state] = exception_from_.size();
+    for (size_t idx = 0; idx < probs.size(); idx++) {
+      if (probs[idx] == default_log2_probs_[state]) continue;
+      if (idx > 0 && probs[idx] == probs[idx - 1]) continue;
+      exception_from_.push_back(state);
+      exception_log2_probs_.push_back(probs[idx]);
+    }
+  }
+  exception_begin[num_states] = exception_from_.size();
+
+  value_idx_.resize(from.size());
+  for (size_t idx = 0; idx < from.size(); idx++) {
+    int state = from[idx];
+    if (log2_probs[idx] == default_log2_probs_[state]) {
+      value_idx_[idx] = state;
+      continue;
+    }
+    int exception =
+        std::lower_bound(
+            exception_log2_probs_.begin() + exception_begin[state],
+            exception_log2_probs_.begin() + exception_begin[state + 1],
+            log2_probs[idx]) - exception_log2_probs_.begin();
+    value_idx_[idx] = num_states_ + exception;
+  }
+}
+
+template <typename Score>
+void CompressedTransitions<Score>::expandRow(const Score* prev,
+                                             Score* values) const {
+  for (int state = 0; state < num_states_; state++) {
+    values[state] = prev[state] + default_log2_probs_[state];
+  }
+  Score* exception_values = values + num_states_;
+  for (int exception = 0; exception < numExceptions(); exception++) {
+    exception_values[exception] =
+        prev[exception_from_[exception]] + exception_log2_probs_[exception];
+  }
+}
+
+template <typename Score>
+size_t CompressedTransitions<Score>::memoryUsage() const {
+  return value_idx_.size() * sizeof(int) +
+         default_log2_probs_.size() * sizeof(Score) +
+         exception_from_.size() * (sizeof(int) + sizeof(Score)) +
+         valuesSize() * sizeof(Score);
+}
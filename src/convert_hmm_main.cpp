@@ -0,0 +1,48 @@
+// Commandline tool for converting HMM between JSON and binary format.
+
+#include <fstream>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "src/hmm.h"
+#include "src/hmm_binary.h"
+
+#include <json/value.h>
+#include <json/reader.h>
+
+DEFINE_string(input, "",
+              "HMM in JSON or binary format. The format is detected from the "
+              "content of the file.");
+
+DEFINE_string(output, "",
+              "Output file. JSON input is converted to binary format and "
+              "binary input to JSON.");
+
+int main(int argc, char** argv) {
+  google::SetUsageMessage(
+      "Commandline tool for converting HMM between JSON and binary format.");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  MappedFile input(FLAGS_input);
+  std::ofstream out(FLAGS_output, std::ios::binary);
+  CHECK(out.is_open()) << "Cannot open " << FLAGS_output;
+
+  if (isBinaryModel(input.data(), input.size())) {
+    ::HMM<double> hmm(BinaryModelView(input.data(), input.size()));
+    out << hmm.toJsonStr();
+    LOG(INFO) << "Converted binary model to JSON.";
+  } else {
+    Json::Value value;
+    Json::Reader reader;
+    CHECK(reader.parse(input.data(), input.data() + input.size(), value,
+                       false)) << "Cannot parse " << FLAGS_input;
+    ::HMM<double> hmm(value);
+    out << hmm.toBinaryStr();
+    LOG(INFO) << "Converted JSON to binary model.";
+  }
+
+  return 0;
+}
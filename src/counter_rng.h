@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random number generator. The n-th number of a stream depends
+// only on the seed, id of the stream and n. Therefore every sample can have
+// its own stream and results do not depend on the order in which samples are
+// computed or on number of threads. Output function is the SplitMix64 mixer.
+class CounterRng {
+ public:
+  CounterRng(uint64_t seed, uint64_t stream)
+      : key_(mix(seed ^ mix(stream * kGamma + kGamma))), counter_(0) {}
+
+  // Next 64 random bits.
+  uint64_t next() {
+    counter_++;
+    return mix(key_ + counter_ * kGamma);
+  }
+
+  // Uniformly distributed number from [0,1).
+  double nextUniform() {
+    // 53 random bits fill the mantissa of double.
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+ private:
+  static const uint64_t kGamma = 0x9e3779b97f4a7c15ULL;
+
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t key_;
+  uint64_t counter_;
+};
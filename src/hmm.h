@@ -1,14 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <cmath>
+#include <functional>
 #include <memory>
 #include <random>
 #include <typeinfo>
 
 #include <json/value.h>
 
+#include "compressed_transitions.h"
+#include "counter_rng.h"
+#include "hmm_binary.h"
+#include "log2_kernels.h"
 #include "log2_num.h"
+#include "packed_matrix.h"
 #include "gtest/gtest_prod.h"
 
 // Transition from one state to another.
@@ -68,6 +75,8 @@ class GaussianState : public State<double> {
   bool isSilent() const { return false; }
   Log2Num prob(const double& emission) const;
   Json::Value toJsonValue() const;
+  double mu() const { return mu_; }
+  double sigma() const { return sigma_; }
 
   bool operator==(const State<double>& state) const {
     if (typeid(*this) != typeid(state)) return false;
@@ -82,13 +91,302 @@ class GaussianState : public State<double> {
   double sigma_;
 };
 
+// Emission probabilities of all states computed one column at a time. Gaussian
+// states are stored as arrays of parameters and the whole column is computed
+// directly in log space without virtual calls. Other non-silent states fall
+// back to State::prob. Silent states have probability 1.
+template <typename EmissionType>
+class StateEmissions {
+ public:
+  explicit StateEmissions(
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states);
+
+  int size() const { return silent_.size(); }
+  bool isSilent(int state_id) const { return silent_[state_id]; }
+  // Sets (*probs)[state_id] to the probability that state_id emits @emission
+  // for every state. Probabilities are computed with doubles and rounded to
+  // @Real.
+  template <typename Real>
+  void column(const EmissionType& emission,
+              std::vector<BasicLog2Num<Real>>* probs) const;
+  // The same as above but stores the probabilities to array @probs.
+  template <typename Real>
+  void column(const EmissionType& emission, BasicLog2Num<Real>* probs) const;
+  // The same as above but only for states in @state_ids.
+  template <typename Real>
+  void column(const EmissionType& emission, const std::vector<int>& state_ids,
+              std::vector<BasicLog2Num<Real>>* probs) const;
+  // Sets probabilities of non-silent states which are not Gaussian.
+  template <typename Real>
+  void fallbackColumn(const EmissionType& emission,
+                      BasicLog2Num<Real>* probs) const;
+  // Upper bound of the error of log2 of emission probability of Gaussian
+  // states interpolated linearly between emissions @spacing apart. Log2 of
+  // Gaussian density is a parabola so the bound is
+  // spacing^2 * log2(e) / (8 * sigma^2) for the smallest sigma.
+  double interpolationError(double spacing) const;
+  // Is @state_id non-silent and either not Gaussian or with mu within
+  // @sigmas standard deviations of @emission?
+  bool isActive(const EmissionType& emission, int state_id,
+                double sigmas) const {
+    if (silent_[state_id]) return false;
+    if (fallback_[state_id] != nullptr) return true;
+    return std::abs(emission - mu_[state_id]) * inv_sigma_[state_id] <=
+           sigmas;
+  }
+  // Stores all active states for @emission to @res in ascending order. Gaussian
+  // states are found by binary search in states sorted by mu. If no Gaussian
+  // state is active, all non-silent states are.
+  void activeStates(const EmissionType& emission, double sigmas,
+                    std::vector<int>* res) const;
+
+ private:
+  // Returns @state if it is GaussianState and null otherwise.
+  static const GaussianState* asGaussian(
+      const State<EmissionType>& /* state */) {
+    return nullptr;
+  }
+  // Log2 of emission probability computed from the arrays of parameters.
+  double log2Prob(const EmissionType& /* emission */,
+                  int /* state_id */) const {
+    return 0;
+  }
+
+  std::vector<char> silent_;
+  // Parameters of Gaussian states. Other states have all parameters zero so
+  // log2Prob gives zero for them.
+  std::vector<double> mu_;
+  std::vector<double> inv_sigma_;
+  // log2(1/(sigma*sqrt(2*pi)))
+  std::vector<double> log2_norm_;
+  // Non-silent states which are not Gaussian. Null for other states.
+  std::vector<const State<EmissionType>*> fallback_;
+  std::vector<int> fallback_ids_;
+  // Gaussian states sorted by mu and their mu.
+  std::vector<int> gaussian_by_mu_;
+  std::vector<double> sorted_mu_;
+  double max_sigma_;
+};
+
+// Log2 of emission probabilities of all states for all emissions of one read.
+// The same table can be passed to Viterbi algorithm, sampling and posterior
+// decoding of the read so that every probability is computed only once.
+// Rows are computed in tiles of @tile_rows consecutive emissions when a row of
+// the tile is needed for the first time and only one tile is kept in memory.
+// If the tile is shorter than the read the table is streamed through the tile
+// instead of being stored whole, but every pass over the read computes the
+// tiles again. @emissions have to outlive the table.
+template <typename EmissionType, typename Real = double>
+class EmissionTable {
+ public:
+  EmissionTable(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      int tile_rows);
+  // Quantized table. Emission probabilities of all states are computed only
+  // in points @bin_width apart covering all emissions of the read and rows
+  // interpolate log2 of them linearly. States which are neither silent nor
+  // Gaussian are computed exactly. Emissions have to be numbers.
+  EmissionTable(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      int tile_rows, double bin_width);
+
+  // Rows of a tile of @num_states states which takes at most @max_bytes,
+  // but at most @max_rows and at least one.
+  static int tileRowsForBudget(int num_states, int max_rows,
+                               size_t max_bytes) {
+    size_t row_bytes = (size_t)num_states * sizeof(BasicLog2Num<Real>);
+    size_t rows = max_bytes / std::max<size_t>(row_bytes, 1);
+    return std::max<size_t>(1, std::min<size_t>(max_rows, rows));
+  }
+
+  int rows() const { return emissions_.size(); }
+  int tileRows() const { return tile_rows_; }
+  // Emission probabilities of emissions[i] for all states. The pointer is
+  // valid until a row of another tile is requested.
+  const BasicLog2Num<Real>* row(int i) {
+    if (tile_begin_ < 0 || i < tile_begin_ || i >= tile_begin_ + tile_rows_) {
+      computeTile(i / tile_rows_ * tile_rows_);
+    }
+    return &tile_[(size_t)(i - tile_begin_) * state_emissions_.size()];
+  }
+  // Number of tiles computed so far.
+  int computedTiles() const { return computed_tiles_; }
+  // Upper bound of the difference between log2 of probability in the table
+  // and the exact one. Zero if the table is not quantized.
+  double maxLog2Error() const {
+    return bin_width_ > 0 ? state_emissions_.interpolationError(bin_width_)
+                          : 0;
+  }
+  int gridPoints() const { return grid_points_; }
+
+ private:
+  void computeTile(int begin);
+  void interpolateRow(const EmissionType& emission,
+                      BasicLog2Num<Real>* res) const;
+
+  const std::vector<EmissionType>& emissions_;
+  StateEmissions<EmissionType> state_emissions_;
+  int tile_rows_;
+  // The first row of the tile in memory or -1.
+  int tile_begin_;
+  std::vector<BasicLog2Num<Real>> tile_;
+  int computed_tiles_;
+  // Distance of points of the quantized table. Zero if rows are exact.
+  double bin_width_;
+  double grid_begin_;
+  int grid_points_;
+  // Emission probabilities of all states in the points grid_begin_,
+  // grid_begin_ + bin_width_, ... row by row.
+  std::vector<Log2Num> grid_;
+};
+
+// States allowed in banded decoding, e.g. around a path found by another
+// decoder. states_[i] are the non-silent states which can emit emissions[i],
+// in ascending order. Silent states are always allowed.
+struct StateBand {
+  StateBand() : expand_log2_drop_(HUGE_VAL) {}
+
+  std::vector<std::vector<int>> states_;
+  // Column is computed for all states if the greatest probability in the band
+  // is smaller than 2^-expand_log2_drop_ times the greatest probability in
+  // the previous column or if no state of the band is reachable.
+  double expand_log2_drop_;
+};
+
+// Parameters of Viterbi algorithm. Default values give exact Viterbi.
+struct ViterbiParams {
+  ViterbiParams()
+      : beam_log2_margin_(HUGE_VAL), beam_max_states_(0),
+        checkpointing_(false), fixed_point_scale_(0),
+        validate_fixed_point_(false), threads_(1), emission_gate_sigmas_(0),
+        band_(nullptr), compressed_transitions_(false) {}
+
+  // Beam pruning. After every column of the Viterbi matrix is computed only
+  // states with probability at least 2^-beam_log2_margin_ times probability of
+  // the best state in the column survive. Only survivors are expanded to the
+  // next column.
+  double beam_log2_margin_;
+  // At most beam_max_states_ best states survive in every column. Zero means
+  // there is no limit.
+  int beam_max_states_;
+  // Instead of keeping backpointers for the whole read keep only every
+  // sqrt(T)-th row of probabilities and recompute backpointers segment by
+  // segment during backtracking. Memory is O(sqrt(T)*states) and every column
+  // is computed twice. The result is the same as without checkpointing.
+  bool checkpointing_;
+  // If positive, Viterbi matrix is computed with int32 numbers. Log2 of
+  // transition and emission probabilities are multiplied by
+  // fixed_point_scale_ and rounded, so paths whose log2 probabilities differ
+  // by less than about length/fixed_point_scale_ can be swapped. Cannot be
+  // combined with beam pruning and checkpointing.
+  double fixed_point_scale_;
+  // Fixed point Viterbi also runs floating point Viterbi and logs a warning
+  // if the paths differ.
+  bool validate_fixed_point_;
+  // Number of threads computing every column of the Viterbi matrix.
+  // Non-silent states of the column are split among the threads and silent
+  // states are computed after them. The path is the same for any number of
+  // threads. Cannot be combined with beam pruning and fixed point.
+  int threads_;
+  // If positive, every column computes only states active for its emission:
+  // Gaussian states with mu within emission_gate_sigmas_ standard deviations
+  // of the emission. Other non-silent states get probability zero, so paths
+  // through them are lost. Emissions are computed only for active states, so
+  // the emission table is read only by columns computed for all states. Can
+  // be combined with beam pruning and checkpointing but not with fixed point
+  // and multiple threads.
+  double emission_gate_sigmas_;
+  // If not null, every column computes only states of the band. It has to be
+  // computed for the same emissions and outlive the decoding. Can be combined
+  // with checkpointing but not with the other options.
+  const StateBand* band_;
+  // Non-silent states read transitions from HMM::compressedTransitions()
+  // instead of the list of all transitions. The path is the same. Can be
+  // combined with checkpointing and multiple threads but not with the other
+  // options.
+  bool compressed_transitions_;
+
+  bool isBeamSearch() const {
+    return beam_log2_margin_ != HUGE_VAL || beam_max_states_ > 0;
+  }
+};
+
+// Parameters of sampling from posterior probability.
+struct SamplingParams {
+  SamplingParams()
+      : threads_(1), batched_traceback_(false), scaled_forward_(false),
+        forward_threads_(1), emission_gate_sigmas_(0), band_(nullptr),
+        compressed_transitions_(false) {}
+
+  // Number of threads used for backtracking of samples. Every sample uses its
+  // own random stream so the result does not depend on number of threads.
+  int threads_;
+  // All samples of a thread are backtracked together row by row. Every row of
+  // the forward matrix is read only once and samples in the same state are
+  // processed together. Samples are the same as without batching.
+  bool batched_traceback_;
+  // Forward matrix is computed with doubles in linear space. Every column is
+  // rescaled so it doesn't underflow. Additions are plain floating point
+  // operations instead of log2/exp2. Weights differ from the log space
+  // computation only by rounding errors.
+  bool scaled_forward_;
+  // Number of threads computing every column of the forward matrix in the
+  // same way as ViterbiParams::threads_. Weights are the same for any number
+  // of threads. Cannot be combined with scaled_forward_.
+  int forward_threads_;
+  // Forward matrix is computed only for active states as in
+  // ViterbiParams::emission_gate_sigmas_. Samples never pass through other
+  // states. Cannot be combined with scaled_forward_ and forward_threads_.
+  double emission_gate_sigmas_;
+  // Forward matrix is computed only for states of the band as in
+  // ViterbiParams::band_. The same restrictions as for emission gating.
+  const StateBand* band_;
+  // Forward matrix reads transitions of non-silent states from
+  // HMM::compressedTransitions(). Weights are the same. Can be combined with
+  // forward_threads_ but not with scaled_forward_, emission gating and band.
+  bool compressed_transitions_;
+};
+
+// Fixed point Viterbi path compared with the floating point one.
+struct FixedPointValidation {
+  std::vector<int> state_ids_;
+  std::vector<int> reference_state_ids_;
+  // Number of emissions emitted by different states in the two paths.
+  int differing_emissions_;
+};
+
+// Viterbi path and samples from posterior probability of the same read.
+struct ViterbiAndSamples {
+  std::vector<int> viterbi_state_ids_;
+  std::vector<std::vector<int>> samples_;
+};
+
+// Result of posterior decoding.
+struct PosteriorDecoding {
+  // Initial state followed by the state with the greatest posterior
+  // probability for every emission.
+  std::vector<int> state_ids_;
+  // posteriors_[i] is posterior probability that state_ids_[i+1] emitted
+  // emissions[i].
+  std::vector<double> posteriors_;
+};
+
+template <typename EmissionType>
+class OnlineViterbi;
+
 // Hidden Markov Model with silent states. It has one initial state.
 // States for the HMM has to be calculated for every emissions sequence because
 // that's the way it is in ONT data.
-template <typename EmissionType>
+// Dynamic programming of Viterbi, forward and backward algorithm stores log2
+// of probabilities as @Score. It is double or float. Float halves memory of
+// the matrices and doubles width of SIMD kernels. Transition probabilities of
+// the model are always doubles and they are rounded to @Score.
+template <typename EmissionType, typename Score = double>
 class HMM {
  public:
-  HMM() {}
+  HMM() : kmer_length_(0), compiled_(false) {}
 
   // States are evaluated in ascending order by id during DP.
   // Therefore we have to put restriction on transitions going
@@ -100,6 +398,17 @@ class HMM {
 
   // Constructs HMM from JSON.
   HMM(const Json::Value& hmm_json);
+  // Constructs HMM from binary model. See hmm_binary.h.
+  explicit HMM(const BinaryModelView& model);
+
+  // Validates the HMM for states with the same silent states as @states and
+  // precomputes the order of silent states. Afterwards states of a read are
+  // only checked to have the same silent states instead of validating all
+  // transitions for every read. Throws std::invalid_argument if the HMM is
+  // not valid. Call it before the HMM is shared by threads.
+  void compile(
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states);
+  bool isCompiled() const { return compiled_; }
 
   // Runs Viterbi algorithm and returns sequence of states.
   // @emission_seq - sequence of emissions - MinION read.
@@ -107,6 +416,50 @@ class HMM {
   std::vector<int> runViterbiReturnStateIds(
       const std::vector<EmissionType>& emission_seq,
       const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+  // The same as above but allows approximate variants of Viterbi algorithm.
+  // See ViterbiParams.
+  std::vector<int> runViterbiReturnStateIds(
+      const std::vector<EmissionType>& emission_seq,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params) const;
+  // The same as above but emission probabilities are read from
+  // @emission_table which has to be computed for the same emissions and
+  // states. Fixed point Viterbi computes its own emission probabilities.
+  std::vector<int> runViterbiReturnStateIds(
+      const std::vector<EmissionType>& emission_seq,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Runs fixed point Viterbi given by @params and floating point Viterbi and
+  // compares the paths.
+  FixedPointValidation validateFixedPointViterbi(
+      const std::vector<EmissionType>& emission_seq,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params) const;
+  // Batched decoding of many reads. Reads share transitions so they are
+  // decoded together with one read per SIMD lane. states[i] are states of
+  // emission_seqs[i] because every read has its own emission parameters.
+  // Only for double scores.
+  // res[i] is the same as runViterbiReturnStateIds for read i.
+  std::vector<std::vector<int>> runViterbiBatch(
+      const std::vector<std::vector<EmissionType>>& emission_seqs,
+      const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+          states) const;
+  // res[i] are samples for read i. Forward matrices of all reads are computed
+  // together and they differ from posteriorProbSample only by rounding
+  // errors. Read i is sampled with seed batchReadSeed(@seed, i) so reads do
+  // not share the random stream. params.scaled_forward_ is not supported.
+  std::vector<std::vector<std::vector<int>>> posteriorProbSampleBatch(
+      int samples, int seed,
+      const std::vector<std::vector<EmissionType>>& emission_seqs,
+      const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+          states,
+      const SamplingParams& params) const;
+  // Seed of read @read of a batch sampled with @seed.
+  static int batchReadSeed(int seed, int read) {
+    return CounterRng(seed, read).next() >> 33;
+  }
+
   // Samples from P(state_sequence|emission_sequence) and returns n sequences of
   // states.
   // @samples - number of samples in the result.
@@ -115,39 +468,446 @@ class HMM {
   std::vector<std::vector<int>> posteriorProbSample(
       int samples, int seed, const std::vector<EmissionType>& emissions,
       const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+  // The same as above with additional parameters. See SamplingParams.
+  std::vector<std::vector<int>> posteriorProbSample(
+      int samples, int seed, const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const SamplingParams& params) const;
+  // The same as above with emission probabilities from @emission_table.
+  std::vector<std::vector<int>> posteriorProbSample(
+      int samples, int seed, const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const SamplingParams& params,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+
+  // Runs Viterbi algorithm and samples from posterior probability in a single
+  // sweep over the emissions. Viterbi and forward matrices are computed
+  // column by column together so every cell uses the same emission
+  // probability and incoming transitions while they are in cache. The result
+  // is the same as from runViterbiReturnStateIds with default ViterbiParams
+  // and posteriorProbSample with @params. Columns are computed by
+  // params.forward_threads_ threads. params.scaled_forward_ is not supported.
+  ViterbiAndSamples runViterbiAndSample(
+      int samples, int seed, const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const SamplingParams& params) const;
+  // The same as above with emission probabilities from @emission_table.
+  ViterbiAndSamples runViterbiAndSample(
+      int samples, int seed, const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const SamplingParams& params,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+
+  // Computes posterior probabilities with forward-backward algorithm.
+  // res[i][state] is probability that @state emitted emissions[i] given the
+  // whole sequence of emissions. Silent states have zero probability.
+  std::vector<std::vector<double>> statePosteriors(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+  // For every emission picks the state with the greatest posterior
+  // probability.
+  PosteriorDecoding posteriorDecoding(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+  // The same as above with emission probabilities from @emission_table.
+  PosteriorDecoding posteriorDecoding(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      EmissionTable<EmissionType, Score>* emission_table) const;
 
   // Serializes transitions to JSON.
   std::string toJsonStr() const;
+  // Serializes transitions to binary model. Probabilities are stored exactly.
+  std::string toBinaryStr() const;
+
+  int initialState() const { return initial_state_; }
+  // Length of kmers if states of the model are kmers (see move_hmm.h) and 0
+  // otherwise. It is only stored with the model and not used by HMM.
+  int kmerLength() const { return kmer_length_; }
+  void setKmerLength(int kmer_length) { kmer_length_ = kmer_length; }
+  // transitions()[i] are transitions going from state i.
+  const std::vector<std::vector<Transition>>& transitions() const {
+    return transitions_;
+  }
+  // Inverse transitions compressed to default probabilities of states and
+  // exceptions. See ViterbiParams::compressed_transitions_.
+  const CompressedTransitions<Score>& compressedTransitions() const {
+    return compressed_transitions_;
+  }
 
  private:
+  friend class OnlineViterbi<EmissionType>;
   FRIEND_TEST(HMMTest, ComputeViterbiMatrixTest);
+  FRIEND_TEST(HMMTest, ComputeBeamViterbiMatrixNoPruningTest);
+  FRIEND_TEST(RandomHMMTest, BeamViterbiMaxStatesTest);
   FRIEND_TEST(HMMTest, ForwardTrackingTest);
+  FRIEND_TEST(RandomHMMTest, ForwardTrackingScaledTest);
+  FRIEND_TEST(RandomHMMTest, ForwardTrackingThreadsTest);
+  FRIEND_TEST(RandomHMMTest, ForwardTrackingSparseTest);
+  FRIEND_TEST(RandomHMMTest, ForwardTrackingBatchTest);
   FRIEND_TEST(HMMTest, ComputeInvTransitions);
+  FRIEND_TEST(HMMTest, LastStateSampleTest);
   FRIEND_TEST(HMMTest, HMMDeserializationTest);
 
-  typedef typename std::pair<Log2Num, int> ProbStateId;
-  typedef typename std::vector<std::vector<ProbStateId>> ViterbiMatrix;
-  typedef typename std::vector<std::vector<std::vector<double>>> ForwardMatrix;
-  typedef typename std::vector<std::vector<std::discrete_distribution<int>>>
-      SamplingMatrix;
-
-  // Finds best path to @state after @steps using @prob[steps][state].
-  // Helper method for Viterbi algorithm.
-  ProbStateId bestPathTo(int state_id, const State<EmissionType>& state,
-                         int emissions_prefix_len,
-                         const EmissionType& last_emission,
-                         const ViterbiMatrix& prob) const;
-  // Computes matrix which is used in Viterbi alorithm.
+  typedef BasicLog2Num<Score> Log2Score;
+  typedef typename std::pair<Log2Score, int> ProbStateId;
+  // Result of Viterbi algorithm. Only the last row of probabilities is kept.
+  // backpointers_[i][u] = 0 <=> there is no path matching emissions[0...i-1]
+  // and ending in state u. Otherwise backpointers_[i][u] = j+1 and
+  // inv_transitions_[u][j] is the state before u on the most probable path.
+  struct ViterbiMatrix {
+    PackedMatrix backpointers_;
+    std::vector<Log2Score> last_row_;
+  };
+  // Result of forward algorithm used for sampling. All weights are stored in
+  // one array. Row i contains weights for all transitions in
+  // inv_transitions_ in the order given by inv_offsets_.
+  struct ForwardMatrix {
+    // Cumulative weights for sampling the state before @state in @row. There
+    // is one weight for every transition in inv_transitions_[state].
+    Score* cumulativeWeights(int row, int state) {
+      return &weights_[weightsOffset(row, state)];
+    }
+    const Score* cumulativeWeights(int row, int state) const {
+      return &weights_[weightsOffset(row, state)];
+    }
+    size_t weightsOffset(int row, int state) const {
+      if (row_begin_.empty()) {
+        return (size_t)row * inv_offsets_.back() + inv_offsets_[state];
+      }
+      std::vector<int>::const_iterator first =
+          row_states_.begin() + row_begin_[row];
+      std::vector<int>::const_iterator last =
+          row_states_.begin() + row_begin_[row + 1];
+      return state_weights_[std::lower_bound(first, last, state) -
+                            row_states_.begin()];
+    }
+
+    int rows_;
+    std::vector<int> inv_offsets_;
+    std::vector<Score> weights_;
+    // Sparse matrix has weights only of some states in every row. States of
+    // row i are row_states_[row_begin_[i] ... row_begin_[i+1]-1] sorted by id
+    // and weights of row_states_[j] start at weights_[state_weights_[j]].
+    // Empty if the matrix is dense.
+    std::vector<size_t> row_begin_;
+    std::vector<int> row_states_;
+    std::vector<size_t> state_weights_;
+    // Cumulative weights for sampling the last state of the path.
+    std::vector<Score> last_state_weights_;
+  };
+
+  // Finds best path to @state_id. Non-silent state extends paths from
+  // @prev_row and silent state extends paths from @curr_row. Returns
+  // probability of the path and index to inv_transitions_[state_id] of the
+  // previous state or kNoState. Helper method for Viterbi algorithm.
+  // If @values is not null, it is @prev_row expanded by
+  // CompressedTransitions::expandRow and non-silent state reads it instead.
+  ProbStateId bestPathTo(int state_id, bool silent,
+                         const Log2Score& emission_prob,
+                         const std::vector<Log2Score>& prev_row,
+                         const std::vector<Log2Score>& curr_row,
+                         const Score* values) const;
+  // Throws std::invalid_argument if @emission_table is not null and it is not
+  // computed for @emissions.
+  static void checkEmissionTable(
+      const std::vector<EmissionType>& emissions,
+      const EmissionTable<EmissionType, Score>* emission_table);
+  // Throws std::invalid_argument if @band is not null and has a different
+  // number of columns than @emissions.
+  static void checkBand(const std::vector<EmissionType>& emissions,
+                        const StateBand* band);
+  // Non-silent states computed in column @i of sparse decoding. States of
+  // @band if it is not null, otherwise states active for @emission.
+  static void sparseColumnStates(
+      const StateEmissions<EmissionType>& state_emissions,
+      const EmissionType& emission, int i, double sigmas,
+      const StateBand* band, std::vector<int>* res);
+  // The greatest probability of @state_ids in @row.
+  static Log2Score bestOf(const std::vector<int>& state_ids,
+                          const std::vector<Log2Score>& row);
+  // Did the greatest probability in the band drop too much from the previous
+  // column? Always false without band.
+  static bool bandCollapsed(const StateBand* band, const Log2Score& best,
+                            const Log2Score& prev_best);
+  // Emission probabilities of emissions[i] for all states. They are read from
+  // @emission_table unless it is null. Otherwise they are computed into
+  // @buffer.
+  const Log2Score* emissionColumn(
+      const std::vector<EmissionType>& emissions, int i,
+      const StateEmissions<EmissionType>& state_emissions,
+      EmissionTable<EmissionType, Score>* emission_table,
+      std::vector<Log2Score>* buffer) const;
+  // Computes probabilities of @state_ids in the given order in one column of
+  // Viterbi matrix and stores them in @curr_row. @emission_probs has to
+  // contain emission probabilities of @state_ids for the column. Previous
+  // states are stored into @backpointer_row of @backpointers unless
+  // @backpointers is null.
+  void computeViterbiColumn(const std::vector<int>& state_ids,
+                            const StateEmissions<EmissionType>& state_emissions,
+                            const Log2Score* emission_probs,
+                            const std::vector<Log2Score>& prev_row,
+                            std::vector<Log2Score>* curr_row,
+                            PackedMatrix* backpointers,
+                            int backpointer_row) const;
+  // The same as above with expanded @prev_row. See bestPathTo.
+  void computeViterbiColumn(const std::vector<int>& state_ids,
+                            const StateEmissions<EmissionType>& state_emissions,
+                            const Log2Score* emission_probs,
+                            const std::vector<Log2Score>& prev_row,
+                            const Score* values,
+                            std::vector<Log2Score>* curr_row,
+                            PackedMatrix* backpointers,
+                            int backpointer_row) const;
+  // Expands @prev_row to @values if it is not null. Returns @values.
+  Score* expandRow(const std::vector<Log2Score>& prev_row,
+                   std::vector<Score>* values) const;
+  // Runs forward sweep of Viterbi algorithm over emissions[begin...end-1].
+  // @row contains probabilities for emissions prefix of length @begin and it
+  // is replaced by probabilities for prefix of length @end. Backpointers for
+  // prefix of length i are stored into row i-@begin of @backpointers unless it
+  // is null. If @checkpoints is not null then rows for every prefix length
+  // divisible by @checkpoint_interval are appended to it. Emission
+  // probabilities are read from @emission_table unless it is null.
+  void viterbiSweep(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params, int begin, int end,
+      std::vector<Log2Score>* row, PackedMatrix* backpointers,
+      std::vector<std::vector<Log2Score>>* checkpoints,
+      int checkpoint_interval,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // viterbiSweep without beam pruning where every column is computed by a
+  // team of params.threads_ threads.
+  void viterbiSweepTeam(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params, int begin, int end,
+      std::vector<Log2Score>* row, PackedMatrix* backpointers,
+      std::vector<std::vector<Log2Score>>* checkpoints,
+      int checkpoint_interval,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Splits non-silent states into @threads lists of consecutive ids with
+  // about the same number of incoming transitions. Lists start at multiples
+  // of @align.
+  std::vector<std::vector<int>> splitStates(
+      const StateEmissions<EmissionType>& state_emissions, int threads,
+      int align) const;
+  // Computes matrix which is used in Viterbi alorithm. Beam pruning is done
+  // according to @params.
   ViterbiMatrix computeViterbiMatrix(
       const std::vector<EmissionType>& emissions,
-      const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Viterbi algorithm which stores only checkpoint rows of probabilities and
+  // recomputes backpointers during backtracking.
+  std::vector<int> runCheckpointedViterbi(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Viterbi algorithm with fixed point numbers. See
+  // ViterbiParams::fixed_point_scale_.
+  std::vector<int> runFixedPointViterbi(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const ViterbiParams& params) const;
+  // Sets probability of all cells in @row which are not good enough according
+  // to beam parameters to zero. Returns ids of surviving states.
+  std::vector<int> pruneViterbiRow(const std::vector<int>& computed_states,
+                                   const ViterbiParams& params,
+                                   std::vector<Log2Score>* row) const;
+  // Float exponents of long reads lose precision as they grow. Therefore rows
+  // of float matrices are divided by their greatest number after every
+  // column. Double rows are kept as they are.
+  static const bool kRescaleRows = sizeof(Score) < sizeof(double);
+  // Divides @row by its greatest number if kRescaleRows and returns log2 of
+  // the divisor. Otherwise returns zero.
+  static double rescaleRow(std::vector<Log2Score>* row);
+  // The same for @row whose cells other than @state_ids are zero.
+  static double rescaleRow(const std::vector<int>& state_ids,
+                           std::vector<Log2Score>* row);
+  // The state with the greatest probability in @row. The first one if there
+  // are more of them.
+  int bestTerminalState(const std::vector<Log2Score>& row) const;
+  // Converts backpointer to id of the previous state.
+  int previousState(const PackedMatrix& backpointers, int row,
+                    int state_id) const {
+    uint32_t backpointer = backpointers.get(row, state_id);
+    if (backpointer == 0) return kNoState;
+    return inv_transitions_[state_id][backpointer - 1].to_state_;
+  }
+  // Allocates matrix for backpointers with @rows rows.
+  PackedMatrix allocateBackpointers(int rows) const {
+    return PackedMatrix(rows, num_states_, max_in_degree_);
+  }
   // Computes matrix res[i][j][k] which means:
   // Sum of probabilities of all paths of form
-  // initial_state -> ... -> inv_transitions_[j][k] -> j
-  // and emitting emissions[0... i-1].
+  // initial_state -> ... -> inv_transitions_[j][l] -> j for l <= k
+  // and emitting emissions[0... i-1] normalized by the sum for all l.
   ForwardMatrix forwardTracking(
       const std::vector<EmissionType>& emissions,
       const std::vector<std::unique_ptr<State<EmissionType>>>& states) const;
+  // The same as above where every column is computed by @threads threads and
+  // emission probabilities are read from @emission_table unless it is null.
+  ForwardMatrix forwardTracking(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      int threads, EmissionTable<EmissionType, Score>* emission_table) const;
+  // The same as above reading compressed transitions if @compressed is true.
+  ForwardMatrix forwardTracking(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      int threads, bool compressed,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Computes sums of all paths ending in @state_ids in the given order for
+  // one column of the forward matrix and stores them in @curr_row.
+  // Normalized cumulative weights are stored to row @prefix_len of @res.
+  // @path_probs is a buffer with at least max_in_degree_ numbers.
+  void computeForwardColumn(const std::vector<int>& state_ids,
+                            const StateEmissions<EmissionType>& state_emissions,
+                            const Log2Score* emission_probs,
+                            const std::vector<Log2Score>& prev_row,
+                            std::vector<Log2Score>* curr_row,
+                            Score* path_probs, int prefix_len,
+                            ForwardMatrix* res) const;
+  // The same as above with expanded @prev_row. See bestPathTo.
+  void computeForwardColumn(const std::vector<int>& state_ids,
+                            const StateEmissions<EmissionType>& state_emissions,
+                            const Log2Score* emission_probs,
+                            const std::vector<Log2Score>& prev_row,
+                            const Score* values,
+                            std::vector<Log2Score>* curr_row,
+                            Score* path_probs, int prefix_len,
+                            ForwardMatrix* res) const;
+  // Computes sum of all paths ending in @state for one column of the forward
+  // matrix. See computeForwardColumn and bestPathTo.
+  void computeForwardCell(int state, bool silent,
+                          const Log2Score& emission_prob,
+                          const std::vector<Log2Score>& prev_row,
+                          const Score* values,
+                          std::vector<Log2Score>* curr_row, Score* path_probs,
+                          int prefix_len, ForwardMatrix* res) const;
+  // Computes Viterbi matrix and forward matrix together with @threads threads.
+  // Both are the same as from computeViterbiMatrix and forwardTracking.
+  void fusedSweep(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      int threads, EmissionTable<EmissionType, Score>* emission_table,
+      ViterbiMatrix* viterbi, ForwardMatrix* forward) const;
+  // Computes the column of @viterbi and @forward for @state_ids. Every state
+  // is computed by computeViterbiColumn and computeForwardColumn.
+  void computeFusedColumn(const std::vector<int>& state_ids,
+                          const StateEmissions<EmissionType>& state_emissions,
+                          const Log2Score* emission_probs,
+                          const std::vector<Log2Score>& viterbi_prev,
+                          std::vector<Log2Score>* viterbi_curr,
+                          const std::vector<Log2Score>& forward_prev,
+                          std::vector<Log2Score>* forward_curr,
+                          Score* path_probs, int prefix_len,
+                          ViterbiMatrix* viterbi, ForwardMatrix* forward) const;
+  // Sets weights for sampling the last state from the last row of sums of
+  // probabilities of all paths.
+  void setLastStateWeights(const std::vector<Log2Score>& last_row,
+                           ForwardMatrix* res) const;
+  // Throws std::invalid_argument unless every read of the batch has its
+  // valid states. Lanes share silent states so they have to be the same in
+  // all reads.
+  void checkBatch(
+      const std::vector<std::vector<EmissionType>>& emission_seqs,
+      const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+          states) const;
+  // Lanes of batched decoding. Reads are sorted by length in descending order
+  // so that reads which are not finished in a column are the first lanes.
+  // res[lane] is id of the read.
+  static std::vector<int> batchLanes(
+      const std::vector<std::vector<EmissionType>>& emission_seqs);
+  // Stores emission probabilities of column @prefix_len of the first @active
+  // lanes into res[state * lanes.size() + lane].
+  void batchEmissions(
+      const std::vector<std::vector<EmissionType>>& emission_seqs,
+      const std::vector<StateEmissions<EmissionType>>& state_emissions,
+      const std::vector<int>& lanes, int prefix_len, int active,
+      std::vector<Log2Score>* res) const;
+  // forwardTracking for all reads of a batch. res[i] is for read i.
+  std::vector<ForwardMatrix> forwardTrackingBatch(
+      const std::vector<std::vector<EmissionType>>& emission_seqs,
+      const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+          states) const;
+  // The same as forwardTracking but computed in linear space with scaling.
+  ForwardMatrix forwardTrackingScaled(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // The same as forwardTracking but every column computes only silent states
+  // and the states of @band, or if it is null the states active within
+  // @sigmas standard deviations. The matrix is sparse and keeps weights only
+  // of the computed states.
+  ForwardMatrix forwardTrackingSparse(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      double sigmas, const StateBand* band,
+      EmissionTable<EmissionType, Score>* emission_table) const;
+  // Allocates zero weights of @state_ids in @row of sparse matrix @res. Rows
+  // are allocated in ascending order and allocating the last row again
+  // replaces it.
+  void allocateSparseRow(int row, const std::vector<int>& state_ids,
+                         ForwardMatrix* res) const;
+  // res[i][j] * 2^(*log2_scales)[i] - sum of probabilities of all paths from
+  // the initial state ending in state j and emitting emissions[0...i-1].
+  std::vector<std::vector<Log2Score>> forwardProbs(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      EmissionTable<EmissionType, Score>* emission_table,
+      std::vector<double>* log2_scales) const;
+  // Computes @curr_row of forwardProbs from @prev_row and emission
+  // probabilities @column_probs of its emission. Returns log2 of the divisor
+  // of rescaleRow.
+  double computeForwardProbsRow(
+      const StateEmissions<EmissionType>& state_emissions,
+      const Log2Score* column_probs, const std::vector<Log2Score>& prev_row,
+      std::vector<Log2Score>* curr_row) const;
+  // res[i * numStates() + j] * 2^(*log2_scales)[i] - sum of probabilities of
+  // all paths starting in state j after emitting emissions[0...i-1] and
+  // emitting emissions[i...]. The path can end in any state.
+  std::vector<Log2Score> backwardProbs(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      EmissionTable<EmissionType, Score>* emission_table,
+      std::vector<double>* log2_scales) const;
+  // Calls @callback(i, posteriors) for every emission where posteriors[j] is
+  // the posterior probability that state j emitted emissions[i]. Only the
+  // backward matrix is stored. Forward rows are computed as the callback is
+  // called.
+  void computePosteriors(
+      const std::vector<EmissionType>& emissions,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      EmissionTable<EmissionType, Score>* emission_table,
+      const std::function<void(int, const std::vector<double>&)>& callback)
+      const;
+  // Samples index from cumulative weights using uniformly distributed number
+  // from [0,1).
+  static int sampleCumulative(const Score* cumulative, int size,
+                              double uniform);
+  // Samples @samples paths from @forward_matrix as specified by @params.
+  std::vector<std::vector<int>> sampleForwardMatrix(
+      const ForwardMatrix& forward_matrix, int samples, int seed,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      const SamplingParams& params) const;
+  // Samples one path from the forward matrix using random stream
+  // (@seed, @sample_id).
+  std::vector<int> samplePath(
+      const ForwardMatrix& forward_matrix,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      uint64_t seed, int sample_id) const;
+  // Samples paths with ids @begin ... @end-1 together row by row and stores
+  // them into @res. Gives the same paths as samplePath.
+  void sampleBatch(
+      const ForwardMatrix& forward_matrix,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+      uint64_t seed, int begin, int end,
+      std::vector<std::vector<int>>* res) const;
   std::vector<int> backtrackMatrix(
       int last_state, int last_row,
       const std::vector<std::unique_ptr<State<EmissionType>>>& states,
@@ -159,8 +919,13 @@ class HMM {
   // 1) Initial state has to be silent.
   // 2) No transitions can go to initial state.
   // 3) Transition to silent state. Outgoing state has to have lower number.
+  // Compiled HMM only checks that @states have the compiled silent states.
   void isValid(const std::vector<std::unique_ptr<State<EmissionType>>>& states)
       const;
+  // Silent states in ascending order, which is the order of their
+  // computation in a column.
+  std::vector<int> silentStates(
+      const StateEmissions<EmissionType>& state_emissions) const;
 
   // This constant is used in Viterbi algorithm to denote that we cannot get
   // into this state. No previous state.
@@ -169,12 +934,32 @@ class HMM {
   int initial_state_;
   // Number of states including the initial state.
   int num_states_;
+  int kmer_length_;
 
   // List of transitions from one state to another with probabilities.
   // Ids of states are from 0 to transitions_.size()-1
   std::vector<std::vector<Transition>> transitions_;
   // Inverse transitions.
   std::vector<std::vector<Transition>> inv_transitions_;
+  // The greatest number of transitions going to one state.
+  int max_in_degree_;
+  // Transitions going to state j are at positions
+  // inv_offsets_[j] ... inv_offsets_[j+1]-1 when all inverse transitions are
+  // put into one array. inv_offsets_.back() is the number of all transitions.
+  std::vector<int> inv_offsets_;
+  // All inverse transitions in one array split into source states and log2 of
+  // probabilities. This is the layout used by log2 kernels.
+  std::vector<int> inv_from_;
+  std::vector<Score> inv_log2_probs_;
+  CompressedTransitions<Score> compressed_transitions_;
+  // Probabilities of transitions which read values expanded by
+  // compressed_transitions_. They are already added to the values.
+  std::vector<Score> zero_log2_probs_;
+
+  // Tables precomputed by compile.
+  bool compiled_;
+  std::vector<char> silent_;
+  std::vector<int> silent_states_;
 };
 
 // Implementation of template classes.
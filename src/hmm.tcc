@@ -6,6 +6,9 @@
 #include <random>
 #include <chrono>
 #include <numeric>
+#include <atomic>
+#include <thread>
+#include <type_traits>
 
 #include <cstdio>
 #include <cmath>
@@ -14,6 +17,7 @@
 #include <glog/logging.h>
 
 #include "log2_num.h"
+#include "thread_team.h"
 
 using std::chrono::system_clock;
 using std::chrono::duration_cast;
@@ -30,10 +34,220 @@ std::string template_to_str() {
   return pretty_function.substr(begin, length);
 }
 
+// log2(sqrt(2*pi)) and log2(e)/2 used for Gaussian density in log space.
+const double kLog2SqrtTwoPi = 0.5 * log2(2 * M_PI);
+const double kHalfLog2E = 0.5 * M_LOG2E;
+
+// The density is computed directly in log space so it does not underflow for
+// emissions far from mu.
 inline Log2Num GaussianState::prob(const double& emission) const {
   double frac = (emission - mu_) / sigma_;
-  double pi_sqrt = sqrt(2 * M_PI);
-  return Log2Num((1 / (sigma_ * pi_sqrt)) * exp(-0.5 * frac * frac));
+  Log2Num res;
+  res.setExponent(-log2(sigma_) - kLog2SqrtTwoPi - kHalfLog2E * frac * frac);
+  return res;
+}
+
+template <typename EmissionType>
+StateEmissions<EmissionType>::StateEmissions(
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states)
+    : silent_(states.size(), false),
+      mu_(states.size(), 0),
+      inv_sigma_(states.size(), 0),
+      log2_norm_(states.size(), 0),
+      fallback_(states.size(), nullptr),
+      max_sigma_(0) {
+  for (int state_id = 0; state_id < (int)states.size(); state_id++) {
+    const State<EmissionType>& state = *states[state_id];
+    if (state.isSilent()) {
+      silent_[state_id] = true;
+    } else if (const GaussianState* gaussian = asGaussian(state)) {
+      mu_[state_id] = gaussian->mu();
+      inv_sigma_[state_id] = 1 / gaussian->sigma();
+      log2_norm_[state_id] = -log2(gaussian->sigma()) - kLog2SqrtTwoPi;
+    } else {
+      fallback_[state_id] = &state;
+      fallback_ids_.push_back(state_id);
+    }
+  }
+
+  for (int state_id = 0; state_id < (int)states.size(); state_id++) {
+    if (inv_sigma_[state_id] == 0) continue;
+    gaussian_by_mu_.push_back(state_id);
+    max_sigma_ = std::max(max_sigma_, 1 / inv_sigma_[state_id]);
+  }
+  std::sort(gaussian_by_mu_.begin(), gaussian_by_mu_.end(),
+            [this](int a, int b) { return mu_[a] < mu_[b]; });
+  for (int state_id : gaussian_by_mu_) sorted_mu_.push_back(mu_[state_id]);
+}
+
+// Only states with mu within sigmas * max_sigma_ can be active so they are
+// found by binary search and then checked one by one.
+template <typename EmissionType>
+void StateEmissions<EmissionType>::activeStates(
+    const EmissionType& emission, double sigmas, std::vector<int>* res) const {
+  res->clear();
+  double margin = sigmas * max_sigma_;
+  auto begin = std::lower_bound(sorted_mu_.begin(), sorted_mu_.end(),
+                                emission - margin);
+  auto end = std::upper_bound(begin, sorted_mu_.end(), emission + margin);
+  for (auto it = begin; it != end; ++it) {
+    int state_id = gaussian_by_mu_[it - sorted_mu_.begin()];
+    if (isActive(emission, state_id, sigmas)) res->push_back(state_id);
+  }
+  if (res->empty()) {
+    for (int state_id = 0; state_id < size(); state_id++) {
+      if (!silent_[state_id]) res->push_back(state_id);
+    }
+    return;
+  }
+  res->insert(res->end(), fallback_ids_.begin(), fallback_ids_.end());
+  std::sort(res->begin(), res->end());
+}
+
+// Only exact GaussianState is stored as parameters. Derived class could
+// override prob.
+template <>
+inline const GaussianState* StateEmissions<double>::asGaussian(
+    const State<double>& state) {
+  if (typeid(state) != typeid(GaussianState)) return nullptr;
+  return static_cast<const GaussianState*>(&state);
+}
+
+template <>
+inline double StateEmissions<double>::log2Prob(const double& emission,
+                                               int state_id) const {
+  double frac = (emission - mu_[state_id]) * inv_sigma_[state_id];
+  return log2_norm_[state_id] - kHalfLog2E * frac * frac;
+}
+
+template <typename EmissionType>
+template <typename Real>
+void StateEmissions<EmissionType>::column(
+    const EmissionType& emission,
+    std::vector<BasicLog2Num<Real>>* probs) const {
+  column(emission, probs->data());
+}
+
+template <typename EmissionType>
+template <typename Real>
+void StateEmissions<EmissionType>::column(const EmissionType& emission,
+                                          BasicLog2Num<Real>* res) const {
+  for (int state_id = 0; state_id < size(); state_id++) {
+    res[state_id].setExponent(log2Prob(emission, state_id));
+  }
+  fallbackColumn(emission, res);
+}
+
+template <typename EmissionType>
+template <typename Real>
+void StateEmissions<EmissionType>::fallbackColumn(
+    const EmissionType& emission, BasicLog2Num<Real>* res) const {
+  for (int state_id : fallback_ids_) {
+    res[state_id] =
+        BasicLog2Num<Real>(fallback_[state_id]->prob(emission));
+  }
+}
+
+template <typename EmissionType>
+double StateEmissions<EmissionType>::interpolationError(
+    double spacing) const {
+  double max_inv_sigma = 0;
+  for (double inv_sigma : inv_sigma_) {
+    max_inv_sigma = std::max(max_inv_sigma, inv_sigma);
+  }
+  // Second derivative of log2 density is -2 * kHalfLog2E / sigma^2.
+  return spacing * spacing * kHalfLog2E * max_inv_sigma * max_inv_sigma / 4;
+}
+
+template <typename EmissionType>
+template <typename Real>
+void StateEmissions<EmissionType>::column(
+    const EmissionType& emission, const std::vector<int>& state_ids,
+    std::vector<BasicLog2Num<Real>>* probs) const {
+  for (int state_id : state_ids) {
+    if (fallback_[state_id] != nullptr) {
+      (*probs)[state_id] =
+          BasicLog2Num<Real>(fallback_[state_id]->prob(emission));
+    } else {
+      (*probs)[state_id].setExponent(log2Prob(emission, state_id));
+    }
+  }
+}
+
+template <typename EmissionType, typename Real>
+EmissionTable<EmissionType, Real>::EmissionTable(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    int tile_rows)
+    : emissions_(emissions),
+      state_emissions_(states),
+      tile_rows_(std::max(1, std::min<int>(tile_rows, emissions.size()))),
+      tile_begin_(-1),
+      computed_tiles_(0),
+      bin_width_(0),
+      grid_begin_(0),
+      grid_points_(0) {
+  if (tile_rows < 1) {
+    throw std::invalid_argument("Tile of emission table has to have rows.");
+  }
+  tile_.resize((size_t)tile_rows_ * states.size());
+}
+
+template <typename EmissionType, typename Real>
+EmissionTable<EmissionType, Real>::EmissionTable(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    int tile_rows, double bin_width)
+    : EmissionTable(emissions, states, tile_rows) {
+  if (!(bin_width > 0)) {
+    throw std::invalid_argument("Bin width has to be positive.");
+  }
+  if (emissions.empty()) return;
+  bin_width_ = bin_width;
+  auto range = std::minmax_element(emissions.begin(), emissions.end());
+  grid_begin_ = *range.first;
+  // The last point is not below the greatest emission.
+  grid_points_ = (int)((*range.second - grid_begin_) / bin_width_) + 2;
+  int num_states = state_emissions_.size();
+  grid_.resize((size_t)grid_points_ * num_states);
+  for (int point = 0; point < grid_points_; point++) {
+    state_emissions_.column(EmissionType(grid_begin_ + point * bin_width_),
+                            &grid_[(size_t)point * num_states]);
+  }
+}
+
+template <typename EmissionType, typename Real>
+void EmissionTable<EmissionType, Real>::computeTile(int begin) {
+  int end = std::min(begin + tile_rows_, rows());
+  for (int i = begin; i < end; i++) {
+    BasicLog2Num<Real>* row =
+        &tile_[(size_t)(i - begin) * state_emissions_.size()];
+    if (bin_width_ > 0) {
+      interpolateRow(emissions_[i], row);
+    } else {
+      state_emissions_.column(emissions_[i], row);
+    }
+  }
+  tile_begin_ = begin;
+  computed_tiles_++;
+}
+
+template <typename EmissionType, typename Real>
+void EmissionTable<EmissionType, Real>::interpolateRow(
+    const EmissionType& emission, BasicLog2Num<Real>* res) const {
+  double position = (emission - grid_begin_) / bin_width_;
+  int point = std::min((int)position, grid_points_ - 2);
+  double weight = position - point;
+  int num_states = state_emissions_.size();
+  const Log2Num* lower = &grid_[(size_t)point * num_states];
+  const Log2Num* upper = lower + num_states;
+  for (int state_id = 0; state_id < num_states; state_id++) {
+    double lower_exponent = lower[state_id].exponent();
+    res[state_id].setExponent(
+        lower_exponent +
+        weight * (upper[state_id].exponent() - lower_exponent));
+  }
+  state_emissions_.fallbackColumn(emission, res);
 }
 
 template <typename EmissionType>
@@ -52,10 +266,12 @@ Json::Value inline GaussianState::toJsonValue() const {
   return json_map;
 }
 
-template <typename EmissionType>
-std::string HMM<EmissionType>::toJsonStr() const {
+template <typename EmissionType, typename Score>
+std::string HMM<EmissionType, Score>::toJsonStr() const {
   Json::Value json_map;
   json_map["initial_state"] = initial_state_;
+  // Models without kmers are serialized the same way as before.
+  if (kmer_length_ > 0) json_map["kmer_length"] = kmer_length_;
 
   // Serialize transitions. We need to serialize list of lists of all
   // transitions for every state.
@@ -72,9 +288,10 @@ std::string HMM<EmissionType>::toJsonStr() const {
   return json_map.toStyledString();
 }
 
-template <typename EmissionType>
-HMM<EmissionType>::HMM(const Json::Value& hmm_json) {
+template <typename EmissionType, typename Score>
+HMM<EmissionType, Score>::HMM(const Json::Value& hmm_json) : compiled_(false) {
   initial_state_ = hmm_json["initial_state"].asInt();
+  kmer_length_ = hmm_json.get("kmer_length", 0).asInt();
   num_states_ = hmm_json["transitions"].size();
 
   // Deserialize transitions.
@@ -90,24 +307,89 @@ HMM<EmissionType>::HMM(const Json::Value& hmm_json) {
   computeInvTransitions();
 }
 
-template <typename EmissionType>
-HMM<EmissionType>::HMM(int initial_state,
+template <typename EmissionType, typename Score>
+std::string HMM<EmissionType, Score>::toBinaryStr() const {
+  std::vector<int32_t> offsets = {0};
+  std::vector<int32_t> to_states;
+  std::vector<double> log2_probs;
+  for (const std::vector<Transition>& state_transitions : transitions_) {
+    for (const Transition& transition : state_transitions) {
+      to_states.push_back(transition.to_state_);
+      log2_probs.push_back(transition.prob_.exponent());
+    }
+    offsets.push_back(to_states.size());
+  }
+  return binaryModelStr(initial_state_, kmer_length_, offsets, to_states,
+                        log2_probs);
+}
+
+template <typename EmissionType, typename Score>
+HMM<EmissionType, Score>::HMM(const BinaryModelView& model)
+    : initial_state_(model.initialState()),
+      num_states_(model.numStates()),
+      kmer_length_(model.kmerLength()),
+      compiled_(false) {
+  transitions_.resize(num_states_);
+  for (int state_id = 0; state_id < num_states_; state_id++) {
+    for (int i = model.offsets()[state_id]; i < model.offsets()[state_id + 1];
+         i++) {
+      Log2Num prob;
+      prob.setExponent(model.log2Probs()[i]);
+      transitions_[state_id].push_back({model.toStates()[i], prob});
+    }
+  }
+  computeInvTransitions();
+}
+
+template <typename EmissionType, typename Score>
+HMM<EmissionType, Score>::HMM(int initial_state,
                        const std::vector<std::vector<Transition>>& transitions)
     : initial_state_(initial_state),
       num_states_(transitions.size()),
+      kmer_length_(0),
       // states(std::make_move_iterator(std::begin(states)),
       // std::make_move_iterator(std::end(states))),
-      transitions_(transitions) {
+      transitions_(transitions),
+      compiled_(false) {
   computeInvTransitions();
 }
 
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::compile(
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states) {
+  compiled_ = false;
+  isValid(states);
+
+  silent_.assign(num_states_, false);
+  silent_states_.clear();
+  for (int state_id = 0; state_id < num_states_; state_id++) {
+    if (!states[state_id]->isSilent()) continue;
+    silent_[state_id] = true;
+    silent_states_.push_back(state_id);
+  }
+  compiled_ = true;
+}
+
 // These checks are done:
 // 1) Initial state has to be silent.
 // 2) No transitions can go to initial state.
 // 3) Transition to silent state. Outgoing state has to have lower number.
-template <typename EmissionType>
-void HMM<EmissionType>::isValid(
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::isValid(
     const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
+  if (compiled_) {
+    if ((int)states.size() != num_states_) {
+      throw std::invalid_argument("Number of states differs from the HMM.");
+    }
+    for (int state_id = 0; state_id < num_states_; state_id++) {
+      if (states[state_id]->isSilent() != (bool)silent_[state_id]) {
+        throw std::invalid_argument(
+            "Silent states differ from the compiled HMM.");
+      }
+    }
+    return;
+  }
+
   // Input validation. Checks only less expected restrictions on input.
   if (!states[initial_state_]->isSilent()) {
     throw std::invalid_argument("Initial state has to be silent.");
@@ -128,66 +410,638 @@ void HMM<EmissionType>::isValid(
   }
 }
 
-// Best path to @state for sequence emissions[0...emissions_prefix_len] with
-// @last_emission.
-template <typename EmissionType>
-typename HMM<EmissionType>::ProbStateId HMM<EmissionType>::bestPathTo(
-    int state_id, const State<EmissionType>& state, int emissions_prefix_len,
-    const EmissionType& last_emission,
-    const HMM<EmissionType>::ViterbiMatrix& prob) const {
-  ProbStateId res = ProbStateId(Log2Num(0), kNoState);
-
-  int prefix;
-  // If the state is silent no emission is emitted. Therefore the prefix for the
-  // previous state is the same.
-  if (state.isSilent())
-    prefix = emissions_prefix_len;
-  else
-    prefix = emissions_prefix_len - 1;
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::silentStates(
+    const StateEmissions<EmissionType>& state_emissions) const {
+  if (compiled_) return silent_states_;
+  std::vector<int> res;
+  for (int state_id = 0; state_id < num_states_; state_id++) {
+    if (state_emissions.isSilent(state_id)) res.push_back(state_id);
+  }
+  return res;
+}
 
+// Best path to @state_id for the current column with @last_emission.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ProbStateId
+HMM<EmissionType, Score>::bestPathTo(
+    int state_id, bool silent, const Log2Score& emission_prob,
+    const std::vector<Log2Score>& prev_row,
+    const std::vector<Log2Score>& curr_row, const Score* values) const {
   // Try all the previous states and pick the best one.
-  for (Transition transition : inv_transitions_[state_id]) {
-    int prev_state = transition.to_state_;
-    Log2Num path_prob = prob[prefix][prev_state].first * transition.prob_;
-    if (res.first < path_prob) {
-      res.first = path_prob;
-      res.second = prev_state;
+  int begin = inv_offsets_[state_id];
+  int in_degree = inv_offsets_[state_id + 1] - begin;
+  ProbStateId res;
+  Score best;
+  if (values != nullptr && !silent) {
+    best = log2MaxPlus(values, compressed_transitions_.valueIdx() + begin,
+                       zero_log2_probs_.data(), in_degree, &res.second);
+  } else {
+    // If the state is silent no emission is emitted. Therefore the previous
+    // state is in the same column.
+    const std::vector<Log2Score>& prob = silent ? curr_row : prev_row;
+    best = log2MaxPlus(log2Exponents(prob.data()), inv_from_.data() + begin,
+                       inv_log2_probs_.data() + begin, in_degree, &res.second);
+  }
+  res.first.setExponent(best);
+  res.first *= emission_prob;
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::checkEmissionTable(
+    const std::vector<EmissionType>& emissions,
+    const EmissionTable<EmissionType, Score>* emission_table) {
+  if (emission_table != nullptr &&
+      emission_table->rows() != (int)emissions.size()) {
+    throw std::invalid_argument(
+        "Emission table is computed for different emissions.");
+  }
+}
+
+template <typename EmissionType, typename Score>
+const typename HMM<EmissionType, Score>::Log2Score*
+HMM<EmissionType, Score>::emissionColumn(
+    const std::vector<EmissionType>& emissions, int i,
+    const StateEmissions<EmissionType>& state_emissions,
+    EmissionTable<EmissionType, Score>* emission_table,
+    std::vector<Log2Score>* buffer) const {
+  if (emission_table != nullptr) return emission_table->row(i);
+  state_emissions.column(emissions[i], buffer);
+  return buffer->data();
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::checkBand(
+    const std::vector<EmissionType>& emissions, const StateBand* band) {
+  if (band != nullptr && band->states_.size() != emissions.size()) {
+    throw std::invalid_argument("Band is computed for different emissions.");
+  }
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::sparseColumnStates(
+    const StateEmissions<EmissionType>& state_emissions,
+    const EmissionType& emission, int i, double sigmas, const StateBand* band,
+    std::vector<int>* res) {
+  if (band != nullptr) {
+    *res = band->states_[i];
+  } else {
+    state_emissions.activeStates(emission, sigmas, res);
+  }
+}
+
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::Log2Score HMM<EmissionType, Score>::bestOf(
+    const std::vector<int>& state_ids, const std::vector<Log2Score>& row) {
+  Log2Score res = Log2Score(0);
+  for (int state_id : state_ids) {
+    if (row[state_id] > res) res = row[state_id];
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+bool HMM<EmissionType, Score>::bandCollapsed(const StateBand* band,
+                                             const Log2Score& best,
+                                             const Log2Score& prev_best) {
+  return band != nullptr &&
+         best.exponent() < prev_best.exponent() - band->expand_log2_drop_;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeViterbiColumn(
+    const std::vector<int>& state_ids,
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* emission_probs, const std::vector<Log2Score>& prev_row,
+    std::vector<Log2Score>* curr_row, PackedMatrix* backpointers,
+    int backpointer_row) const {
+  computeViterbiColumn(state_ids, state_emissions, emission_probs, prev_row,
+                       nullptr, curr_row, backpointers, backpointer_row);
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeViterbiColumn(
+    const std::vector<int>& state_ids,
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* emission_probs, const std::vector<Log2Score>& prev_row,
+    const Score* values, std::vector<Log2Score>* curr_row,
+    PackedMatrix* backpointers, int backpointer_row) const {
+  for (int state_id : state_ids) {
+    ProbStateId best =
+        bestPathTo(state_id, state_emissions.isSilent(state_id),
+                   emission_probs[state_id], prev_row, *curr_row, values);
+    (*curr_row)[state_id] = best.first;
+    if (backpointers != nullptr) {
+      backpointers->set(backpointer_row, state_id, best.second + 1);
+    }
+  }
+}
+
+template <typename EmissionType, typename Score>
+Score* HMM<EmissionType, Score>::expandRow(
+    const std::vector<Log2Score>& prev_row, std::vector<Score>* values) const {
+  if (values == nullptr) return nullptr;
+  values->resize(compressed_transitions_.valuesSize());
+  compressed_transitions_.expandRow(log2Exponents(prev_row.data()),
+                                    values->data());
+  return values->data();
+}
+
+// Without beam pruning all states are computed in ascending order in every
+// column. With beam pruning only successors of states that survived pruning in
+// the previous column are computed. Emission gating computes only active
+// states, or only active successors with beam pruning, and band only the
+// states of the band. If none of them is reachable or the band collapses, the
+// column is computed for all states so that the path does not end. Silent
+// states are always computed in ascending order after all non-silent states of
+// the column because they depend only on states in the same column with lower
+// ids. Only two rows of probabilities are kept in memory.
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::viterbiSweep(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params, int begin, int end,
+    std::vector<Log2Score>* row, PackedMatrix* backpointers,
+    std::vector<std::vector<Log2Score>>* checkpoints, int checkpoint_interval,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  bool beam_search = params.isBeamSearch();
+  double sigmas = params.emission_gate_sigmas_;
+  bool gated = sigmas > 0;
+  const StateBand* band = params.band_;
+  bool sparse = gated || band != nullptr;
+  checkBand(emissions, band);
+  if (band != nullptr && (beam_search || gated)) {
+    throw std::invalid_argument(
+        "Banded Viterbi cannot be used with beam pruning or emission gating.");
+  }
+  if (params.compressed_transitions_ && (beam_search || sparse)) {
+    throw std::invalid_argument(
+        "Compressed transitions cannot be used with beam pruning, emission "
+        "gating or band.");
+  }
+  if (params.threads_ < 1) {
+    throw std::invalid_argument("Number of threads has to be positive.");
+  }
+  if (params.threads_ > 1) {
+    if (beam_search || sparse) {
+      throw std::invalid_argument(
+          "Multithreaded Viterbi cannot be used with beam pruning, emission "
+          "gating or band.");
+    }
+    viterbiSweepTeam(emissions, states, params, begin, end, row, backpointers,
+                     checkpoints, checkpoint_interval, emission_table);
+    return;
+  }
+
+  std::vector<Log2Score> prev_row = std::move(*row);
+  std::vector<Log2Score> curr_row(num_states_, Log2Score(0.0));
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Score> emission_probs(num_states_);
+  std::vector<Score> values;
+
+  std::vector<int> all_states(num_states_);
+  std::iota(all_states.begin(), all_states.end(), 0);
+
+  std::vector<int> silent_states;
+  std::vector<int> survivors;
+  if (beam_search || sparse) {
+    for (int state_id = 0; state_id < num_states_; state_id++) {
+      if (state_id != initial_state_ && state_emissions.isSilent(state_id)) {
+        silent_states.push_back(state_id);
+      }
+      if (!prev_row[state_id].isLogZero()) survivors.push_back(state_id);
+    }
+  }
+
+  // Best probability of the previous column to detect collapse of the band.
+  Log2Score prev_best = bestOf(all_states, prev_row);
+
+  // last_computed[state] == prefix_len <=> state was already computed in the
+  // column prefix_len.
+  std::vector<int> last_computed(num_states_, -1);
+  // Only these cells of curr_row can be nonzero, all cells if
+  // curr_row_full. Reset of a pruned column then does not touch all states.
+  std::vector<int> curr_row_states, prev_row_states;
+  bool curr_row_full = false, prev_row_full = true;
+  for (int prefix_len = begin + 1; prefix_len <= end; prefix_len++) {
+    const EmissionType& emission = emissions[prefix_len - 1];
+    int backpointer_row = prefix_len - begin;
+    bool all_computed = !beam_search && !sparse;
+    std::vector<int> computed_states;
+    if (!all_computed) {
+      if (curr_row_full) {
+        std::fill(curr_row.begin(), curr_row.end(), Log2Score(0.0));
+      } else {
+        for (int state_id : curr_row_states) {
+          curr_row[state_id] = Log2Score(0.0);
+        }
+      }
+      if (beam_search) {
+        for (int survivor : survivors) {
+          for (const Transition& transition : transitions_[survivor]) {
+            int state_id = transition.to_state_;
+            if (state_emissions.isSilent(state_id)) continue;
+            if (last_computed[state_id] == prefix_len) continue;
+            last_computed[state_id] = prefix_len;
+            if (gated &&
+                !state_emissions.isActive(emission, state_id, sigmas)) {
+              continue;
+            }
+            computed_states.push_back(state_id);
+          }
+        }
+      } else {
+        sparseColumnStates(state_emissions, emission, prefix_len - 1, sigmas,
+                           band, &computed_states);
+      }
+      computed_states.insert(computed_states.end(), silent_states.begin(),
+                             silent_states.end());
+      // Without the table only emissions of the computed states are needed.
+      // Gated and banded columns do not read the table because it would
+      // compute emissions of all states.
+      const Log2Score* column_probs = emission_probs.data();
+      if (emission_table != nullptr && !sparse) {
+        column_probs = emission_table->row(prefix_len - 1);
+      } else {
+        state_emissions.column(emission, computed_states, &emission_probs);
+      }
+      computeViterbiColumn(computed_states, state_emissions, column_probs,
+                           prev_row, &curr_row, backpointers, backpointer_row);
+      survivors = pruneViterbiRow(computed_states, params, &curr_row);
+      all_computed =
+          sparse && (survivors.empty() ||
+                     bandCollapsed(band, bestOf(survivors, curr_row),
+                                   prev_best));
+    }
+    if (all_computed) {
+      const Log2Score* column_probs =
+          emissionColumn(emissions, prefix_len - 1, state_emissions,
+                         emission_table, &emission_probs);
+      const Score* row_values =
+          expandRow(prev_row, params.compressed_transitions_ ? &values
+                                                             : nullptr);
+      computeViterbiColumn(all_states, state_emissions, column_probs,
+                           prev_row, row_values, &curr_row, backpointers,
+                           backpointer_row);
+      if (beam_search || sparse) {
+        survivors = pruneViterbiRow(all_states, params, &curr_row);
+      }
+      rescaleRow(&curr_row);
+    } else {
+      rescaleRow(computed_states, &curr_row);
+    }
+    if (band != nullptr) prev_best = bestOf(survivors, curr_row);
+    std::swap(prev_row, curr_row);
+    curr_row_states.swap(prev_row_states);
+    prev_row_states.swap(computed_states);
+    curr_row_full = prev_row_full;
+    prev_row_full = all_computed;
+
+    if (checkpoints != nullptr && prefix_len % checkpoint_interval == 0) {
+      checkpoints->push_back(prev_row);
+    }
+  }
+
+  *row = std::move(prev_row);
+}
+
+// Non-silent states depend only on the previous column so every thread
+// computes its own range of them. Then the calling thread computes silent
+// states in ascending order as in viterbiSweep. Ranges are aligned to words
+// of @backpointers so threads never write to the same word.
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::viterbiSweepTeam(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params, int begin, int end,
+    std::vector<Log2Score>* row, PackedMatrix* backpointers,
+    std::vector<std::vector<Log2Score>>* checkpoints, int checkpoint_interval,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  std::vector<Log2Score> prev_row = std::move(*row);
+  std::vector<Log2Score> curr_row(num_states_, Log2Score(0.0));
+  StateEmissions<EmissionType> state_emissions(states);
+  // Emission probabilities of silent states are never recomputed.
+  std::vector<Log2Score> emission_probs(num_states_, Log2Score(1.0));
+  // Row of @emission_table for the current column. The table is not thread
+  // safe so the calling thread loads the next row between columns.
+  const Log2Score* table_row = nullptr;
+  if (emission_table != nullptr && begin < end) {
+    table_row = emission_table->row(begin);
+  }
+
+  int align = backpointers != nullptr ? backpointers->cellsPerWord() : 1;
+  std::vector<std::vector<int>> thread_states =
+      splitStates(state_emissions, params.threads_, align);
+  std::vector<int> silent_states = silentStates(state_emissions);
+  // Expanded by the calling thread between columns.
+  std::vector<Score> values;
+  std::vector<Score>* values_ptr =
+      params.compressed_transitions_ ? &values : nullptr;
+  const Score* row_values = expandRow(prev_row, values_ptr);
+
+  auto parallel = [&](int step, int thread) {
+    const std::vector<int>& own_states = thread_states[thread];
+    const Log2Score* column_probs = table_row;
+    if (column_probs == nullptr) {
+      state_emissions.column(emissions[begin + step], own_states,
+                             &emission_probs);
+      column_probs = emission_probs.data();
+    }
+    computeViterbiColumn(own_states, state_emissions, column_probs, prev_row,
+                         row_values, &curr_row, backpointers, step + 1);
+  };
+  auto sequential = [&](int step) {
+    const Log2Score* column_probs =
+        table_row != nullptr ? table_row : emission_probs.data();
+    computeViterbiColumn(silent_states, state_emissions, column_probs,
+                         prev_row, &curr_row, backpointers, step + 1);
+    rescaleRow(&curr_row);
+    std::swap(prev_row, curr_row);
+    row_values = expandRow(prev_row, values_ptr);
+
+    int prefix_len = begin + step + 1;
+    if (checkpoints != nullptr && prefix_len % checkpoint_interval == 0) {
+      checkpoints->push_back(prev_row);
+    }
+    if (table_row != nullptr && prefix_len < end) {
+      table_row = emission_table->row(prefix_len);
     }
+  };
+  runInLockstep(params.threads_, end - begin, parallel, sequential);
+
+  *row = std::move(prev_row);
+}
+
+// The cost of a state is its in-degree plus one for the emission.
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::splitStates(
+    const StateEmissions<EmissionType>& state_emissions, int threads,
+    int align) const {
+  long long total_cost = 0;
+  for (int state_id = 0; state_id < num_states_; state_id++) {
+    if (state_emissions.isSilent(state_id)) continue;
+    total_cost += inv_offsets_[state_id + 1] - inv_offsets_[state_id] + 1;
+  }
+
+  std::vector<std::vector<int>> res(threads);
+  int thread = 0;
+  long long cost = 0;
+  for (int state_id = 0; state_id < num_states_; state_id++) {
+    // The next thread starts when the current one has its share.
+    if (state_id % align == 0) {
+      while (thread + 1 < threads &&
+             cost * threads >= total_cost * (thread + 1)) {
+        thread++;
+      }
+    }
+    if (state_emissions.isSilent(state_id)) continue;
+    res[thread].push_back(state_id);
+    cost += inv_offsets_[state_id + 1] - inv_offsets_[state_id] + 1;
   }
-  res.first *= state.prob(last_emission);
   return res;
 }
 
-// ViterbiMatrix[i][u] = (p,v) <=> the most probable path matching sequence
-// emissions[0...i-1] starting in @begin_state_ and ending in state u has
-// probability p and the state before u on this path is v.
-template <typename EmissionType>
-typename HMM<EmissionType>::ViterbiMatrix
-HMM<EmissionType>::computeViterbiMatrix(
+template <typename EmissionType, typename Score>
+double HMM<EmissionType, Score>::rescaleRow(std::vector<Log2Score>* row) {
+  if (!kRescaleRows) return 0;
+  Score best = -HUGE_VAL;
+  for (const Log2Score& prob : *row) best = std::max(best, prob.exponent());
+  if (best == -HUGE_VAL) return 0;
+  for (Log2Score& prob : *row) prob.setExponent(prob.exponent() - best);
+  return best;
+}
+
+template <typename EmissionType, typename Score>
+double HMM<EmissionType, Score>::rescaleRow(const std::vector<int>& state_ids,
+                                            std::vector<Log2Score>* row) {
+  if (!kRescaleRows) return 0;
+  Score best = -HUGE_VAL;
+  for (int state_id : state_ids) {
+    best = std::max(best, (*row)[state_id].exponent());
+  }
+  if (best == -HUGE_VAL) return 0;
+  for (int state_id : state_ids) {
+    (*row)[state_id].setExponent((*row)[state_id].exponent() - best);
+  }
+  return best;
+}
+
+// backpointers_[i][u] points to the state before u on the most probable path
+// matching sequence emissions[0...i-1] starting in @initial_state_ and ending
+// in state u.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ViterbiMatrix
+HMM<EmissionType, Score>::computeViterbiMatrix(
     const std::vector<EmissionType>& emissions,
-    const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
-  ViterbiMatrix prob = ViterbiMatrix(emissions.size() + 1,
-                                     std::vector<ProbStateId>(num_states_));
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  ViterbiMatrix res;
+  res.backpointers_ = allocateBackpointers(emissions.size() + 1);
 
   // Initial probabilities.
-  for (int state = 0; state < num_states_; state++) {
-    prob[0][state] = ProbStateId(Log2Num(0.0), kNoState);
+  res.last_row_.assign(num_states_, Log2Score(0.0));
+  res.last_row_[initial_state_] = Log2Score(1.0);
+
+  viterbiSweep(emissions, states, params, 0, emissions.size(), &res.last_row_,
+               &res.backpointers_, nullptr, 1, emission_table);
+  return res;
+}
+
+// Rows of probabilities for prefix lengths 0, interval, 2*interval, ... are
+// kept where interval is about sqrt(T). Backtracking goes from the end and
+// whenever it gets below the segment which has backpointers in memory, the
+// previous segment is recomputed from its checkpoint.
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::runCheckpointedViterbi(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  int length = emissions.size();
+  int interval = std::max(1, (int)std::ceil(std::sqrt(length)));
+
+  std::vector<Log2Score> row(num_states_, Log2Score(0.0));
+  row[initial_state_] = Log2Score(1.0);
+  std::vector<std::vector<Log2Score>> checkpoints = {row};
+  viterbiSweep(emissions, states, params, 0, length, &row, nullptr,
+               &checkpoints, interval, emission_table);
+
+  int best_terminal_state = bestTerminalState(row);
+
+  // Backpointers for rows segment_begin+1 ... segment_begin+interval.
+  PackedMatrix segment;
+  int segment_begin = length;
+  return backtrackMatrix(best_terminal_state, length, states,
+                         [&](int row_id, int state)->int {
+    if (row_id <= segment_begin) {
+      int checkpoint = (row_id - 1) / interval;
+      segment_begin = checkpoint * interval;
+      int segment_end = std::min(length, segment_begin + interval);
+      segment = allocateBackpointers(segment_end - segment_begin + 1);
+      std::vector<Log2Score> segment_row = checkpoints[checkpoint];
+      viterbiSweep(emissions, states, params, segment_begin, segment_end,
+                   &segment_row, &segment, nullptr, 1, emission_table);
+    }
+    return previousState(segment, row_id - segment_begin, state);
+  });
+}
+
+// Only decisions of Viterbi algorithm matter. Emissions of all non-silent
+// states in a column are divided by the greatest one and every row is divided
+// by its greatest number. This multiplies all paths ending in a column by the
+// same number so decisions do not change. Then all numbers are at most one
+// and sums of fixed point exponents do not overflow.
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::runFixedPointViterbi(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params) const {
+  if (params.fixed_point_scale_ <= 0) {
+    throw std::invalid_argument("Fixed point scale has to be positive.");
+  }
+  if (params.isBeamSearch() || params.checkpointing_ || params.threads_ > 1 ||
+      params.emission_gate_sigmas_ > 0 || params.band_ != nullptr ||
+      params.compressed_transitions_) {
+    throw std::invalid_argument(
+        "Fixed point Viterbi cannot be used with beam pruning, "
+        "checkpointing, multiple threads, emission gating, band or "
+        "compressed transitions.");
+  }
+  double scale = params.fixed_point_scale_;
+  std::vector<int32_t> inv_probs;
+  for (const std::vector<Transition>& inv_transitions : inv_transitions_) {
+    for (const Transition& transition : inv_transitions) {
+      inv_probs.push_back(log2ToFixed(transition.prob_.exponent(), scale));
+    }
   }
-  prob[0][initial_state_] = ProbStateId(Log2Num(1.0), kNoState);
 
-  for (int prefix_len = 1; prefix_len <= (int)emissions.size(); prefix_len++) {
+  int length = emissions.size();
+  PackedMatrix backpointers = allocateBackpointers(length + 1);
+  std::vector<int32_t> prev_row(num_states_, kLog2FixedZero);
+  std::vector<int32_t> curr_row(num_states_, kLog2FixedZero);
+  prev_row[initial_state_] = 0;
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Num> emission_probs(num_states_);
+  std::vector<int32_t> emission_row(num_states_, 0);
+  for (int prefix_len = 1; prefix_len <= length; prefix_len++) {
+    state_emissions.column(emissions[prefix_len - 1], &emission_probs);
+    double best_emission = -HUGE_VAL;
+    for (int state_id = 0; state_id < num_states_; state_id++) {
+      if (state_emissions.isSilent(state_id)) continue;
+      best_emission =
+          std::max(best_emission, emission_probs[state_id].exponent());
+    }
+    for (int state_id = 0; state_id < num_states_; state_id++) {
+      if (state_emissions.isSilent(state_id)) continue;
+      emission_row[state_id] =
+          best_emission == -HUGE_VAL
+              ? kLog2FixedZero
+              : log2ToFixed(emission_probs[state_id].exponent() -
+                                best_emission,
+                            scale);
+    }
+
+    int32_t best_in_row = kLog2FixedZero;
     for (int state_id = 0; state_id < num_states_; state_id++) {
-      prob[prefix_len][state_id] =
-          bestPathTo(state_id, *states[state_id], prefix_len,
-                     emissions[prefix_len - 1], prob);
+      const std::vector<int32_t>& prob =
+          state_emissions.isSilent(state_id) ? curr_row : prev_row;
+      int begin = inv_offsets_[state_id];
+      int argmax;
+      int32_t best = log2MaxPlus(prob.data(), inv_from_.data() + begin,
+                                 inv_probs.data() + begin,
+                                 inv_offsets_[state_id + 1] - begin, &argmax);
+      if (best > kLog2FixedZero) {
+        best = std::max(kLog2FixedZero, best + emission_row[state_id]);
+      }
+      if (best == kLog2FixedZero) argmax = -1;
+      curr_row[state_id] = best;
+      backpointers.set(prefix_len, state_id, argmax + 1);
+      best_in_row = std::max(best_in_row, best);
+    }
+    if (best_in_row > kLog2FixedZero) {
+      for (int32_t& prob : curr_row) {
+        if (prob > kLog2FixedZero) prob -= best_in_row;
+      }
+    }
+    std::swap(prev_row, curr_row);
+  }
+
+  int32_t best_prob = kLog2FixedZero;
+  int best_terminal_state = 0;
+  for (int i = 0; i < num_states_; ++i) {
+    if (prev_row[i] > best_prob) {
+      best_prob = prev_row[i];
+      best_terminal_state = i;
     }
   }
 
-  return prob;
+  return backtrackMatrix(best_terminal_state, length, states,
+                         [&backpointers, this](int row, int state)->int {
+    return previousState(backpointers, row, state);
+  });
 }
 
-template <typename EmissionType>
-std::vector<int> HMM<EmissionType>::backtrackMatrix(
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::pruneViterbiRow(
+    const std::vector<int>& computed_states, const ViterbiParams& params,
+    std::vector<Log2Score>* row) const {
+  Log2Score best_prob = Log2Score(0);
+  std::vector<int> survivors;
+  for (int state_id : computed_states) {
+    const Log2Score& state_prob = (*row)[state_id];
+    if (state_prob.isLogZero()) continue;
+    survivors.push_back(state_id);
+    if (state_prob > best_prob) best_prob = state_prob;
+  }
+  if (survivors.empty()) return survivors;
+
+  // Threshold relative to the best state in the column.
+  Log2Score threshold;
+  threshold.setExponent(-params.beam_log2_margin_);
+  threshold *= best_prob;
+
+  // Threshold given by the number of states that can survive.
+  if (params.beam_max_states_ > 0 &&
+      (int)survivors.size() > params.beam_max_states_) {
+    std::vector<int> by_prob = survivors;
+    std::nth_element(by_prob.begin(),
+                     by_prob.begin() + params.beam_max_states_ - 1,
+                     by_prob.end(), [row](int lhs, int rhs) {
+      return (*row)[lhs] > (*row)[rhs];
+    });
+    const Log2Score& nth_best = (*row)[by_prob[params.beam_max_states_ - 1]];
+    if (threshold < nth_best) threshold = nth_best;
+  }
+
+  std::vector<int> res;
+  for (int state_id : survivors) {
+    if ((*row)[state_id] < threshold) {
+      (*row)[state_id] = Log2Score(0);
+    } else {
+      res.push_back(state_id);
+    }
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+int HMM<EmissionType, Score>::bestTerminalState(
+    const std::vector<Log2Score>& row) const {
+  Log2Score best_prob = Log2Score(0);
+  int best_terminal_state = 0;
+  for (int i = 0; i < num_states_; ++i) {
+    if (row[i] > best_prob) {
+      best_prob = row[i];
+      best_terminal_state = i;
+    }
+  }
+  return best_terminal_state;
+}
+
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::backtrackMatrix(
     int last_state, int last_row,
     const std::vector<std::unique_ptr<State<EmissionType>>>& states,
     const std::function<int(int, int)>& nextState) const {
@@ -206,31 +1060,230 @@ std::vector<int> HMM<EmissionType>::backtrackMatrix(
   return res;
 }
 
-template <typename EmissionType>
-std::vector<int> HMM<EmissionType>::runViterbiReturnStateIds(
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::runViterbiReturnStateIds(
     const std::vector<EmissionType>& emission_seq,
     const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
+  return runViterbiReturnStateIds(emission_seq, states, ViterbiParams());
+}
+
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::runViterbiReturnStateIds(
+    const std::vector<EmissionType>& emission_seq,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params) const {
+  return runViterbiReturnStateIds(emission_seq, states, params, nullptr);
+}
+
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::runViterbiReturnStateIds(
+    const std::vector<EmissionType>& emission_seq,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params,
+    EmissionTable<EmissionType, Score>* emission_table) const {
   // Checks is the input states and transitions are valid.
   isValid(states);
+  checkEmissionTable(emission_seq, emission_table);
 
-  ViterbiMatrix prob = computeViterbiMatrix(emission_seq, states);
+  if (params.fixed_point_scale_ > 0) {
+    if (!params.validate_fixed_point_) {
+      return runFixedPointViterbi(emission_seq, states, params);
+    }
+    FixedPointValidation validation =
+        validateFixedPointViterbi(emission_seq, states, params);
+    if (validation.differing_emissions_ > 0) {
+      LOG(WARNING) << "Fixed point Viterbi path differs in "
+                   << validation.differing_emissions_ << " of "
+                   << emission_seq.size() << " emissions.";
+    }
+    return validation.state_ids_;
+  }
+  if (params.checkpointing_) {
+    return runCheckpointedViterbi(emission_seq, states, params,
+                                  emission_table);
+  }
 
-  Log2Num best_prob = Log2Num(0);
-  int best_terminal_state = 0;
-  for (int i = 0; i < num_states_; ++i) {
-    if (prob[emission_seq.size()][i].first > best_prob) {
-      best_prob = prob[emission_seq.size()][i].first;
-      best_terminal_state = i;
+  ViterbiMatrix prob =
+      computeViterbiMatrix(emission_seq, states, params, emission_table);
+  return backtrackMatrix(bestTerminalState(prob.last_row_),
+                         emission_seq.size(), states,
+                         [&prob, this](int row, int state)->int {
+    return previousState(prob.backpointers_, row, state);
+  });
+}
+
+// Both paths emit every emission exactly once so emitting states are compared
+// emission by emission.
+template <typename EmissionType, typename Score>
+FixedPointValidation HMM<EmissionType, Score>::validateFixedPointViterbi(
+    const std::vector<EmissionType>& emission_seq,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const ViterbiParams& params) const {
+  isValid(states);
+  FixedPointValidation res;
+  res.state_ids_ = runFixedPointViterbi(emission_seq, states, params);
+  ViterbiParams reference_params = params;
+  reference_params.fixed_point_scale_ = 0;
+  res.reference_state_ids_ =
+      runViterbiReturnStateIds(emission_seq, states, reference_params);
+
+  auto emittingStates = [&states](const std::vector<int>& state_ids) {
+    std::vector<int> res;
+    for (int state_id : state_ids) {
+      if (!states[state_id]->isSilent()) res.push_back(state_id);
+    }
+    return res;
+  };
+  std::vector<int> emitting = emittingStates(res.state_ids_);
+  std::vector<int> reference_emitting =
+      emittingStates(res.reference_state_ids_);
+  res.differing_emissions_ = 0;
+  for (size_t i = 0; i < std::max(emitting.size(), reference_emitting.size());
+       i++) {
+    if (i >= emitting.size() || i >= reference_emitting.size() ||
+        emitting[i] != reference_emitting[i]) {
+      res.differing_emissions_++;
+    }
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::checkBatch(
+    const std::vector<std::vector<EmissionType>>& emission_seqs,
+    const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+        states) const {
+  if (emission_seqs.size() != states.size()) {
+    throw std::invalid_argument("Every read of the batch needs its states.");
+  }
+  for (const auto& read_states : states) {
+    if ((int)read_states.size() != num_states_) {
+      throw std::invalid_argument("Number of states differs from the HMM.");
+    }
+    isValid(read_states);
+    for (int state_id = 0; state_id < num_states_; state_id++) {
+      bool silent = states[0][state_id]->isSilent();
+      if (read_states[state_id]->isSilent() != silent) {
+        throw std::invalid_argument(
+            "Silent states differ between reads of the batch.");
+      }
     }
   }
+}
 
-  return backtrackMatrix(
-      best_terminal_state, emission_seq.size(), states,
-      [&prob](int row, int state)->int { return prob[row][state].second; });
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::batchLanes(
+    const std::vector<std::vector<EmissionType>>& emission_seqs) {
+  std::vector<int> res(emission_seqs.size());
+  std::iota(res.begin(), res.end(), 0);
+  std::stable_sort(res.begin(), res.end(), [&](int lhs, int rhs) {
+    return emission_seqs[lhs].size() > emission_seqs[rhs].size();
+  });
+  return res;
 }
 
-template <typename EmissionType>
-void HMM<EmissionType>::computeInvTransitions() {
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::batchEmissions(
+    const std::vector<std::vector<EmissionType>>& emission_seqs,
+    const std::vector<StateEmissions<EmissionType>>& state_emissions,
+    const std::vector<int>& lanes, int prefix_len, int active,
+    std::vector<Log2Score>* res) const {
+  int stride = lanes.size();
+  std::vector<Log2Score> column(num_states_);
+  for (int lane = 0; lane < active; lane++) {
+    int read = lanes[lane];
+    state_emissions[read].column(emission_seqs[read][prefix_len - 1],
+                                 &column);
+    for (int state = 0; state < num_states_; state++) {
+      (*res)[(size_t)state * stride + lane] = column[state];
+    }
+  }
+}
+
+// The same as computeViterbiMatrix but rows contain all lanes. When a read
+// ends its last row is copied out and the number of active lanes decreases.
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::runViterbiBatch(
+    const std::vector<std::vector<EmissionType>>& emission_seqs,
+    const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+        states) const {
+  static_assert(std::is_same<Score, double>::value,
+                "Batched decoding needs double scores.");
+  checkBatch(emission_seqs, states);
+  int batch = emission_seqs.size();
+  std::vector<StateEmissions<EmissionType>> state_emissions;
+  std::vector<PackedMatrix> backpointers;
+  for (int read = 0; read < batch; read++) {
+    state_emissions.emplace_back(states[read]);
+    backpointers.push_back(
+        allocateBackpointers(emission_seqs[read].size() + 1));
+  }
+  std::vector<std::vector<int>> res(batch);
+  if (batch == 0) return res;
+  const StateEmissions<EmissionType>& silent = state_emissions[0];
+
+  std::vector<int> lanes = batchLanes(emission_seqs);
+  size_t row_size = (size_t)num_states_ * batch;
+  std::vector<Log2Score> prev_row(row_size, Log2Score(0.0));
+  std::vector<Log2Score> curr_row(row_size, Log2Score(0.0));
+  std::fill_n(prev_row.begin() + (size_t)initial_state_ * batch, batch,
+              Log2Score(1.0));
+  std::vector<Log2Score> emission_probs(row_size);
+  std::vector<double> best(batch);
+  std::vector<int> argmax(batch);
+  std::vector<std::vector<Log2Score>> last_rows(batch);
+  int active = batch;
+  for (int prefix_len = 1; active > 0; prefix_len++) {
+    while (active > 0 &&
+           (int)emission_seqs[lanes[active - 1]].size() < prefix_len) {
+      active--;
+      std::vector<Log2Score>& last_row = last_rows[lanes[active]];
+      for (int state = 0; state < num_states_; state++) {
+        last_row.push_back(prev_row[(size_t)state * batch + active]);
+      }
+    }
+    if (active == 0) break;
+
+    batchEmissions(emission_seqs, state_emissions, lanes, prefix_len, active,
+                   &emission_probs);
+    for (int state = 0; state < num_states_; state++) {
+      const std::vector<Log2Score>& prob =
+          silent.isSilent(state) ? curr_row : prev_row;
+      int begin = inv_offsets_[state];
+      log2MaxPlusLanes(log2Exponents(prob.data()), inv_from_.data() + begin,
+                       inv_log2_probs_.data() + begin,
+                       inv_offsets_[state + 1] - begin, batch, active,
+                       best.data(), argmax.data());
+      for (int lane = 0; lane < active; lane++) {
+        size_t cell = (size_t)state * batch + lane;
+        curr_row[cell].setExponent(best[lane]);
+        curr_row[cell] *= emission_probs[cell];
+        backpointers[lanes[lane]].set(prefix_len, state, argmax[lane] + 1);
+      }
+    }
+    std::swap(prev_row, curr_row);
+  }
+
+  for (int read = 0; read < batch; read++) {
+    res[read] = backtrackMatrix(
+        bestTerminalState(last_rows[read]), emission_seqs[read].size(),
+        states[read], [&backpointers, read, this](int row, int state)->int {
+      return previousState(backpointers[read], row, state);
+    });
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeInvTransitions() {
+  // Transitions are indexed by int here and by int32_t in binary models.
+  size_t num_transitions = 0;
+  for (const std::vector<Transition>& state_transitions : transitions_) {
+    num_transitions += state_transitions.size();
+  }
+  if (num_transitions > (size_t)std::numeric_limits<int32_t>::max()) {
+    throw std::invalid_argument("Number of transitions does not fit into int.");
+  }
   inv_transitions_.resize(num_states_);
   for (int state = 0; state < num_states_; state++) {
     for (Transition transition : transitions_[state]) {
@@ -238,118 +1291,1040 @@ void HMM<EmissionType>::computeInvTransitions() {
           .push_back({state, transition.prob_});
     }
   }
+
+  max_in_degree_ = 0;
+  inv_offsets_.assign(1, 0);
+  for (const std::vector<Transition>& inv_transitions : inv_transitions_) {
+    max_in_degree_ = std::max(max_in_degree_, (int)inv_transitions.size());
+    inv_offsets_.push_back(inv_offsets_.back() + inv_transitions.size());
+    for (const Transition& transition : inv_transitions) {
+      inv_from_.push_back(transition.to_state_);
+      inv_log2_probs_.push_back(transition.prob_.exponent());
+    }
+  }
+  compressed_transitions_ =
+      CompressedTransitions<Score>(num_states_, inv_from_, inv_log2_probs_);
+  zero_log2_probs_.assign(max_in_degree_, 0);
 }
 
-// Computes matrix res[i][j][k] which means:
-// Sum of probabilities of all paths of form
-// initial_state -> ... -> inv_transitions_[j][k] -> j
-// and emitting emissions[0... i-1].
-template <typename EmissionType>
-typename HMM<EmissionType>::ForwardMatrix HMM<EmissionType>::forwardTracking(
+// Computes cumulative weights for sampling of previous states:
+// res.cumulativeWeights(i, j)[k] is sum of probabilities of all paths of form
+// initial_state -> ... -> inv_transitions_[j][l] -> j for l <= k emitting
+// emissions[0... i-1] divided by the same sum for all l.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ForwardMatrix
+HMM<EmissionType, Score>::forwardTracking(
     const std::vector<EmissionType>& emissions,
     const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
-  ForwardMatrix res(emissions.size() + 1,
-                    std::vector<std::vector<double>>(num_states_));
-  // sum_all_paths[prefix_len][state]
-  // Sum of probabilities of all paths ending at @state emitting prefix of
-  // emission sequence of length @prefix_len.
-  std::vector<std::vector<Log2Num>> sum_all_paths(
-      emissions.size() + 1, std::vector<Log2Num>(num_states_));
-
-  // Initial values.
+  return forwardTracking(emissions, states, 1, nullptr);
+}
+
+// With more threads every thread computes its own range of non-silent states
+// and then the calling thread computes silent states as in viterbiSweepTeam.
+// Each state is computed in the same way by both variants so the weights do
+// not depend on number of threads.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ForwardMatrix
+HMM<EmissionType, Score>::forwardTracking(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    int threads, EmissionTable<EmissionType, Score>* emission_table) const {
+  return forwardTracking(emissions, states, threads, false, emission_table);
+}
+
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ForwardMatrix
+HMM<EmissionType, Score>::forwardTracking(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    int threads, bool compressed,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  if (threads < 1) {
+    throw std::invalid_argument("Number of threads has to be positive.");
+  }
+  ForwardMatrix res;
+  res.rows_ = emissions.size() + 1;
+  res.inv_offsets_ = inv_offsets_;
+  res.weights_.assign((size_t)res.rows_ * inv_offsets_.back(), 0);
+
+  // sum_all_paths[state] - sum of probabilities of all paths ending at @state
+  // emitting prefix of emission sequence of length @prefix_len. Only the
+  // previous and the current row are kept.
+  std::vector<Log2Score> prev_sum_all_paths(num_states_, Log2Score(0));
+  std::vector<Log2Score> sum_all_paths(num_states_, Log2Score(0));
+  prev_sum_all_paths[initial_state_] = Log2Score(1);
+  std::vector<Score> values;
+  std::vector<Score>* values_ptr = compressed ? &values : nullptr;
+  const Score* row_values = expandRow(prev_sum_all_paths, values_ptr);
+
+  StateEmissions<EmissionType> state_emissions(states);
+  if (threads == 1) {
+    std::vector<int> all_states(num_states_);
+    std::iota(all_states.begin(), all_states.end(), 0);
+    std::vector<Log2Score> emission_probs(num_states_);
+    std::vector<Score> path_probs(max_in_degree_);
+    for (int prefix_len = 1; prefix_len <= (int)emissions.size();
+         prefix_len++) {
+      const Log2Score* column_probs =
+          emissionColumn(emissions, prefix_len - 1, state_emissions,
+                         emission_table, &emission_probs);
+      computeForwardColumn(all_states, state_emissions, column_probs,
+                           prev_sum_all_paths, row_values, &sum_all_paths,
+                           path_probs.data(), prefix_len, &res);
+      // Rescaling does not change normalized weights.
+      rescaleRow(&sum_all_paths);
+      std::swap(prev_sum_all_paths, sum_all_paths);
+      row_values = expandRow(prev_sum_all_paths, values_ptr);
+    }
+  } else {
+    std::vector<Log2Score> emission_probs(num_states_, Log2Score(1));
+    std::vector<std::vector<int>> thread_states =
+        splitStates(state_emissions, threads, 1);
+    std::vector<int> silent_states = silentStates(state_emissions);
+    std::vector<std::vector<Score>> path_probs(
+        threads, std::vector<Score>(max_in_degree_));
+    // Loaded by the calling thread as in viterbiSweepTeam.
+    const Log2Score* table_row = nullptr;
+    if (emission_table != nullptr && !emissions.empty()) {
+      table_row = emission_table->row(0);
+    }
+
+    auto parallel = [&](int step, int thread) {
+      const std::vector<int>& own_states = thread_states[thread];
+      const Log2Score* column_probs = table_row;
+      if (column_probs == nullptr) {
+        state_emissions.column(emissions[step], own_states, &emission_probs);
+        column_probs = emission_probs.data();
+      }
+      computeForwardColumn(own_states, state_emissions, column_probs,
+                           prev_sum_all_paths, row_values, &sum_all_paths,
+                           path_probs[thread].data(), step + 1, &res);
+    };
+    auto sequential = [&](int step) {
+      const Log2Score* column_probs =
+          table_row != nullptr ? table_row : emission_probs.data();
+      computeForwardColumn(silent_states, state_emissions, column_probs,
+                           prev_sum_all_paths, &sum_all_paths,
+                           path_probs[0].data(), step + 1, &res);
+      rescaleRow(&sum_all_paths);
+      std::swap(prev_sum_all_paths, sum_all_paths);
+      row_values = expandRow(prev_sum_all_paths, values_ptr);
+      if (table_row != nullptr && step + 1 < (int)emissions.size()) {
+        table_row = emission_table->row(step + 1);
+      }
+    };
+    runInLockstep(threads, emissions.size(), parallel, sequential);
+  }
+
+  setLastStateWeights(prev_sum_all_paths, &res);
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeForwardColumn(
+    const std::vector<int>& state_ids,
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* emission_probs, const std::vector<Log2Score>& prev_row,
+    std::vector<Log2Score>* curr_row, Score* path_probs, int prefix_len,
+    ForwardMatrix* res) const {
+  computeForwardColumn(state_ids, state_emissions, emission_probs, prev_row,
+                       nullptr, curr_row, path_probs, prefix_len, res);
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeForwardColumn(
+    const std::vector<int>& state_ids,
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* emission_probs, const std::vector<Log2Score>& prev_row,
+    const Score* values, std::vector<Log2Score>* curr_row, Score* path_probs,
+    int prefix_len, ForwardMatrix* res) const {
+  for (int state : state_ids) {
+    computeForwardCell(state, state_emissions.isSilent(state),
+                       emission_probs[state], prev_row, values, curr_row,
+                       path_probs, prefix_len, res);
+  }
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeForwardCell(
+    int state, bool silent, const Log2Score& emission_prob,
+    const std::vector<Log2Score>& prev_row, const Score* values,
+    std::vector<Log2Score>* curr_row, Score* path_probs, int prefix_len,
+    ForwardMatrix* res) const {
+  // Sum of probabilities of all paths ending in @state and emitting
+  // sequence emissions[0...prefix_prev_len-1]. Emission probability is
+  // the same for all paths so it does not change normalized weights.
+  int begin = inv_offsets_[state];
+  int in_degree = inv_offsets_[state + 1] - begin;
+  Score log2_sum;
+  if (values != nullptr && !silent) {
+    log2_sum =
+        log2SumExpPlus(values, compressed_transitions_.valueIdx() + begin,
+                       zero_log2_probs_.data(), in_degree, path_probs);
+  } else {
+    // If the state is silent no emission is emitted. Therefore we cannot
+    // extend the sequence of emission and we look at solutions with the
+    // same prefix length.
+    const std::vector<Log2Score>& from_row = silent ? *curr_row : prev_row;
+    log2_sum = log2SumExpPlus(
+        log2Exponents(from_row.data()), inv_from_.data() + begin,
+        inv_log2_probs_.data() + begin, in_degree, path_probs);
+  }
+  Log2Score sum;
+  sum.setExponent(log2_sum);
+  sum *= emission_prob;
+  (*curr_row)[state] = sum;
+
+  // Normalize probabilities and store them cumulatively.
+  if (!sum.isLogZero()) {
+    log2NormalizedCumulative(path_probs, in_degree, log2_sum,
+                             res->cumulativeWeights(prefix_len, state));
+  }
+}
+
+// Viterbi and forward cells of a state read the same incoming transitions
+// and emission probability, so the second one finds them in cache.
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computeFusedColumn(
+    const std::vector<int>& state_ids,
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* emission_probs,
+    const std::vector<Log2Score>& viterbi_prev,
+    std::vector<Log2Score>* viterbi_curr,
+    const std::vector<Log2Score>& forward_prev,
+    std::vector<Log2Score>* forward_curr, Score* path_probs, int prefix_len,
+    ViterbiMatrix* viterbi, ForwardMatrix* forward) const {
+  for (int state : state_ids) {
+    bool silent = state_emissions.isSilent(state);
+    ProbStateId best = bestPathTo(state, silent, emission_probs[state],
+                                  viterbi_prev, *viterbi_curr, nullptr);
+    (*viterbi_curr)[state] = best.first;
+    viterbi->backpointers_.set(prefix_len, state, best.second + 1);
+    computeForwardCell(state, silent, emission_probs[state], forward_prev,
+                       nullptr, forward_curr, path_probs, prefix_len,
+                       forward);
+  }
+}
+
+// Every state is computed in the same order and in the same way as in
+// viterbiSweep and forwardTracking, so both matrices are the same as when they
+// are computed separately. Emission probabilities are computed once per
+// column for both of them.
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::fusedSweep(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    int threads, EmissionTable<EmissionType, Score>* emission_table,
+    ViterbiMatrix* viterbi, ForwardMatrix* forward) const {
+  if (threads < 1) {
+    throw std::invalid_argument("Number of threads has to be positive.");
+  }
+  int length = emissions.size();
+  viterbi->backpointers_ = allocateBackpointers(length + 1);
+  forward->rows_ = length + 1;
+  forward->inv_offsets_ = inv_offsets_;
+  forward->weights_.assign((size_t)forward->rows_ * inv_offsets_.back(), 0);
+
+  std::vector<Log2Score> viterbi_prev(num_states_, Log2Score(0.0));
+  std::vector<Log2Score> viterbi_curr(num_states_, Log2Score(0.0));
+  viterbi_prev[initial_state_] = Log2Score(1.0);
+  std::vector<Log2Score> forward_prev(num_states_, Log2Score(0.0));
+  std::vector<Log2Score> forward_curr(num_states_, Log2Score(0.0));
+  forward_prev[initial_state_] = Log2Score(1.0);
+
+  auto finishColumn = [&]() {
+    rescaleRow(&viterbi_curr);
+    std::swap(viterbi_prev, viterbi_curr);
+    rescaleRow(&forward_curr);
+    std::swap(forward_prev, forward_curr);
+  };
+
+  StateEmissions<EmissionType> state_emissions(states);
+  if (threads == 1) {
+    std::vector<int> all_states(num_states_);
+    std::iota(all_states.begin(), all_states.end(), 0);
+    std::vector<Log2Score> emission_probs(num_states_);
+    std::vector<Score> path_probs(max_in_degree_);
+    for (int prefix_len = 1; prefix_len <= length; prefix_len++) {
+      const Log2Score* column_probs =
+          emissionColumn(emissions, prefix_len - 1, state_emissions,
+                         emission_table, &emission_probs);
+      computeFusedColumn(all_states, state_emissions, column_probs,
+                         viterbi_prev, &viterbi_curr, forward_prev,
+                         &forward_curr, path_probs.data(), prefix_len,
+                         viterbi, forward);
+      finishColumn();
+    }
+  } else {
+    std::vector<Log2Score> emission_probs(num_states_, Log2Score(1.0));
+    std::vector<std::vector<int>> thread_states = splitStates(
+        state_emissions, threads, viterbi->backpointers_.cellsPerWord());
+    std::vector<int> silent_states = silentStates(state_emissions);
+    std::vector<std::vector<Score>> path_probs(
+        threads, std::vector<Score>(max_in_degree_));
+    // Loaded by the calling thread as in viterbiSweepTeam.
+    const Log2Score* table_row = nullptr;
+    if (emission_table != nullptr && length > 0) {
+      table_row = emission_table->row(0);
+    }
+
+    auto parallel = [&](int step, int thread) {
+      const std::vector<int>& own_states = thread_states[thread];
+      const Log2Score* column_probs = table_row;
+      if (column_probs == nullptr) {
+        state_emissions.column(emissions[step], own_states, &emission_probs);
+        column_probs = emission_probs.data();
+      }
+      computeFusedColumn(own_states, state_emissions, column_probs,
+                         viterbi_prev, &viterbi_curr, forward_prev,
+                         &forward_curr, path_probs[thread].data(), step + 1,
+                         viterbi, forward);
+    };
+    auto sequential = [&](int step) {
+      const Log2Score* column_probs =
+          table_row != nullptr ? table_row : emission_probs.data();
+      computeFusedColumn(silent_states, state_emissions, column_probs,
+                         viterbi_prev, &viterbi_curr, forward_prev,
+                         &forward_curr, path_probs[0].data(), step + 1,
+                         viterbi, forward);
+      finishColumn();
+      if (table_row != nullptr && step + 1 < length) {
+        table_row = emission_table->row(step + 1);
+      }
+    };
+    runInLockstep(threads, length, parallel, sequential);
+  }
+
+  viterbi->last_row_ = std::move(viterbi_prev);
+  setLastStateWeights(forward_prev, forward);
+}
+
+// The same as forwardTracking but rows contain all lanes.
+template <typename EmissionType, typename Score>
+std::vector<typename HMM<EmissionType, Score>::ForwardMatrix>
+HMM<EmissionType, Score>::forwardTrackingBatch(
+    const std::vector<std::vector<EmissionType>>& emission_seqs,
+    const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+        states) const {
+  static_assert(std::is_same<Score, double>::value,
+                "Batched decoding needs double scores.");
+  checkBatch(emission_seqs, states);
+  int batch = emission_seqs.size();
+  std::vector<StateEmissions<EmissionType>> state_emissions;
+  std::vector<ForwardMatrix> res(batch);
+  for (int read = 0; read < batch; read++) {
+    state_emissions.emplace_back(states[read]);
+    res[read].rows_ = emission_seqs[read].size() + 1;
+    res[read].inv_offsets_ = inv_offsets_;
+    res[read].weights_.assign((size_t)res[read].rows_ * inv_offsets_.back(),
+                              0);
+  }
+  if (batch == 0) return res;
+  const StateEmissions<EmissionType>& silent = state_emissions[0];
+
+  std::vector<int> lanes = batchLanes(emission_seqs);
+  size_t row_size = (size_t)num_states_ * batch;
+  std::vector<Log2Score> prev_sum_all_paths(row_size, Log2Score(0));
+  std::vector<Log2Score> sum_all_paths(row_size, Log2Score(0));
+  std::fill_n(prev_sum_all_paths.begin() + (size_t)initial_state_ * batch,
+              batch, Log2Score(1));
+  std::vector<Log2Score> emission_probs(row_size);
+  std::vector<double> terms((size_t)max_in_degree_ * batch);
+  std::vector<double> cumulative(terms.size());
+  std::vector<double> log2_sums(batch);
+  int active = batch;
+  for (int prefix_len = 1; active > 0; prefix_len++) {
+    while (active > 0 &&
+           (int)emission_seqs[lanes[active - 1]].size() < prefix_len) {
+      active--;
+      std::vector<Log2Score> last_row;
+      for (int state = 0; state < num_states_; state++) {
+        last_row.push_back(prev_sum_all_paths[(size_t)state * batch + active]);
+      }
+      setLastStateWeights(last_row, &res[lanes[active]]);
+    }
+    if (active == 0) break;
+
+    batchEmissions(emission_seqs, state_emissions, lanes, prefix_len, active,
+                   &emission_probs);
+    for (int state = 0; state < num_states_; state++) {
+      const std::vector<Log2Score>& prev_row =
+          silent.isSilent(state) ? sum_all_paths : prev_sum_all_paths;
+      int begin = inv_offsets_[state];
+      int in_degree = inv_offsets_[state + 1] - begin;
+      log2SumExpPlusLanes(log2Exponents(prev_row.data()),
+                          inv_from_.data() + begin,
+                          inv_log2_probs_.data() + begin, in_degree, batch,
+                          active, terms.data(), log2_sums.data());
+      log2NormalizedCumulativeLanes(terms.data(), in_degree, batch, active,
+                                    log2_sums.data(), cumulative.data());
+      for (int lane = 0; lane < active; lane++) {
+        size_t cell = (size_t)state * batch + lane;
+        Log2Score& sum = sum_all_paths[cell];
+        sum.setExponent(log2_sums[lane]);
+        sum *= emission_probs[cell];
+        if (sum.isLogZero()) continue;
+        Score* weights =
+            res[lanes[lane]].cumulativeWeights(prefix_len, state);
+        for (int i = 0; i < in_degree; i++) {
+          weights[i] = cumulative[(size_t)i * batch + lane];
+        }
+      }
+    }
+    std::swap(prev_sum_all_paths, sum_all_paths);
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::setLastStateWeights(
+    const std::vector<Log2Score>& last_row, ForwardMatrix* res) const {
+  Log2Score total = Log2Score(0);
+  for (const Log2Score& sum : last_row) total += sum;
+  res->last_state_weights_.assign(num_states_, 0);
+  Score cumulative = 0;
   for (int state = 0; state < num_states_; state++) {
-    sum_all_paths[0][state] = Log2Num(0);
+    if (!total.isLogZero()) cumulative += (last_row[state] / total).value();
+    res->last_state_weights_[state] = cumulative;
   }
-  sum_all_paths[0][initial_state_] = Log2Num(1);
+}
+
+// States which are not computed keep zero sums and have no weights. A column
+// without any reachable state or where the band collapses is computed for all
+// states as in viterbiSweep.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ForwardMatrix
+HMM<EmissionType, Score>::forwardTrackingSparse(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    double sigmas, const StateBand* band,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  checkBand(emissions, band);
+  ForwardMatrix res;
+  res.rows_ = emissions.size() + 1;
+  res.inv_offsets_ = inv_offsets_;
+  res.row_begin_.assign(1, 0);
+  res.state_weights_.assign(1, 0);
+  allocateSparseRow(0, {}, &res);
 
+  std::vector<Log2Score> prev_sum_all_paths(num_states_, Log2Score(0));
+  std::vector<Log2Score> sum_all_paths(num_states_, Log2Score(0));
+  prev_sum_all_paths[initial_state_] = Log2Score(1);
+
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<int> all_states(num_states_);
+  std::iota(all_states.begin(), all_states.end(), 0);
+  std::vector<int> silent_states = silentStates(state_emissions);
+  std::vector<int> computed_states;
+  std::vector<Log2Score> emission_probs(num_states_);
+  std::vector<Score> path_probs(max_in_degree_);
+  Log2Score prev_best = Log2Score(1);
+  // Only these cells of sum_all_paths and prev_sum_all_paths can be nonzero
+  // so a column resets only them.
+  std::vector<int> curr_states, prev_states = {initial_state_};
   for (int prefix_len = 1; prefix_len <= (int)emissions.size(); prefix_len++) {
+    const EmissionType& emission = emissions[prefix_len - 1];
+    for (int state : curr_states) sum_all_paths[state] = Log2Score(0);
+    sparseColumnStates(state_emissions, emission, prefix_len - 1, sigmas, band,
+                       &computed_states);
+    computed_states.insert(computed_states.end(), silent_states.begin(),
+                           silent_states.end());
+    allocateSparseRow(prefix_len, computed_states, &res);
+    // The table is read only by columns computed for all states.
+    state_emissions.column(emission, computed_states, &emission_probs);
+    const Log2Score* column_probs = emission_probs.data();
+    computeForwardColumn(computed_states, state_emissions, column_probs,
+                         prev_sum_all_paths, &sum_all_paths, path_probs.data(),
+                         prefix_len, &res);
+
+    Log2Score best = bestOf(computed_states, sum_all_paths);
+    if (best.isLogZero() || bandCollapsed(band, best, prev_best)) {
+      column_probs = emissionColumn(emissions, prefix_len - 1, state_emissions,
+                                    emission_table, &emission_probs);
+      allocateSparseRow(prefix_len, all_states, &res);
+      computeForwardColumn(all_states, state_emissions, column_probs,
+                           prev_sum_all_paths, &sum_all_paths,
+                           path_probs.data(), prefix_len, &res);
+      computed_states = all_states;
+    }
+    rescaleRow(computed_states, &sum_all_paths);
+    prev_best = bestOf(computed_states, sum_all_paths);
+    std::swap(prev_sum_all_paths, sum_all_paths);
+    curr_states.swap(prev_states);
+    prev_states = computed_states;
+  }
+
+  setLastStateWeights(prev_sum_all_paths, &res);
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::allocateSparseRow(
+    int row, const std::vector<int>& state_ids, ForwardMatrix* res) const {
+  res->row_begin_.resize(row + 1);
+  size_t begin = res->row_begin_[row];
+  res->row_states_.resize(begin);
+  res->state_weights_.resize(begin + 1);
+  res->weights_.resize(res->state_weights_.back());
+
+  res->row_states_.insert(res->row_states_.end(), state_ids.begin(),
+                          state_ids.end());
+  std::sort(res->row_states_.begin() + begin, res->row_states_.end());
+  for (size_t idx = begin; idx < res->row_states_.size(); idx++) {
+    int state = res->row_states_[idx];
+    res->state_weights_.push_back(res->state_weights_.back() +
+                                  inv_offsets_[state + 1] -
+                                  inv_offsets_[state]);
+  }
+  res->weights_.resize(res->state_weights_.back(), 0);
+  res->row_begin_.push_back(res->row_states_.size());
+}
+
+// Rabiner-style scaling. Emission probabilities in a column are divided by the
+// greatest of them and after the column is computed it is divided by its sum.
+// Both multiply all paths ending in the column by the same number so
+// normalized weights are the same as in forwardTracking.
+template <typename EmissionType, typename Score>
+typename HMM<EmissionType, Score>::ForwardMatrix
+HMM<EmissionType, Score>::forwardTrackingScaled(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  ForwardMatrix res;
+  res.rows_ = emissions.size() + 1;
+  res.inv_offsets_ = inv_offsets_;
+  res.weights_.assign((size_t)res.rows_ * inv_offsets_.back(), 0);
+
+  std::vector<Score> inv_probs(inv_log2_probs_.size());
+  for (int idx = 0; idx < (int)inv_probs.size(); idx++) {
+    inv_probs[idx] = std::exp2(inv_log2_probs_[idx]);
+  }
+
+  // Scaled forward probabilities of the previous and the current column.
+  std::vector<Score> prev_row(num_states_, 0);
+  std::vector<Score> curr_row(num_states_, 0);
+  prev_row[initial_state_] = 1;
+
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Score> emission_probs(num_states_);
+  std::vector<Score> scaled_emissions(num_states_);
+  for (int prefix_len = 1; prefix_len <= (int)emissions.size(); prefix_len++) {
+    const Log2Score* column_probs =
+        emissionColumn(emissions, prefix_len - 1, state_emissions,
+                       emission_table, &emission_probs);
+    Score max_exponent = -HUGE_VAL;
+    for (int state = 0; state < num_states_; state++) {
+      if (state_emissions.isSilent(state)) continue;
+      max_exponent = std::max(max_exponent, column_probs[state].exponent());
+    }
     for (int state = 0; state < num_states_; state++) {
-      // If the state is silent no emission is emitted. Therefore we cannot
-      // extend the sequence of emission and we look at solutions with the
-      // same prefix length.
-      int prefix_prev;
-      if (states[state]->isSilent())
-        prefix_prev = prefix_len;
-      else
-        prefix_prev = prefix_len - 1;
-
-      // Sum of probabilities of all paths ending in @state and emitting
-      // sequence emissions[0...prefix_prev_len-1].
-      Log2Num sum = Log2Num(0);
-      std::vector<Log2Num> path_probs;
-      for (Transition transition : inv_transitions_[state]) {
-        Log2Num path_prob = transition.prob_ *
-                            states[state]->prob(emissions[prefix_len - 1]) *
-                            sum_all_paths[prefix_prev][transition.to_state_];
-        path_probs.push_back(path_prob);
-        sum += path_prob;
+      if (state_emissions.isSilent(state)) {
+        scaled_emissions[state] = 1;
+      } else if (max_exponent == -HUGE_VAL) {
+        scaled_emissions[state] = 0;
+      } else {
+        scaled_emissions[state] =
+            std::exp2(column_probs[state].exponent() - max_exponent);
       }
-      sum_all_paths[prefix_len][state] = sum;
+    }
 
-      // Normalize probabilities.
-      if (!sum.isLogZero()) {
-        for (const Log2Num& prob : path_probs) {
-          res[prefix_len][state].push_back((prob / sum).value());
-        }
+    Score column_sum = 0;
+    for (int state = 0; state < num_states_; state++) {
+      // Silent state extends paths from the same column.
+      const Score* prev =
+          state_emissions.isSilent(state) ? curr_row.data() : prev_row.data();
+      int begin = inv_offsets_[state];
+      int in_degree = inv_offsets_[state + 1] - begin;
+      Score* weights = res.cumulativeWeights(prefix_len, state);
+      Score sum = 0;
+      for (int idx = 0; idx < in_degree; idx++) {
+        sum += inv_probs[begin + idx] * prev[inv_from_[begin + idx]];
+        weights[idx] = sum;
+      }
+      curr_row[state] = sum * scaled_emissions[state];
+      column_sum += curr_row[state];
+
+      // Normalize cumulative weights. Unreachable states have no weights.
+      for (int idx = 0; idx < in_degree; idx++) {
+        weights[idx] = curr_row[state] > 0 ? weights[idx] / sum : 0;
       }
     }
+
+    if (column_sum > 0) {
+      for (Score& prob : curr_row) prob /= column_sum;
+    }
+    std::swap(prev_row, curr_row);
+  }
+
+  // Weights that are used when sampling for the last state.
+  Score total = std::accumulate(prev_row.begin(), prev_row.end(), Score(0));
+  res.last_state_weights_.assign(num_states_, 0);
+  Score cumulative = 0;
+  for (int state = 0; state < num_states_; state++) {
+    if (total > 0) cumulative += prev_row[state] / total;
+    res.last_state_weights_[state] = cumulative;
   }
 
   return res;
 }
 
-template <typename EmissionType>
-std::vector<std::vector<int>> HMM<EmissionType>::posteriorProbSample(
+// Returns index of the first cumulative weight greater than @uniform scaled by
+// the total weight.
+template <typename EmissionType, typename Score>
+int HMM<EmissionType, Score>::sampleCumulative(const Score* cumulative,
+                                               int size, double uniform) {
+  if (size == 0) return 0;
+  Score threshold = uniform * cumulative[size - 1];
+  int idx = std::upper_bound(cumulative, cumulative + size, threshold) -
+            cumulative;
+  return std::min(idx, size - 1);
+}
+
+template <typename EmissionType, typename Score>
+std::vector<int> HMM<EmissionType, Score>::samplePath(
+    const ForwardMatrix& forward_matrix,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    uint64_t seed, int sample_id) const {
+  CounterRng rng(seed, sample_id);
+  int last_state = sampleCumulative(forward_matrix.last_state_weights_.data(),
+                                    num_states_, rng.nextUniform());
+  return backtrackMatrix(last_state, forward_matrix.rows_ - 1, states,
+                         [&forward_matrix, &rng, this](int row, int state)
+                             ->int {
+    int idx = sampleCumulative(forward_matrix.cumulativeWeights(row, state),
+                               inv_transitions_[state].size(),
+                               rng.nextUniform());
+    return inv_transitions_[state][idx].to_state_;
+  });
+}
+
+// Every sample is in some state of the current row. Samples are sorted by
+// their states so that samples in the same state share the slice of weights.
+// Samples in silent states stay in the current row after the step. The others
+// move to the previous row. Random numbers are drawn in the same order as in
+// samplePath.
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::sampleBatch(
+    const ForwardMatrix& forward_matrix,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    uint64_t seed, int begin, int end,
+    std::vector<std::vector<int>>* res) const {
+  std::vector<CounterRng> rngs;
+  // Pairs (current state, sample id) of samples in the current row.
+  std::vector<std::pair<int, int>> in_row;
+  for (int sample = begin; sample < end; sample++) {
+    rngs.emplace_back(seed, sample);
+    int last_state =
+        sampleCumulative(forward_matrix.last_state_weights_.data(),
+                         num_states_, rngs.back().nextUniform());
+    in_row.emplace_back(last_state, sample - begin);
+    (*res)[sample].clear();
+  }
+
+  std::vector<std::pair<int, int>> in_prev_row;
+  for (int row = forward_matrix.rows_ - 1; row > 0; row--) {
+    while (!in_row.empty()) {
+      std::sort(in_row.begin(), in_row.end());
+      std::vector<std::pair<int, int>> in_silent_states;
+      for (int idx = 0; idx < (int)in_row.size();) {
+        int state = in_row[idx].first;
+        const Score* weights = forward_matrix.cumulativeWeights(row, state);
+        int in_degree = inv_transitions_[state].size();
+        bool silent = states[state]->isSilent();
+        for (; idx < (int)in_row.size() && in_row[idx].first == state; idx++) {
+          int sample = in_row[idx].second;
+          (*res)[begin + sample].push_back(state);
+          int prev = sampleCumulative(weights, in_degree,
+                                      rngs[sample].nextUniform());
+          int prev_state = inv_transitions_[state][prev].to_state_;
+          if (silent) {
+            in_silent_states.emplace_back(prev_state, sample);
+          } else {
+            in_prev_row.emplace_back(prev_state, sample);
+          }
+        }
+      }
+      std::swap(in_row, in_silent_states);
+    }
+    std::swap(in_row, in_prev_row);
+  }
+
+  for (const std::pair<int, int>& state_sample : in_row) {
+    std::vector<int>& path = (*res)[begin + state_sample.second];
+    path.push_back(state_sample.first);
+    std::reverse(path.begin(), path.end());
+  }
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::posteriorProbSample(
     int samples, int seed, const std::vector<EmissionType>& emission_seq,
     const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
+  return posteriorProbSample(samples, seed, emission_seq, states,
+                             SamplingParams());
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::posteriorProbSample(
+    int samples, int seed, const std::vector<EmissionType>& emission_seq,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const SamplingParams& params) const {
+  return posteriorProbSample(samples, seed, emission_seq, states, params,
+                             nullptr);
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::posteriorProbSample(
+    int samples, int seed, const std::vector<EmissionType>& emission_seq,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const SamplingParams& params,
+    EmissionTable<EmissionType, Score>* emission_table) const {
   auto start = system_clock::now();
 
   // Checks is the input states and transitions are valid.
   isValid(states);
+  checkEmissionTable(emission_seq, emission_table);
 
-  ForwardMatrix forward_matrix = forwardTracking(emission_seq, states);
-
-  // Sampling matrix could be calculated in forwardTracking but I split it
-  // into two phases because it's better for debugging and testing. Weights in
-  // discrete_distribution<int> are automatically normalized. It does not store
-  // original values.
-  int num_states_ = states.size();
-  SamplingMatrix sampling_matrix(forward_matrix.size());
-  for (int row = 0; row < (int)forward_matrix.size(); row++) {
-    for (int col = 0; col < num_states_; col++) {
-      const auto& weights = forward_matrix[row][col];
-      sampling_matrix[row].emplace_back(weights.begin(), weights.end());
-    }
+  if (params.scaled_forward_ && params.forward_threads_ > 1) {
+    throw std::invalid_argument(
+        "Scaled forward matrix cannot be computed by multiple threads.");
+  }
+  bool gated = params.emission_gate_sigmas_ > 0;
+  bool sparse = gated || params.band_ != nullptr;
+  if (sparse && (params.scaled_forward_ || params.forward_threads_ > 1)) {
+    throw std::invalid_argument(
+        "Emission gating and band cannot be used with scaled forward matrix "
+        "or multiple threads.");
+  }
+  if (gated && params.band_ != nullptr) {
+    throw std::invalid_argument("Emission gating cannot be used with band.");
+  }
+  if (params.compressed_transitions_ && (params.scaled_forward_ || sparse)) {
+    throw std::invalid_argument(
+        "Compressed transitions cannot be used with scaled forward matrix, "
+        "emission gating or band.");
+  }
+  ForwardMatrix forward_matrix;
+  if (params.scaled_forward_) {
+    forward_matrix =
+        forwardTrackingScaled(emission_seq, states, emission_table);
+  } else if (sparse) {
+    forward_matrix =
+        forwardTrackingSparse(emission_seq, states,
+                              params.emission_gate_sigmas_, params.band_,
+                              emission_table);
+  } else {
+    forward_matrix = forwardTracking(emission_seq, states,
+                                     params.forward_threads_,
+                                     params.compressed_transitions_,
+                                     emission_table);
   }
 
-  // Weights that are used when sampling for the last state.
-  std::vector<double> last_state_weights(num_states_);
-  const auto& last_row = forward_matrix.back();
-  for (int col = 0; col < num_states_; col++) {
-    last_state_weights[col] =
-        std::accumulate(last_row[col].begin(), last_row[col].end(), 0.0);
+  LOG(INFO) << "Computation of forward matrix took: "
+            << duration_cast<milliseconds>(system_clock::now() - start).count()
+            << " ms";
+
+  return sampleForwardMatrix(forward_matrix, samples, seed, states, params);
+}
+
+template <typename EmissionType, typename Score>
+ViterbiAndSamples HMM<EmissionType, Score>::runViterbiAndSample(
+    int samples, int seed, const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const SamplingParams& params) const {
+  return runViterbiAndSample(samples, seed, emissions, states, params,
+                             nullptr);
+}
+
+template <typename EmissionType, typename Score>
+ViterbiAndSamples HMM<EmissionType, Score>::runViterbiAndSample(
+    int samples, int seed, const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const SamplingParams& params,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  auto start = system_clock::now();
+
+  // Checks is the input states and transitions are valid.
+  isValid(states);
+  checkEmissionTable(emissions, emission_table);
+  if (params.scaled_forward_ || params.emission_gate_sigmas_ > 0 ||
+      params.band_ != nullptr || params.compressed_transitions_) {
+    throw std::invalid_argument(
+        "Scaled forward matrix, emission gating, band and compressed "
+        "transitions cannot be computed together with Viterbi.");
   }
 
-  std::default_random_engine generator(seed);
-  std::discrete_distribution<int> last_state(last_state_weights.begin(),
-                                             last_state_weights.end());
+  ViterbiMatrix viterbi;
+  ForwardMatrix forward;
+  fusedSweep(emissions, states, params.forward_threads_, emission_table,
+             &viterbi, &forward);
 
-  LOG(INFO) << "Computation of forward matrix took: "
+  LOG(INFO) << "Computation of Viterbi and forward matrix took: "
+            << duration_cast<milliseconds>(system_clock::now() - start).count()
+            << " ms";
+
+  ViterbiAndSamples res;
+  res.viterbi_state_ids_ =
+      backtrackMatrix(bestTerminalState(viterbi.last_row_), emissions.size(),
+                      states, [&viterbi, this](int row, int state)->int {
+        return previousState(viterbi.backpointers_, row, state);
+      });
+  res.samples_ = sampleForwardMatrix(forward, samples, seed, states, params);
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<std::vector<int>>>
+HMM<EmissionType, Score>::posteriorProbSampleBatch(
+    int samples, int seed,
+    const std::vector<std::vector<EmissionType>>& emission_seqs,
+    const std::vector<std::vector<std::unique_ptr<State<EmissionType>>>>&
+        states,
+    const SamplingParams& params) const {
+  if (params.scaled_forward_ || params.emission_gate_sigmas_ > 0 ||
+      params.band_ != nullptr || params.compressed_transitions_) {
+    throw std::invalid_argument(
+        "Batched sampling does not support scaled forward matrix, emission "
+        "gating, band and compressed transitions.");
+  }
+  auto start = system_clock::now();
+  std::vector<ForwardMatrix> forward_matrices =
+      forwardTrackingBatch(emission_seqs, states);
+  LOG(INFO) << "Computation of forward matrices of " << emission_seqs.size()
+            << " reads took: "
             << duration_cast<milliseconds>(system_clock::now() - start).count()
             << " ms";
 
-  start = system_clock::now();
+  std::vector<std::vector<std::vector<int>>> res;
+  for (int read = 0; read < (int)emission_seqs.size(); read++) {
+    res.push_back(sampleForwardMatrix(forward_matrices[read], samples,
+                                      batchReadSeed(seed, read), states[read],
+                                      params));
+  }
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<int>> HMM<EmissionType, Score>::sampleForwardMatrix(
+    const ForwardMatrix& forward_matrix, int samples, int seed,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    const SamplingParams& params) const {
+  if (params.threads_ < 1) {
+    throw std::invalid_argument("Number of threads has to be positive.");
+  }
+  // Sampling would otherwise return paths through unreachable states.
+  if (samples > 0 && !(forward_matrix.last_state_weights_.back() > 0)) {
+    throw std::invalid_argument("Emissions cannot be generated by the HMM.");
+  }
+  auto start = system_clock::now();
   std::vector<std::vector<int>> res(samples);
-  for (int i = 0; i < samples; i++) {
-    res[i] = backtrackMatrix(
-        last_state(generator), sampling_matrix.size() - 1, states,
-        [&sampling_matrix, &generator, this ](int row, int state)->int {
-          int idx = sampling_matrix[row][state](generator);
-          return inv_transitions_[state][idx].to_state_;
-        });
+  // Forward matrix is only read by threads. Without batching samples are
+  // handed out to threads one by one. With batching every thread gets
+  // contiguous block of samples.
+  std::atomic<int> next_sample(0);
+  auto worker = [&](int thread) {
+    if (params.batched_traceback_) {
+      int begin = (long long)samples * thread / params.threads_;
+      int end = (long long)samples * (thread + 1) / params.threads_;
+      sampleBatch(forward_matrix, states, seed, begin, end, &res);
+      return;
+    }
+    for (int i = next_sample++; i < samples; i = next_sample++) {
+      res[i] = samplePath(forward_matrix, states, seed, i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int thread = 1; thread < params.threads_; thread++) {
+    threads.emplace_back(worker, thread);
   }
+  worker(0);
+  for (std::thread& thread : threads) thread.join();
+
   LOG(INFO) << "Computation of all samples took: "
             << duration_cast<milliseconds>(system_clock::now() - start).count()
             << " ms";
   return res;
 }
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<BasicLog2Num<Score>>>
+HMM<EmissionType, Score>::forwardProbs(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    EmissionTable<EmissionType, Score>* emission_table,
+    std::vector<double>* log2_scales) const {
+  std::vector<std::vector<Log2Score>> res(
+      emissions.size() + 1, std::vector<Log2Score>(num_states_, Log2Score(0)));
+  res[0][initial_state_] = Log2Score(1);
+  log2_scales->assign(emissions.size() + 1, 0);
+
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Score> emission_probs(num_states_);
+  for (int prefix_len = 1; prefix_len <= (int)emissions.size(); prefix_len++) {
+    const Log2Score* column_probs =
+        emissionColumn(emissions, prefix_len - 1, state_emissions,
+                       emission_table, &emission_probs);
+    (*log2_scales)[prefix_len] =
+        (*log2_scales)[prefix_len - 1] +
+        computeForwardProbsRow(state_emissions, column_probs,
+                               res[prefix_len - 1], &res[prefix_len]);
+  }
+
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+double HMM<EmissionType, Score>::computeForwardProbsRow(
+    const StateEmissions<EmissionType>& state_emissions,
+    const Log2Score* column_probs, const std::vector<Log2Score>& prev_row,
+    std::vector<Log2Score>* curr_row) const {
+  for (int state = 0; state < num_states_; state++) {
+    // Silent state does not emit so paths come from the same row.
+    const std::vector<Log2Score>& from_row =
+        state_emissions.isSilent(state) ? *curr_row : prev_row;
+    int begin = inv_offsets_[state];
+    Log2Score sum;
+    sum.setExponent(log2SumExpPlus(
+        log2Exponents(from_row.data()), inv_from_.data() + begin,
+        inv_log2_probs_.data() + begin, inv_offsets_[state + 1] - begin,
+        nullptr));
+    (*curr_row)[state] = sum * column_probs[state];
+  }
+  return rescaleRow(curr_row);
+}
+
+// States are processed in descending order in every row because transition
+// to silent state goes from state with lower id in the same row. In row 0
+// silent states are not entered the same way as in forwardProbs. Rows are
+// computed in @curr_row and copied to the flat result.
+template <typename EmissionType, typename Score>
+std::vector<BasicLog2Num<Score>> HMM<EmissionType, Score>::backwardProbs(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    EmissionTable<EmissionType, Score>* emission_table,
+    std::vector<double>* log2_scales) const {
+  int length = emissions.size();
+  std::vector<Log2Score> res((size_t)(length + 1) * num_states_);
+  log2_scales->assign(length + 1, 0);
+
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Score> emission_probs(num_states_);
+  std::vector<Log2Score> curr_row(num_states_), next_row(num_states_);
+  const Log2Score* column_probs = emission_probs.data();
+  for (int row = length; row >= 0; row--) {
+    if (row < length) {
+      column_probs = emissionColumn(emissions, row, state_emissions,
+                                    emission_table, &emission_probs);
+    }
+
+    for (int state = num_states_ - 1; state >= 0; state--) {
+      // The path can end after all emissions are emitted.
+      Log2Score sum = row == length ? Log2Score(1) : Log2Score(0);
+      for (const Transition& transition : transitions_[state]) {
+        int next_state = transition.to_state_;
+        Log2Score prob(transition.prob_);
+        if (state_emissions.isSilent(next_state)) {
+          if (row > 0) sum += prob * curr_row[next_state];
+        } else if (row < length) {
+          sum += prob * column_probs[next_state] * next_row[next_state];
+        }
+      }
+      curr_row[state] = sum;
+    }
+    double next_scale = row < length ? (*log2_scales)[row + 1] : 0;
+    (*log2_scales)[row] = next_scale + rescaleRow(&curr_row);
+    std::copy(curr_row.begin(), curr_row.end(),
+              res.begin() + (size_t)row * num_states_);
+    std::swap(curr_row, next_row);
+  }
+
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+void HMM<EmissionType, Score>::computePosteriors(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    EmissionTable<EmissionType, Score>* emission_table,
+    const std::function<void(int, const std::vector<double>&)>& callback)
+    const {
+  // Checks is the input states and transitions are valid.
+  isValid(states);
+  checkEmissionTable(emissions, emission_table);
+
+  std::vector<double> backward_scales;
+  std::vector<Log2Score> backward =
+      backwardProbs(emissions, states, emission_table, &backward_scales);
+
+  // Probability of the whole sequence of emissions is the backward
+  // probability of the initial state before the first emission. Scales are
+  // put together in double.
+  Log2Num total(backward[initial_state_]);
+  if (!total.isLogZero()) {
+    total.setExponent(total.exponent() + backward_scales[0]);
+  }
+
+  StateEmissions<EmissionType> state_emissions(states);
+  std::vector<Log2Score> emission_probs(num_states_);
+  std::vector<Log2Score> forward_prev(num_states_, Log2Score(0));
+  std::vector<Log2Score> forward_curr(num_states_, Log2Score(0));
+  forward_prev[initial_state_] = Log2Score(1);
+  double forward_scale = 0;
+  std::vector<double> posteriors(num_states_);
+  for (int row = 1; row <= (int)emissions.size(); row++) {
+    const Log2Score* column_probs = emissionColumn(
+        emissions, row - 1, state_emissions, emission_table, &emission_probs);
+    forward_scale += computeForwardProbsRow(state_emissions, column_probs,
+                                            forward_prev, &forward_curr);
+    const Log2Score* backward_row = backward.data() + (size_t)row * num_states_;
+    Log2Num scale;
+    scale.setExponent(forward_scale + backward_scales[row]);
+    for (int state = 0; state < num_states_; state++) {
+      if (state_emissions.isSilent(state) || total.isLogZero()) {
+        posteriors[state] = 0;
+      } else {
+        posteriors[state] = (Log2Num(forward_curr[state]) *
+                             Log2Num(backward_row[state]) * scale / total)
+                                .value();
+      }
+    }
+    callback(row - 1, posteriors);
+    std::swap(forward_prev, forward_curr);
+  }
+}
+
+template <typename EmissionType, typename Score>
+std::vector<std::vector<double>> HMM<EmissionType, Score>::statePosteriors(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
+  std::vector<std::vector<double>> res(emissions.size());
+  computePosteriors(emissions, states, nullptr,
+                    [&res](int idx, const std::vector<double>& posteriors) {
+    res[idx] = posteriors;
+  });
+  return res;
+}
+
+template <typename EmissionType, typename Score>
+PosteriorDecoding HMM<EmissionType, Score>::posteriorDecoding(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states) const {
+  return posteriorDecoding(emissions, states, nullptr);
+}
+
+template <typename EmissionType, typename Score>
+PosteriorDecoding HMM<EmissionType, Score>::posteriorDecoding(
+    const std::vector<EmissionType>& emissions,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states,
+    EmissionTable<EmissionType, Score>* emission_table) const {
+  PosteriorDecoding res;
+  res.state_ids_.push_back(initial_state_);
+  computePosteriors(emissions, states, emission_table,
+                    [&res](int, const std::vector<double>& posteriors) {
+    int best_state = std::max_element(posteriors.begin(), posteriors.end()) -
+                     posteriors.begin();
+    res.state_ids_.push_back(best_state);
+    res.posteriors_.push_back(posteriors[best_state]);
+  });
+  return res;
+}
@@ -0,0 +1,125 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hmm_binary.h"
+
+namespace {
+
+size_t payloadSize(int num_states, uint64_t num_transitions) {
+  return num_transitions * (sizeof(double) + sizeof(int32_t)) +
+         (num_states + 1) * sizeof(int32_t);
+}
+
+}  // namespace
+
+uint64_t fnv1a64(const char* data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool isBinaryModel(const char* data, size_t size) {
+  return size >= sizeof(kBinaryModelMagic) &&
+         memcmp(data, kBinaryModelMagic, sizeof(kBinaryModelMagic)) == 0;
+}
+
+std::string binaryModelStr(int initial_state, int kmer_length,
+                           const std::vector<int32_t>& offsets,
+                           const std::vector<int32_t>& to_states,
+                           const std::vector<double>& log2_probs) {
+  std::string payload;
+  payload.append((const char*)log2_probs.data(),
+                 log2_probs.size() * sizeof(double));
+  payload.append((const char*)offsets.data(),
+                 offsets.size() * sizeof(int32_t));
+  payload.append((const char*)to_states.data(),
+                 to_states.size() * sizeof(int32_t));
+
+  BinaryModelHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, kBinaryModelMagic, sizeof(kBinaryModelMagic));
+  header.version_ = kBinaryModelVersion;
+  header.initial_state_ = initial_state;
+  header.num_states_ = offsets.size() - 1;
+  header.kmer_length_ = kmer_length;
+  header.num_transitions_ = to_states.size();
+  header.checksum_ = fnv1a64(payload.data(), payload.size());
+
+  return std::string((const char*)&header, sizeof(header)) + payload;
+}
+
+BinaryModelView::BinaryModelView(const char* data, size_t size) {
+  if (size < sizeof(BinaryModelHeader) || !isBinaryModel(data, size)) {
+    throw std::invalid_argument("Not a binary model.");
+  }
+  header_ = (const BinaryModelHeader*)data;
+  if (header_->version_ != kBinaryModelVersion) {
+    throw std::invalid_argument("Unsupported version of binary model: " +
+                                std::to_string(header_->version_));
+  }
+  int num_states = header_->num_states_;
+  uint64_t num_transitions = header_->num_transitions_;
+  // Bounds the sizes before they are multiplied.
+  if (num_states <= 0 || num_transitions > size ||
+      sizeof(BinaryModelHeader) + payloadSize(num_states, num_transitions) !=
+          size) {
+    throw std::invalid_argument("Binary model has wrong size.");
+  }
+  const char* payload = data + sizeof(BinaryModelHeader);
+  if (fnv1a64(payload, size - sizeof(BinaryModelHeader)) !=
+      header_->checksum_) {
+    throw std::invalid_argument("Checksum of binary model does not match.");
+  }
+
+  log2_probs_ = (const double*)payload;
+  offsets_ = (const int32_t*)(log2_probs_ + num_transitions);
+  to_states_ = offsets_ + num_states + 1;
+
+  if (initialState() < 0 || initialState() >= num_states ||
+      offsets_[0] != 0 || (uint64_t)offsets_[num_states] != num_transitions) {
+    throw std::invalid_argument("Binary model is corrupted.");
+  }
+  for (int state = 0; state < num_states; state++) {
+    if (offsets_[state] > offsets_[state + 1]) {
+      throw std::invalid_argument("Binary model is corrupted.");
+    }
+  }
+  for (uint64_t i = 0; i < num_transitions; i++) {
+    if (to_states_[i] < 0 || to_states_[i] >= num_states) {
+      throw std::invalid_argument("Binary model is corrupted.");
+    }
+  }
+}
+
+MappedFile::MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open file: " + path);
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot read size of file: " + path);
+  }
+  size_ = info.st_size;
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Cannot map file: " + path);
+    }
+    data_ = (const char*)data;
+  }
+  // The mapping stays valid after the file is closed.
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) munmap((void*)data_, size_);
+}
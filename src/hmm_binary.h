@@ -0,0 +1,83 @@
+// Binary format of HMM transitions. The file can be memory mapped and used
+// directly without parsing.
+//
+// Layout, all numbers in native byte order:
+// BinaryModelHeader
+// double log2_probs[num_transitions]
+// int32_t offsets[num_states + 1]
+// int32_t to_states[num_transitions]
+// Transitions from state u are at positions offsets[u] ... offsets[u+1]-1.
+// Checksum is FNV-1a of everything after the header.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const char kBinaryModelMagic[8] = {'N', 'R', 'A', 'H', 'M', 'M', '\0', '\0'};
+const uint32_t kBinaryModelVersion = 1;
+
+struct BinaryModelHeader {
+  char magic_[8];
+  uint32_t version_;
+  int32_t initial_state_;
+  int32_t num_states_;
+  // HMM::kmerLength(). Models written before it was stored have zero here.
+  uint32_t kmer_length_;
+  uint64_t num_transitions_;
+  uint64_t checksum_;
+};
+
+// 64-bit FNV-1a hash.
+uint64_t fnv1a64(const char* data, size_t size);
+
+// Does @data start with the magic of binary model?
+bool isBinaryModel(const char* data, size_t size);
+
+// Serializes transitions given as arrays in the layout above.
+std::string binaryModelStr(int initial_state, int kmer_length,
+                           const std::vector<int32_t>& offsets,
+                           const std::vector<int32_t>& to_states,
+                           const std::vector<double>& log2_probs);
+
+// Read-only view of a binary model stored in memory. Nothing is copied so
+// @data has to outlive the view. Header, sizes and checksum are checked in
+// the constructor which throws std::invalid_argument if they are wrong.
+// @data has to be aligned to 8 bytes.
+class BinaryModelView {
+ public:
+  BinaryModelView(const char* data, size_t size);
+
+  int initialState() const { return header_->initial_state_; }
+  int numStates() const { return header_->num_states_; }
+  int kmerLength() const { return header_->kmer_length_; }
+  size_t numTransitions() const { return header_->num_transitions_; }
+  const int32_t* offsets() const { return offsets_; }
+  const int32_t* toStates() const { return to_states_; }
+  const double* log2Probs() const { return log2_probs_; }
+
+ private:
+  const BinaryModelHeader* header_;
+  const double* log2_probs_;
+  const int32_t* offsets_;
+  const int32_t* to_states_;
+};
+
+// Read-only file mapped to memory. Throws std::runtime_error if the file
+// cannot be mapped.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Mapping starts at page boundary so it is aligned for BinaryModelView.
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
@@ -6,6 +6,9 @@
 
 const int kNumBases = 4;
 const char kBases[] = {'A', 'C', 'T', 'G'};
+// The longest kmer whose MoveHMM with move threshold 2 has fewer than 2^31
+// transitions (4^13 * 22), so they can be indexed by int.
+const int kMaxKmerLength = 13;
 
 // Calculate the smallest move size between two kmers.
 int getSmallestMove(const std::string& prev_kmer, const std::string& next_kmer);
@@ -0,0 +1,1165 @@
+#include <algorithm>
+#include <cmath>
+
+#include "log2_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOG2_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Coefficients 1/k! of Taylor series of e^y for k = 12 ... 0. The series is
+// evaluated for |y| <= ln(2)/2 where the error is below 2e-16.
+const double kExpCoefficients[] = {
+    1.0 / 479001600, 1.0 / 39916800, 1.0 / 3628800, 1.0 / 362880,
+    1.0 / 40320,     1.0 / 5040,     1.0 / 720,     1.0 / 120,
+    1.0 / 24,        1.0 / 6,        1.0 / 2,       1.0,
+    1.0};
+const int kExpCoefficientsSize =
+    sizeof(kExpCoefficients) / sizeof(kExpCoefficients[0]);
+
+// Smaller exponents are flushed to zero by the vectorized exp2.
+const double kMinExponent = -1022;
+const double kMaxExponent = 1023;
+
+// The same for floats. Taylor series up to k = 7 has error below 1e-8.
+const float kExpCoefficientsFloat[] = {1.0f / 5040, 1.0f / 720, 1.0f / 120,
+                                       1.0f / 24,   1.0f / 6,   1.0f / 2,
+                                       1.0f,        1.0f};
+const int kExpCoefficientsFloatSize =
+    sizeof(kExpCoefficientsFloat) / sizeof(kExpCoefficientsFloat[0]);
+const float kMinExponentFloat = -126;
+const float kMaxExponentFloat = 127;
+
+/////////////////////////////// Scalar ///////////////////////////////////////
+
+template <typename Real>
+Real maxPlusScalar(const Real* values, const int* idx, const Real* weights,
+                   int n, int* argmax) {
+  Real best = -HUGE_VAL;
+  *argmax = -1;
+  for (int i = 0; i < n; i++) {
+    Real term = values[idx[i]] + weights[i];
+    if (term > best) {
+      best = term;
+      *argmax = i;
+    }
+  }
+  return best;
+}
+
+int32_t maxPlusFixedScalar(const int32_t* values, const int* idx,
+                           const int32_t* weights, int n, int* argmax) {
+  int32_t best = kLog2FixedZero;
+  *argmax = -1;
+  for (int i = 0; i < n; i++) {
+    int32_t term = values[idx[i]] + weights[i];
+    if (term > best) {
+      best = term;
+      *argmax = i;
+    }
+  }
+  return best;
+}
+
+template <typename Real>
+Real sumExpPlusScalar(const Real* values, const int* idx, const Real* weights,
+                      int n, Real* terms) {
+  Real best = -HUGE_VAL;
+  for (int i = 0; i < n; i++) {
+    Real term = values[idx[i]] + weights[i];
+    if (terms != nullptr) terms[i] = term;
+    best = std::max(best, term);
+  }
+  if (best == -HUGE_VAL) return best;
+
+  Real sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += std::exp2(values[idx[i]] + weights[i] - best);
+  }
+  return best + std::log2(sum);
+}
+
+void maxPlusUpdateScalar(const double* values, const int* idx,
+                         const double* weights, int n, int offset, int arg,
+                         double* best, int* best_pos, int* best_arg) {
+  for (int i = 0; i < n; i++) {
+    double term = values[idx[i]] + weights[i];
+    int pos = offset + idx[i];
+    if (term > best[i] || (term == best[i] && pos < best_pos[i])) {
+      best[i] = term;
+      best_pos[i] = pos;
+      best_arg[i] = arg;
+    }
+  }
+}
+
+template <typename Real>
+void normalizedCumulativeScalar(const Real* terms, int n, Real log2_total,
+                                Real* res) {
+  Real cumulative = 0;
+  for (int i = 0; i < n; i++) {
+    cumulative += std::exp2(terms[i] - log2_total);
+    res[i] = cumulative;
+  }
+}
+
+void maxPlusLanesScalar(const double* values, const int* idx,
+                        const double* weights, int n, int stride, int lanes,
+                        double* best, int* argmax) {
+  if (lanes == 0) return;
+  std::fill(best, best + lanes, -HUGE_VAL);
+  std::fill(argmax, argmax + lanes, -1);
+  for (int i = 0; i < n; i++) {
+    const double* row = values + (size_t)idx[i] * stride;
+    for (int lane = 0; lane < lanes; lane++) {
+      double term = row[lane] + weights[i];
+      if (term > best[lane]) {
+        best[lane] = term;
+        argmax[lane] = i;
+      }
+    }
+  }
+}
+
+void sumExpPlusLanesScalar(const double* values, const int* idx,
+                           const double* weights, int n, int stride,
+                           int lanes, double* terms, double* res) {
+  if (lanes == 0) return;
+  std::fill(res, res + lanes, -HUGE_VAL);
+  for (int i = 0; i < n; i++) {
+    const double* row = values + (size_t)idx[i] * stride;
+    for (int lane = 0; lane < lanes; lane++) {
+      double term = row[lane] + weights[i];
+      terms[(size_t)i * stride + lane] = term;
+      res[lane] = std::max(res[lane], term);
+    }
+  }
+  for (int lane = 0; lane < lanes; lane++) {
+    if (res[lane] == -HUGE_VAL) continue;
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+      sum += std::exp2(terms[(size_t)i * stride + lane] - res[lane]);
+    }
+    res[lane] += std::log2(sum);
+  }
+}
+
+void normalizedCumulativeLanesScalar(const double* terms, int n, int stride,
+                                     int lanes, const double* log2_totals,
+                                     double* res) {
+  if (lanes == 0) return;
+  for (int lane = 0; lane < lanes; lane++) {
+    double cumulative = 0;
+    for (int i = 0; i < n; i++) {
+      size_t pos = (size_t)i * stride + lane;
+      cumulative += std::exp2(terms[pos] - log2_totals[lane]);
+      res[pos] = cumulative;
+    }
+  }
+}
+
+#ifdef LOG2_KERNELS_X86
+
+// Gather, min, max and scalef intrinsics of some GCC versions use
+// intentionally undefined vectors which trigger false warnings when they are
+// inlined. The warnings stay on for the scalar and dispatch code.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+//////////////////////////////// AVX2 ////////////////////////////////////////
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+// 2^x for vector of exponents. Exponents below kMinExponent give zero.
+AVX2_TARGET inline __m256d exp2Avx2(__m256d x) {
+  __m256d underflow =
+      _mm256_cmp_pd(x, _mm256_set1_pd(kMinExponent), _CMP_LT_OQ);
+  x = _mm256_max_pd(x, _mm256_set1_pd(kMinExponent));
+  x = _mm256_min_pd(x, _mm256_set1_pd(kMaxExponent));
+  __m256d n =
+      _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d y = _mm256_mul_pd(_mm256_sub_pd(x, n), _mm256_set1_pd(M_LN2));
+  __m256d p = _mm256_set1_pd(kExpCoefficients[0]);
+  for (int k = 1; k < kExpCoefficientsSize; k++) {
+    p = _mm256_fmadd_pd(p, y, _mm256_set1_pd(kExpCoefficients[k]));
+  }
+  // 2^n is built from the bits of n + 1023 which is the biased exponent.
+  __m256d biased =
+      _mm256_add_pd(n, _mm256_set1_pd(1023.0 + 4503599627370496.0));
+  __m256i bits = _mm256_slli_epi64(_mm256_castpd_si256(biased), 52);
+  p = _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+  return _mm256_andnot_pd(underflow, p);
+}
+
+AVX2_TARGET inline __m256d gatherPlusAvx2(const double* values, const int* idx,
+                                          const double* weights) {
+  __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx));
+  return _mm256_add_pd(_mm256_i32gather_pd(values, ids, 8),
+                       _mm256_loadu_pd(weights));
+}
+
+AVX2_TARGET double horizontalMaxAvx2(__m256d x) {
+  __m128d m =
+      _mm_max_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+  return std::max(_mm_cvtsd_f64(m), _mm_cvtsd_f64(_mm_unpackhi_pd(m, m)));
+}
+
+AVX2_TARGET double horizontalSumAvx2(__m256d x) {
+  __m128d s =
+      _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+  return _mm_cvtsd_f64(s) + _mm_cvtsd_f64(_mm_unpackhi_pd(s, s));
+}
+
+// Every lane keeps its greatest term and index of its first occurrence. The
+// result is the smallest index among lanes with the greatest term.
+AVX2_TARGET double maxPlusAvx2(const double* values, const int* idx,
+                               const double* weights, int n, int* argmax) {
+  __m256d best = _mm256_set1_pd(-HUGE_VAL);
+  __m256d best_idx = _mm256_set1_pd(-1);
+  __m256d curr_idx = _mm256_setr_pd(0, 1, 2, 3);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d term = gatherPlusAvx2(values, idx + i, weights + i);
+    __m256d greater = _mm256_cmp_pd(term, best, _CMP_GT_OQ);
+    best = _mm256_blendv_pd(best, term, greater);
+    best_idx = _mm256_blendv_pd(best_idx, curr_idx, greater);
+    curr_idx = _mm256_add_pd(curr_idx, _mm256_set1_pd(4));
+  }
+
+  double lanes[4], lane_idx[4];
+  _mm256_storeu_pd(lanes, best);
+  _mm256_storeu_pd(lane_idx, best_idx);
+  double res = -HUGE_VAL;
+  *argmax = -1;
+  for (int lane = 0; lane < 4; lane++) {
+    if (lanes[lane] > res ||
+        (lanes[lane] == res && res != -HUGE_VAL && lane_idx[lane] < *argmax)) {
+      res = lanes[lane];
+      *argmax = (int)lane_idx[lane];
+    }
+  }
+  for (; i < n; i++) {
+    double term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX2_TARGET double sumExpPlusAvx2(const double* values, const int* idx,
+                                  const double* weights, int n,
+                                  double* terms) {
+  __m256d best4 = _mm256_set1_pd(-HUGE_VAL);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d term = gatherPlusAvx2(values, idx + i, weights + i);
+    if (terms != nullptr) _mm256_storeu_pd(terms + i, term);
+    best4 = _mm256_max_pd(best4, term);
+  }
+  double best = horizontalMaxAvx2(best4);
+  for (int j = i; j < n; j++) {
+    double term = values[idx[j]] + weights[j];
+    if (terms != nullptr) terms[j] = term;
+    best = std::max(best, term);
+  }
+  if (best == -HUGE_VAL) return best;
+
+  __m256d shift = _mm256_set1_pd(best);
+  __m256d sum4 = _mm256_setzero_pd();
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m256d term = gatherPlusAvx2(values, idx + i, weights + i);
+    sum4 = _mm256_add_pd(sum4, exp2Avx2(_mm256_sub_pd(term, shift)));
+  }
+  double sum = horizontalSumAvx2(sum4);
+  for (; i < n; i++) sum += exp2(values[idx[i]] + weights[i] - best);
+  return best + log2(sum);
+}
+
+AVX2_TARGET void maxPlusUpdateAvx2(const double* values, const int* idx,
+                                   const double* weights, int n, int offset,
+                                   int arg, double* best, int* best_pos,
+                                   int* best_arg) {
+  const __m128i offset4 = _mm_set1_epi32(offset);
+  const __m128i arg4 = _mm_set1_epi32(arg);
+  // Picks the lower 32 bits of every 64-bit lane of the mask.
+  const __m256i lower_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idx + i));
+    __m256d term = _mm256_add_pd(_mm256_i32gather_pd(values, ids, 8),
+                                 _mm256_loadu_pd(weights + i));
+    __m256d curr = _mm256_loadu_pd(best + i);
+    __m128i pos = _mm_add_epi32(ids, offset4);
+    __m128i curr_pos =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(best_pos + i));
+    __m256d smaller_pos = _mm256_castsi256_pd(
+        _mm256_cvtepi32_epi64(_mm_cmplt_epi32(pos, curr_pos)));
+    __m256d update = _mm256_or_pd(
+        _mm256_cmp_pd(term, curr, _CMP_GT_OQ),
+        _mm256_and_pd(_mm256_cmp_pd(term, curr, _CMP_EQ_OQ), smaller_pos));
+    __m128i update4 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+        _mm256_castpd_si256(update), lower_halves));
+
+    _mm256_storeu_pd(best + i, _mm256_blendv_pd(curr, term, update));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(best_pos + i),
+                     _mm_blendv_epi8(curr_pos, pos, update4));
+    __m128i curr_arg =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(best_arg + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(best_arg + i),
+                     _mm_blendv_epi8(curr_arg, arg4, update4));
+  }
+  maxPlusUpdateScalar(values, idx + i, weights + i, n - i, offset, arg,
+                      best + i, best_pos + i, best_arg + i);
+}
+
+AVX2_TARGET void normalizedCumulativeAvx2(const double* terms, int n,
+                                          double log2_total, double* res) {
+  __m256d shift = _mm256_set1_pd(log2_total);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d term = _mm256_loadu_pd(terms + i);
+    _mm256_storeu_pd(res + i, exp2Avx2(_mm256_sub_pd(term, shift)));
+  }
+  for (; i < n; i++) res[i] = exp2(terms[i] - log2_total);
+  for (i = 1; i < n; i++) res[i] += res[i - 1];
+}
+
+// Term @i of 4 lanes replaces @best if it is greater.
+AVX2_TARGET inline void maxPlusLanesStepAvx2(const double* values,
+                                             const int* idx,
+                                             const double* weights, int i,
+                                             int stride, int lane,
+                                             __m256d* best, __m256d* argmax) {
+  const double* row = values + (size_t)idx[i] * stride + lane;
+  __m256d term =
+      _mm256_add_pd(_mm256_loadu_pd(row), _mm256_set1_pd(weights[i]));
+  __m256d greater = _mm256_cmp_pd(term, *best, _CMP_GT_OQ);
+  *best = _mm256_blendv_pd(*best, term, greater);
+  *argmax = _mm256_blendv_pd(*argmax, _mm256_set1_pd(i), greater);
+}
+
+// Lanes are processed 4 at a time and the rest by the scalar kernel. Terms
+// are split into 4 independent chains of comparisons which are merged at the
+// end preferring smaller index among equal terms.
+AVX2_TARGET void maxPlusLanesAvx2(const double* values, const int* idx,
+                                  const double* weights, int n, int stride,
+                                  int lanes, double* best, int* argmax) {
+  int lane = 0;
+  for (; lane + 4 <= lanes; lane += 4) {
+    __m256d chain_best[4], chain_argmax[4];
+    for (int chain = 0; chain < 4; chain++) {
+      chain_best[chain] = _mm256_set1_pd(-HUGE_VAL);
+      chain_argmax[chain] = _mm256_set1_pd(-1);
+    }
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+      for (int chain = 0; chain < 4; chain++) {
+        maxPlusLanesStepAvx2(values, idx, weights, i + chain, stride, lane,
+                             &chain_best[chain], &chain_argmax[chain]);
+      }
+    }
+    for (; i < n; i++) {
+      maxPlusLanesStepAvx2(values, idx, weights, i, stride, lane,
+                           &chain_best[0], &chain_argmax[0]);
+    }
+    __m256d best4 = chain_best[0], argmax4 = chain_argmax[0];
+    for (int chain = 1; chain < 4; chain++) {
+      __m256d take = _mm256_or_pd(
+          _mm256_cmp_pd(chain_best[chain], best4, _CMP_GT_OQ),
+          _mm256_and_pd(
+              _mm256_cmp_pd(chain_best[chain], best4, _CMP_EQ_OQ),
+              _mm256_cmp_pd(chain_argmax[chain], argmax4, _CMP_LT_OQ)));
+      best4 = _mm256_blendv_pd(best4, chain_best[chain], take);
+      argmax4 = _mm256_blendv_pd(argmax4, chain_argmax[chain], take);
+    }
+    _mm256_storeu_pd(best + lane, best4);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(argmax + lane),
+                     _mm256_cvtpd_epi32(argmax4));
+  }
+  maxPlusLanesScalar(values + lane, idx, weights, n, stride, lanes - lane,
+                     best + lane, argmax + lane);
+}
+
+AVX2_TARGET void sumExpPlusLanesAvx2(const double* values, const int* idx,
+                                     const double* weights, int n, int stride,
+                                     int lanes, double* terms, double* res) {
+  int lane = 0;
+  for (; lane + 4 <= lanes; lane += 4) {
+    __m256d best4 = _mm256_set1_pd(-HUGE_VAL);
+    for (int i = 0; i < n; i++) {
+      const double* row = values + (size_t)idx[i] * stride + lane;
+      __m256d term =
+          _mm256_add_pd(_mm256_loadu_pd(row), _mm256_set1_pd(weights[i]));
+      _mm256_storeu_pd(terms + (size_t)i * stride + lane, term);
+      best4 = _mm256_max_pd(best4, term);
+    }
+    // Lanes without any path are shifted by zero so that exp2 gives zero.
+    __m256d zero =
+        _mm256_cmp_pd(best4, _mm256_set1_pd(-HUGE_VAL), _CMP_EQ_OQ);
+    __m256d shift = _mm256_andnot_pd(zero, best4);
+    __m256d sum4 = _mm256_setzero_pd();
+    for (int i = 0; i < n; i++) {
+      __m256d term = _mm256_loadu_pd(terms + (size_t)i * stride + lane);
+      sum4 = _mm256_add_pd(sum4, exp2Avx2(_mm256_sub_pd(term, shift)));
+    }
+    double lane_best[4], lane_sum[4];
+    _mm256_storeu_pd(lane_best, best4);
+    _mm256_storeu_pd(lane_sum, sum4);
+    for (int k = 0; k < 4; k++) {
+      res[lane + k] = lane_best[k] == -HUGE_VAL
+                          ? -HUGE_VAL
+                          : lane_best[k] + std::log2(lane_sum[k]);
+    }
+  }
+  sumExpPlusLanesScalar(values + lane, idx, weights, n, stride, lanes - lane,
+                        terms + lane, res + lane);
+}
+
+AVX2_TARGET void normalizedCumulativeLanesAvx2(const double* terms, int n,
+                                               int stride, int lanes,
+                                               const double* log2_totals,
+                                               double* res) {
+  int lane = 0;
+  for (; lane + 4 <= lanes; lane += 4) {
+    __m256d shift = _mm256_loadu_pd(log2_totals + lane);
+    __m256d cumulative = _mm256_setzero_pd();
+    for (int i = 0; i < n; i++) {
+      size_t pos = (size_t)i * stride + lane;
+      cumulative = _mm256_add_pd(
+          cumulative,
+          exp2Avx2(_mm256_sub_pd(_mm256_loadu_pd(terms + pos), shift)));
+      _mm256_storeu_pd(res + pos, cumulative);
+    }
+  }
+  normalizedCumulativeLanesScalar(terms + lane, n, stride, lanes - lane,
+                                  log2_totals + lane, res + lane);
+}
+
+AVX2_TARGET inline __m256 exp2Avx2(__m256 x) {
+  __m256 underflow =
+      _mm256_cmp_ps(x, _mm256_set1_ps(kMinExponentFloat), _CMP_LT_OQ);
+  x = _mm256_max_ps(x, _mm256_set1_ps(kMinExponentFloat));
+  x = _mm256_min_ps(x, _mm256_set1_ps(kMaxExponentFloat));
+  __m256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 y = _mm256_mul_ps(_mm256_sub_ps(x, n), _mm256_set1_ps(M_LN2));
+  __m256 p = _mm256_set1_ps(kExpCoefficientsFloat[0]);
+  for (int k = 1; k < kExpCoefficientsFloatSize; k++) {
+    p = _mm256_fmadd_ps(p, y, _mm256_set1_ps(kExpCoefficientsFloat[k]));
+  }
+  __m256i bits = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  p = _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+  return _mm256_andnot_ps(underflow, p);
+}
+
+AVX2_TARGET inline __m256 gatherPlusAvx2(const float* values, const int* idx,
+                                         const float* weights) {
+  __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx));
+  return _mm256_add_ps(_mm256_i32gather_ps(values, ids, 4),
+                       _mm256_loadu_ps(weights));
+}
+
+AVX2_TARGET float horizontalMaxAvx2(__m256 x) {
+  __m128 m = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+  return std::max(_mm_cvtss_f32(m), _mm_cvtss_f32(_mm_movehdup_ps(m)));
+}
+
+AVX2_TARGET float horizontalSumAvx2(__m256 x) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  return _mm_cvtss_f32(s) + _mm_cvtss_f32(_mm_movehdup_ps(s));
+}
+
+AVX2_TARGET float maxPlusAvx2(const float* values, const int* idx,
+                              const float* weights, int n, int* argmax) {
+  __m256 best = _mm256_set1_ps(-HUGE_VAL);
+  __m256 best_idx = _mm256_set1_ps(-1);
+  __m256 curr_idx = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 term = gatherPlusAvx2(values, idx + i, weights + i);
+    __m256 greater = _mm256_cmp_ps(term, best, _CMP_GT_OQ);
+    best = _mm256_blendv_ps(best, term, greater);
+    best_idx = _mm256_blendv_ps(best_idx, curr_idx, greater);
+    curr_idx = _mm256_add_ps(curr_idx, _mm256_set1_ps(8));
+  }
+
+  float lanes[8], lane_idx[8];
+  _mm256_storeu_ps(lanes, best);
+  _mm256_storeu_ps(lane_idx, best_idx);
+  float res = -HUGE_VAL;
+  *argmax = -1;
+  for (int lane = 0; lane < 8; lane++) {
+    if (lanes[lane] > res ||
+        (lanes[lane] == res && res != -HUGE_VAL && lane_idx[lane] < *argmax)) {
+      res = lanes[lane];
+      *argmax = (int)lane_idx[lane];
+    }
+  }
+  for (; i < n; i++) {
+    float term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX2_TARGET int32_t maxPlusFixedAvx2(const int32_t* values, const int* idx,
+                                     const int32_t* weights, int n,
+                                     int* argmax) {
+  __m256i best = _mm256_set1_epi32(kLog2FixedZero);
+  __m256i best_idx = _mm256_set1_epi32(-1);
+  __m256i curr_idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + i));
+    __m256i term = _mm256_add_epi32(
+        _mm256_i32gather_epi32(values, ids, 4),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i)));
+    __m256i greater = _mm256_cmpgt_epi32(term, best);
+    best = _mm256_blendv_epi8(best, term, greater);
+    best_idx = _mm256_blendv_epi8(best_idx, curr_idx, greater);
+    curr_idx = _mm256_add_epi32(curr_idx, _mm256_set1_epi32(8));
+  }
+
+  int32_t lanes[8], lane_idx[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), best);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lane_idx), best_idx);
+  int32_t res = kLog2FixedZero;
+  *argmax = -1;
+  for (int lane = 0; lane < 8; lane++) {
+    if (lanes[lane] > res ||
+        (lanes[lane] == res && res != kLog2FixedZero &&
+         lane_idx[lane] < *argmax)) {
+      res = lanes[lane];
+      *argmax = lane_idx[lane];
+    }
+  }
+  for (; i < n; i++) {
+    int32_t term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX2_TARGET float sumExpPlusAvx2(const float* values, const int* idx,
+                                 const float* weights, int n, float* terms) {
+  __m256 best8 = _mm256_set1_ps(-HUGE_VAL);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 term = gatherPlusAvx2(values, idx + i, weights + i);
+    if (terms != nullptr) _mm256_storeu_ps(terms + i, term);
+    best8 = _mm256_max_ps(best8, term);
+  }
+  float best = horizontalMaxAvx2(best8);
+  for (int j = i; j < n; j++) {
+    float term = values[idx[j]] + weights[j];
+    if (terms != nullptr) terms[j] = term;
+    best = std::max(best, term);
+  }
+  if (best == -HUGE_VAL) return best;
+
+  __m256 shift = _mm256_set1_ps(best);
+  __m256 sum8 = _mm256_setzero_ps();
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256 term = gatherPlusAvx2(values, idx + i, weights + i);
+    sum8 = _mm256_add_ps(sum8, exp2Avx2(_mm256_sub_ps(term, shift)));
+  }
+  float sum = horizontalSumAvx2(sum8);
+  for (; i < n; i++) sum += std::exp2(values[idx[i]] + weights[i] - best);
+  return best + std::log2(sum);
+}
+
+AVX2_TARGET void normalizedCumulativeAvx2(const float* terms, int n,
+                                          float log2_total, float* res) {
+  __m256 shift = _mm256_set1_ps(log2_total);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 term = _mm256_loadu_ps(terms + i);
+    _mm256_storeu_ps(res + i, exp2Avx2(_mm256_sub_ps(term, shift)));
+  }
+  for (; i < n; i++) res[i] = std::exp2(terms[i] - log2_total);
+  for (i = 1; i < n; i++) res[i] += res[i - 1];
+}
+
+////////////////////////////// AVX-512 ///////////////////////////////////////
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+AVX512_TARGET inline __m512d exp2Avx512(__m512d x) {
+  __mmask8 in_range =
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(kMinExponent), _CMP_GE_OQ);
+  x = _mm512_max_pd(x, _mm512_set1_pd(kMinExponent));
+  x = _mm512_min_pd(x, _mm512_set1_pd(kMaxExponent));
+  __m512d n =
+      _mm512_roundscale_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512d y = _mm512_mul_pd(_mm512_sub_pd(x, n), _mm512_set1_pd(M_LN2));
+  __m512d p = _mm512_set1_pd(kExpCoefficients[0]);
+  for (int k = 1; k < kExpCoefficientsSize; k++) {
+    p = _mm512_fmadd_pd(p, y, _mm512_set1_pd(kExpCoefficients[k]));
+  }
+  return _mm512_maskz_mov_pd(in_range, _mm512_scalef_pd(p, n));
+}
+
+AVX512_TARGET inline __m512d gatherPlusAvx512(const double* values,
+                                              const int* idx,
+                                              const double* weights) {
+  __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx));
+  return _mm512_add_pd(_mm512_i32gather_pd(ids, values, 8),
+                       _mm512_loadu_pd(weights));
+}
+
+AVX512_TARGET double maxPlusAvx512(const double* values, const int* idx,
+                                   const double* weights, int n,
+                                   int* argmax) {
+  __m512d best = _mm512_set1_pd(-HUGE_VAL);
+  __m512d best_idx = _mm512_set1_pd(-1);
+  __m512d curr_idx = _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d term = gatherPlusAvx512(values, idx + i, weights + i);
+    __mmask8 greater = _mm512_cmp_pd_mask(term, best, _CMP_GT_OQ);
+    best = _mm512_mask_blend_pd(greater, best, term);
+    best_idx = _mm512_mask_blend_pd(greater, best_idx, curr_idx);
+    curr_idx = _mm512_add_pd(curr_idx, _mm512_set1_pd(8));
+  }
+
+  double res = _mm512_reduce_max_pd(best);
+  *argmax = -1;
+  if (res != -HUGE_VAL) {
+    __mmask8 is_best =
+        _mm512_cmp_pd_mask(best, _mm512_set1_pd(res), _CMP_EQ_OQ);
+    __m512d candidates =
+        _mm512_mask_blend_pd(is_best, _mm512_set1_pd(HUGE_VAL), best_idx);
+    *argmax = (int)_mm512_reduce_min_pd(candidates);
+  }
+  for (; i < n; i++) {
+    double term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX512_TARGET double sumExpPlusAvx512(const double* values, const int* idx,
+                                      const double* weights, int n,
+                                      double* terms) {
+  __m512d best8 = _mm512_set1_pd(-HUGE_VAL);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d term = gatherPlusAvx512(values, idx + i, weights + i);
+    if (terms != nullptr) _mm512_storeu_pd(terms + i, term);
+    best8 = _mm512_max_pd(best8, term);
+  }
+  double best = _mm512_reduce_max_pd(best8);
+  for (int j = i; j < n; j++) {
+    double term = values[idx[j]] + weights[j];
+    if (terms != nullptr) terms[j] = term;
+    best = std::max(best, term);
+  }
+  if (best == -HUGE_VAL) return best;
+
+  __m512d shift = _mm512_set1_pd(best);
+  __m512d sum8 = _mm512_setzero_pd();
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m512d term = gatherPlusAvx512(values, idx + i, weights + i);
+    sum8 = _mm512_add_pd(sum8, exp2Avx512(_mm512_sub_pd(term, shift)));
+  }
+  double sum = _mm512_reduce_add_pd(sum8);
+  for (; i < n; i++) sum += exp2(values[idx[i]] + weights[i] - best);
+  return best + log2(sum);
+}
+
+// 16 cells are updated in one iteration so positions and arguments fill one
+// 512-bit register.
+AVX512_TARGET void maxPlusUpdateAvx512(const double* values, const int* idx,
+                                       const double* weights, int n,
+                                       int offset, int arg, double* best,
+                                       int* best_pos, int* best_arg) {
+  const __m512i offset16 = _mm512_set1_epi32(offset);
+  const __m512i arg16 = _mm512_set1_epi32(arg);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i ids = _mm512_loadu_si512(idx + i);
+    __m512d term_lo =
+        _mm512_add_pd(_mm512_i32gather_pd(_mm512_castsi512_si256(ids),
+                                          values, 8),
+                      _mm512_loadu_pd(weights + i));
+    __m512d term_hi =
+        _mm512_add_pd(_mm512_i32gather_pd(_mm512_extracti64x4_epi64(ids, 1),
+                                          values, 8),
+                      _mm512_loadu_pd(weights + i + 8));
+    __m512d curr_lo = _mm512_loadu_pd(best + i);
+    __m512d curr_hi = _mm512_loadu_pd(best + i + 8);
+    __m512i pos = _mm512_add_epi32(ids, offset16);
+    __m512i curr_pos = _mm512_loadu_si512(best_pos + i);
+
+    __mmask16 greater =
+        _mm512_cmp_pd_mask(term_lo, curr_lo, _CMP_GT_OQ) |
+        (_mm512_cmp_pd_mask(term_hi, curr_hi, _CMP_GT_OQ) << 8);
+    __mmask16 equal = _mm512_cmp_pd_mask(term_lo, curr_lo, _CMP_EQ_OQ) |
+                      (_mm512_cmp_pd_mask(term_hi, curr_hi, _CMP_EQ_OQ) << 8);
+    __mmask16 update =
+        greater | (equal & _mm512_cmplt_epi32_mask(pos, curr_pos));
+
+    _mm512_storeu_pd(best + i,
+                     _mm512_mask_blend_pd(update & 0xff, curr_lo, term_lo));
+    _mm512_storeu_pd(best + i + 8,
+                     _mm512_mask_blend_pd(update >> 8, curr_hi, term_hi));
+    _mm512_storeu_si512(best_pos + i,
+                        _mm512_mask_blend_epi32(update, curr_pos, pos));
+    _mm512_mask_storeu_epi32(best_arg + i, update, arg16);
+  }
+  maxPlusUpdateScalar(values, idx + i, weights + i, n - i, offset, arg,
+                      best + i, best_pos + i, best_arg + i);
+}
+
+AVX512_TARGET void normalizedCumulativeAvx512(const double* terms, int n,
+                                              double log2_total, double* res) {
+  __m512d shift = _mm512_set1_pd(log2_total);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512d term = _mm512_loadu_pd(terms + i);
+    _mm512_storeu_pd(res + i, exp2Avx512(_mm512_sub_pd(term, shift)));
+  }
+  for (; i < n; i++) res[i] = exp2(terms[i] - log2_total);
+  for (i = 1; i < n; i++) res[i] += res[i - 1];
+}
+
+AVX512_TARGET inline void maxPlusLanesStepAvx512(const double* values,
+                                                 const int* idx,
+                                                 const double* weights, int i,
+                                                 int stride, int lane,
+                                                 __m512d* best,
+                                                 __m512d* argmax) {
+  const double* row = values + (size_t)idx[i] * stride + lane;
+  __m512d term =
+      _mm512_add_pd(_mm512_loadu_pd(row), _mm512_set1_pd(weights[i]));
+  __mmask8 greater = _mm512_cmp_pd_mask(term, *best, _CMP_GT_OQ);
+  *best = _mm512_mask_blend_pd(greater, *best, term);
+  *argmax = _mm512_mask_blend_pd(greater, *argmax, _mm512_set1_pd(i));
+}
+
+AVX512_TARGET void maxPlusLanesAvx512(const double* values, const int* idx,
+                                      const double* weights, int n,
+                                      int stride, int lanes, double* best,
+                                      int* argmax) {
+  int lane = 0;
+  for (; lane + 8 <= lanes; lane += 8) {
+    __m512d chain_best[4], chain_argmax[4];
+    for (int chain = 0; chain < 4; chain++) {
+      chain_best[chain] = _mm512_set1_pd(-HUGE_VAL);
+      chain_argmax[chain] = _mm512_set1_pd(-1);
+    }
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+      for (int chain = 0; chain < 4; chain++) {
+        maxPlusLanesStepAvx512(values, idx, weights, i + chain, stride, lane,
+                               &chain_best[chain], &chain_argmax[chain]);
+      }
+    }
+    for (; i < n; i++) {
+      maxPlusLanesStepAvx512(values, idx, weights, i, stride, lane,
+                             &chain_best[0], &chain_argmax[0]);
+    }
+    __m512d best8 = chain_best[0], argmax8 = chain_argmax[0];
+    for (int chain = 1; chain < 4; chain++) {
+      __mmask8 take =
+          _mm512_cmp_pd_mask(chain_best[chain], best8, _CMP_GT_OQ) |
+          (_mm512_cmp_pd_mask(chain_best[chain], best8, _CMP_EQ_OQ) &
+           _mm512_cmp_pd_mask(chain_argmax[chain], argmax8, _CMP_LT_OQ));
+      best8 = _mm512_mask_blend_pd(take, best8, chain_best[chain]);
+      argmax8 = _mm512_mask_blend_pd(take, argmax8, chain_argmax[chain]);
+    }
+    _mm512_storeu_pd(best + lane, best8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(argmax + lane),
+                        _mm512_cvtpd_epi32(argmax8));
+  }
+  maxPlusLanesAvx2(values + lane, idx, weights, n, stride, lanes - lane,
+                   best + lane, argmax + lane);
+}
+
+AVX512_TARGET void sumExpPlusLanesAvx512(const double* values,
+                                         const int* idx,
+                                         const double* weights, int n,
+                                         int stride, int lanes,
+                                         double* terms, double* res) {
+  int lane = 0;
+  for (; lane + 8 <= lanes; lane += 8) {
+    __m512d best8 = _mm512_set1_pd(-HUGE_VAL);
+    for (int i = 0; i < n; i++) {
+      const double* row = values + (size_t)idx[i] * stride + lane;
+      __m512d term =
+          _mm512_add_pd(_mm512_loadu_pd(row), _mm512_set1_pd(weights[i]));
+      _mm512_storeu_pd(terms + (size_t)i * stride + lane, term);
+      best8 = _mm512_max_pd(best8, term);
+    }
+    __mmask8 nonzero =
+        _mm512_cmp_pd_mask(best8, _mm512_set1_pd(-HUGE_VAL), _CMP_NEQ_OQ);
+    __m512d shift = _mm512_maskz_mov_pd(nonzero, best8);
+    __m512d sum8 = _mm512_setzero_pd();
+    for (int i = 0; i < n; i++) {
+      __m512d term = _mm512_loadu_pd(terms + (size_t)i * stride + lane);
+      sum8 = _mm512_add_pd(sum8, exp2Avx512(_mm512_sub_pd(term, shift)));
+    }
+    double lane_best[8], lane_sum[8];
+    _mm512_storeu_pd(lane_best, best8);
+    _mm512_storeu_pd(lane_sum, sum8);
+    for (int k = 0; k < 8; k++) {
+      res[lane + k] = lane_best[k] == -HUGE_VAL
+                          ? -HUGE_VAL
+                          : lane_best[k] + std::log2(lane_sum[k]);
+    }
+  }
+  sumExpPlusLanesAvx2(values + lane, idx, weights, n, stride, lanes - lane,
+                      terms + lane, res + lane);
+}
+
+AVX512_TARGET void normalizedCumulativeLanesAvx512(const double* terms,
+                                                   int n, int stride,
+                                                   int lanes,
+                                                   const double* log2_totals,
+                                                   double* res) {
+  int lane = 0;
+  for (; lane + 8 <= lanes; lane += 8) {
+    __m512d shift = _mm512_loadu_pd(log2_totals + lane);
+    __m512d cumulative = _mm512_setzero_pd();
+    for (int i = 0; i < n; i++) {
+      size_t pos = (size_t)i * stride + lane;
+      cumulative = _mm512_add_pd(
+          cumulative,
+          exp2Avx512(_mm512_sub_pd(_mm512_loadu_pd(terms + pos), shift)));
+      _mm512_storeu_pd(res + pos, cumulative);
+    }
+  }
+  normalizedCumulativeLanesAvx2(terms + lane, n, stride, lanes - lane,
+                                log2_totals + lane, res + lane);
+}
+
+AVX512_TARGET inline __m512 exp2Avx512(__m512 x) {
+  __mmask16 in_range =
+      _mm512_cmp_ps_mask(x, _mm512_set1_ps(kMinExponentFloat), _CMP_GE_OQ);
+  x = _mm512_max_ps(x, _mm512_set1_ps(kMinExponentFloat));
+  x = _mm512_min_ps(x, _mm512_set1_ps(kMaxExponentFloat));
+  __m512 n =
+      _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 y = _mm512_mul_ps(_mm512_sub_ps(x, n), _mm512_set1_ps(M_LN2));
+  __m512 p = _mm512_set1_ps(kExpCoefficientsFloat[0]);
+  for (int k = 1; k < kExpCoefficientsFloatSize; k++) {
+    p = _mm512_fmadd_ps(p, y, _mm512_set1_ps(kExpCoefficientsFloat[k]));
+  }
+  return _mm512_maskz_mov_ps(in_range, _mm512_scalef_ps(p, n));
+}
+
+AVX512_TARGET inline __m512 gatherPlusAvx512(const float* values,
+                                             const int* idx,
+                                             const float* weights) {
+  __m512i ids = _mm512_loadu_si512(idx);
+  return _mm512_add_ps(_mm512_i32gather_ps(ids, values, 4),
+                       _mm512_loadu_ps(weights));
+}
+
+AVX512_TARGET float maxPlusAvx512(const float* values, const int* idx,
+                                  const float* weights, int n, int* argmax) {
+  __m512 best = _mm512_set1_ps(-HUGE_VAL);
+  __m512 best_idx = _mm512_set1_ps(-1);
+  __m512 curr_idx = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+                                   13, 14, 15);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 term = gatherPlusAvx512(values, idx + i, weights + i);
+    __mmask16 greater = _mm512_cmp_ps_mask(term, best, _CMP_GT_OQ);
+    best = _mm512_mask_blend_ps(greater, best, term);
+    best_idx = _mm512_mask_blend_ps(greater, best_idx, curr_idx);
+    curr_idx = _mm512_add_ps(curr_idx, _mm512_set1_ps(16));
+  }
+
+  float res = _mm512_reduce_max_ps(best);
+  *argmax = -1;
+  if (res != -HUGE_VAL) {
+    __mmask16 is_best =
+        _mm512_cmp_ps_mask(best, _mm512_set1_ps(res), _CMP_EQ_OQ);
+    __m512 candidates =
+        _mm512_mask_blend_ps(is_best, _mm512_set1_ps(HUGE_VAL), best_idx);
+    *argmax = (int)_mm512_reduce_min_ps(candidates);
+  }
+  for (; i < n; i++) {
+    float term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX512_TARGET int32_t maxPlusFixedAvx512(const int32_t* values,
+                                         const int* idx,
+                                         const int32_t* weights, int n,
+                                         int* argmax) {
+  __m512i best = _mm512_set1_epi32(kLog2FixedZero);
+  __m512i best_idx = _mm512_set1_epi32(-1);
+  __m512i curr_idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                       12, 13, 14, 15);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i term =
+        _mm512_add_epi32(_mm512_i32gather_epi32(_mm512_loadu_si512(idx + i),
+                                                values, 4),
+                         _mm512_loadu_si512(weights + i));
+    __mmask16 greater = _mm512_cmpgt_epi32_mask(term, best);
+    best = _mm512_mask_blend_epi32(greater, best, term);
+    best_idx = _mm512_mask_blend_epi32(greater, best_idx, curr_idx);
+    curr_idx = _mm512_add_epi32(curr_idx, _mm512_set1_epi32(16));
+  }
+
+  int32_t res = _mm512_reduce_max_epi32(best);
+  *argmax = -1;
+  if (res != kLog2FixedZero) {
+    __mmask16 is_best = _mm512_cmpeq_epi32_mask(best, _mm512_set1_epi32(res));
+    *argmax = _mm512_mask_reduce_min_epi32(is_best, best_idx);
+  }
+  for (; i < n; i++) {
+    int32_t term = values[idx[i]] + weights[i];
+    if (term > res) {
+      res = term;
+      *argmax = i;
+    }
+  }
+  return res;
+}
+
+AVX512_TARGET float sumExpPlusAvx512(const float* values, const int* idx,
+                                     const float* weights, int n,
+                                     float* terms) {
+  __m512 best16 = _mm512_set1_ps(-HUGE_VAL);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 term = gatherPlusAvx512(values, idx + i, weights + i);
+    if (terms != nullptr) _mm512_storeu_ps(terms + i, term);
+    best16 = _mm512_max_ps(best16, term);
+  }
+  float best = _mm512_reduce_max_ps(best16);
+  for (int j = i; j < n; j++) {
+    float term = values[idx[j]] + weights[j];
+    if (terms != nullptr) terms[j] = term;
+    best = std::max(best, term);
+  }
+  if (best == -HUGE_VAL) return best;
+
+  __m512 shift = _mm512_set1_ps(best);
+  __m512 sum16 = _mm512_setzero_ps();
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m512 term = gatherPlusAvx512(values, idx + i, weights + i);
+    sum16 = _mm512_add_ps(sum16, exp2Avx512(_mm512_sub_ps(term, shift)));
+  }
+  float sum = _mm512_reduce_add_ps(sum16);
+  for (; i < n; i++) sum += std::exp2(values[idx[i]] + weights[i] - best);
+  return best + std::log2(sum);
+}
+
+AVX512_TARGET void normalizedCumulativeAvx512(const float* terms, int n,
+                                              float log2_total, float* res) {
+  __m512 shift = _mm512_set1_ps(log2_total);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 term = _mm512_loadu_ps(terms + i);
+    _mm512_storeu_ps(res + i, exp2Avx512(_mm512_sub_ps(term, shift)));
+  }
+  for (; i < n; i++) res[i] = std::exp2(terms[i] - log2_total);
+  for (i = 1; i < n; i++) res[i] += res[i - 1];
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif  // LOG2_KERNELS_X86
+
+// One implementation of all kernels.
+struct Kernels {
+  Log2KernelIsa isa_;
+  double (*max_plus_)(const double*, const int*, const double*, int, int*);
+  double (*sum_exp_plus_)(const double*, const int*, const double*, int,
+                          double*);
+  void (*max_plus_update_)(const double*, const int*, const double*, int, int,
+                           int, double*, int*, int*);
+  void (*normalized_cumulative_)(const double*, int, double, double*);
+  float (*max_plus_float_)(const float*, const int*, const float*, int, int*);
+  float (*sum_exp_plus_float_)(const float*, const int*, const float*, int,
+                               float*);
+  void (*normalized_cumulative_float_)(const float*, int, float, float*);
+  int32_t (*max_plus_fixed_)(const int32_t*, const int*, const int32_t*, int,
+                             int*);
+  void (*max_plus_lanes_)(const double*, const int*, const double*, int, int,
+                          int, double*, int*);
+  void (*sum_exp_plus_lanes_)(const double*, const int*, const double*, int,
+                              int, int, double*, double*);
+  void (*normalized_cumulative_lanes_)(const double*, int, int, int,
+                                       const double*, double*);
+};
+
+const Kernels kScalarKernels = {
+    Log2KernelIsa::kScalar, maxPlusScalar<double>, sumExpPlusScalar<double>,
+    maxPlusUpdateScalar, normalizedCumulativeScalar<double>,
+    maxPlusScalar<float>, sumExpPlusScalar<float>,
+    normalizedCumulativeScalar<float>, maxPlusFixedScalar, maxPlusLanesScalar,
+    sumExpPlusLanesScalar, normalizedCumulativeLanesScalar};
+#ifdef LOG2_KERNELS_X86
+const Kernels kAvx2Kernels = {
+    Log2KernelIsa::kAvx2, maxPlusAvx2, sumExpPlusAvx2, maxPlusUpdateAvx2,
+    normalizedCumulativeAvx2, maxPlusAvx2, sumExpPlusAvx2,
+    normalizedCumulativeAvx2, maxPlusFixedAvx2, maxPlusLanesAvx2,
+    sumExpPlusLanesAvx2, normalizedCumulativeLanesAvx2};
+const Kernels kAvx512Kernels = {
+    Log2KernelIsa::kAvx512, maxPlusAvx512, sumExpPlusAvx512,
+    maxPlusUpdateAvx512, normalizedCumulativeAvx512, maxPlusAvx512,
+    sumExpPlusAvx512, normalizedCumulativeAvx512, maxPlusFixedAvx512,
+    maxPlusLanesAvx512, sumExpPlusLanesAvx512,
+    normalizedCumulativeLanesAvx512};
+#endif
+
+const Kernels* kernelsFor(Log2KernelIsa isa) {
+#ifdef LOG2_KERNELS_X86
+  if (isa == Log2KernelIsa::kAvx2) return &kAvx2Kernels;
+  if (isa == Log2KernelIsa::kAvx512) return &kAvx512Kernels;
+#endif
+  (void)isa;
+  return &kScalarKernels;
+}
+
+const Kernels* bestKernels() {
+  if (log2KernelIsaSupported(Log2KernelIsa::kAvx512)) {
+    return kernelsFor(Log2KernelIsa::kAvx512);
+  }
+  if (log2KernelIsaSupported(Log2KernelIsa::kAvx2)) {
+    return kernelsFor(Log2KernelIsa::kAvx2);
+  }
+  return &kScalarKernels;
+}
+
+// Chosen at the first call, so that static initializers of other
+// translation units can call the kernels before this one is initialized.
+const Kernels*& currentKernels() {
+  static const Kernels* kernels = bestKernels();
+  return kernels;
+}
+
+}  // namespace
+
+double log2MaxPlus(const double* values, const int* idx, const double* weights,
+                   int n, int* argmax) {
+  return currentKernels()->max_plus_(values, idx, weights, n, argmax);
+}
+
+double log2SumExpPlus(const double* values, const int* idx,
+                      const double* weights, int n, double* terms) {
+  return currentKernels()->sum_exp_plus_(values, idx, weights, n, terms);
+}
+
+void log2MaxPlusUpdate(const double* values, const int* idx,
+                       const double* weights, int n, int offset, int arg,
+                       double* best, int* best_pos, int* best_arg) {
+  currentKernels()->max_plus_update_(values, idx, weights, n, offset, arg, best,
+                                      best_pos, best_arg);
+}
+
+void log2NormalizedCumulative(const double* terms, int n, double log2_total,
+                              double* res) {
+  currentKernels()->normalized_cumulative_(terms, n, log2_total, res);
+}
+
+float log2MaxPlus(const float* values, const int* idx, const float* weights,
+                  int n, int* argmax) {
+  return currentKernels()->max_plus_float_(values, idx, weights, n, argmax);
+}
+
+float log2SumExpPlus(const float* values, const int* idx, const float* weights,
+                     int n, float* terms) {
+  return currentKernels()->sum_exp_plus_float_(values, idx, weights, n, terms);
+}
+
+void log2NormalizedCumulative(const float* terms, int n, float log2_total,
+                              float* res) {
+  currentKernels()->normalized_cumulative_float_(terms, n, log2_total, res);
+}
+
+int32_t log2MaxPlus(const int32_t* values, const int* idx,
+                    const int32_t* weights, int n, int* argmax) {
+  return currentKernels()->max_plus_fixed_(values, idx, weights, n, argmax);
+}
+
+void log2MaxPlusLanes(const double* values, const int* idx,
+                      const double* weights, int n, int stride, int lanes,
+                      double* best, int* argmax) {
+  currentKernels()->max_plus_lanes_(values, idx, weights, n, stride, lanes,
+                                     best, argmax);
+}
+
+void log2SumExpPlusLanes(const double* values, const int* idx,
+                         const double* weights, int n, int stride, int lanes,
+                         double* terms, double* res) {
+  currentKernels()->sum_exp_plus_lanes_(values, idx, weights, n, stride, lanes,
+                                         terms, res);
+}
+
+void log2NormalizedCumulativeLanes(const double* terms, int n, int stride,
+                                   int lanes, const double* log2_totals,
+                                   double* res) {
+  currentKernels()->normalized_cumulative_lanes_(terms, n, stride, lanes,
+                                                  log2_totals, res);
+}
+
+Log2KernelIsa log2KernelIsa() { return currentKernels()->isa_; }
+
+bool log2KernelIsaSupported(Log2KernelIsa isa) {
+#ifdef LOG2_KERNELS_X86
+  // Needed when called before main.
+  __builtin_cpu_init();
+#endif
+  switch (isa) {
+    case Log2KernelIsa::kScalar:
+      return true;
+#ifdef LOG2_KERNELS_X86
+    case Log2KernelIsa::kAvx2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case Log2KernelIsa::kAvx512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+bool setLog2KernelIsa(Log2KernelIsa isa) {
+  if (!log2KernelIsaSupported(isa)) return false;
+  currentKernels() = kernelsFor(isa);
+  return true;
+}
+
+std::string log2KernelIsaName(Log2KernelIsa isa) {
+  switch (isa) {
+    case Log2KernelIsa::kAvx2:
+      return "avx2";
+    case Log2KernelIsa::kAvx512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
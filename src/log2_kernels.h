@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "log2_num.h"
+
+// Kernels for arrays of numbers in the form 2^x where only exponents x are
+// stored the same way as in Log2Num. Zero is represented by -HUGE_VAL.
+// Every kernel has AVX2 and AVX-512 implementation and scalar fallback. The
+// best implementation supported by the CPU is picked when the program starts.
+//
+// Reductions work with terms values[idx[i]] + weights[i] for i = 0 ... n-1,
+// i.e. product of a number gathered from @values and a weight. This is the
+// shape of one cell of Viterbi and forward algorithm where @values is the
+// previous row and @idx, @weights are transitions going to the cell.
+//
+// Reductions have overloads for float exponents which process twice as many
+// terms in one vector. Max-plus has also overload for fixed point exponents.
+
+enum class Log2KernelIsa { kScalar, kAvx2, kAvx512 };
+
+// Max-plus reduction. Returns the greatest term and stores index of its first
+// occurrence to @argmax. If all terms are zero returns -HUGE_VAL and @argmax
+// is -1.
+double log2MaxPlus(const double* values, const int* idx, const double* weights,
+                   int n, int* argmax);
+
+// Log-sum-exp reduction. Returns log2 of the sum of 2^term. Terms are stored
+// to @terms unless it is null.
+double log2SumExpPlus(const double* values, const int* idx,
+                      const double* weights, int n, double* terms);
+
+// Max-plus update of many cells at once. Term values[idx[i]] + weights[i]
+// replaces best[i] if it is greater, or if it is equal and its position
+// @offset + idx[i] is smaller than best_pos[i]. Then best_pos[i] is set to the
+// position and best_arg[i] to @arg. Calling it for all sources gives the
+// greatest term of every cell and the smallest position among ties.
+void log2MaxPlusUpdate(const double* values, const int* idx,
+                       const double* weights, int n, int offset, int arg,
+                       double* best, int* best_pos, int* best_arg);
+
+// res[i] = sum of 2^(terms[j] - log2_total) for j <= i. Zero terms give
+// exactly zero.
+void log2NormalizedCumulative(const double* terms, int n, double log2_total,
+                              double* res);
+
+float log2MaxPlus(const float* values, const int* idx, const float* weights,
+                  int n, int* argmax);
+float log2SumExpPlus(const float* values, const int* idx, const float* weights,
+                     int n, float* terms);
+void log2NormalizedCumulative(const float* terms, int n, float log2_total,
+                              float* res);
+
+// Fixed point exponents are log2 of numbers multiplied by a scale and rounded
+// to int32. Zero is kLog2FixedZero. Values and weights have to be in
+// [kLog2FixedZero, 0] so that sums do not overflow.
+const int32_t kLog2FixedZero = -(1 << 30);
+
+// Rounds @exponent * @scale. Numbers too small to be represented saturate to
+// the smallest non-zero number.
+inline int32_t log2ToFixed(double exponent, double scale) {
+  if (exponent == -HUGE_VAL) return kLog2FixedZero;
+  double fixed = std::round(exponent * scale);
+  if (fixed <= kLog2FixedZero) return kLog2FixedZero + 1;
+  return fixed;
+}
+
+// Max-plus reduction of fixed point exponents. Terms not greater than
+// kLog2FixedZero are zero. If all terms are zero returns kLog2FixedZero and
+// @argmax is -1.
+int32_t log2MaxPlus(const int32_t* values, const int* idx,
+                    const int32_t* weights, int n, int* argmax);
+
+// Kernels for batches of reads decoded together, one read per lane. Number of
+// state u for read l is stored at row[u * stride + l]. Lanes 0 ... lanes-1 are
+// computed and every lane gives the same result as the kernel for one read.
+
+// best[l] = max of values[idx[i] * stride + l] + weights[i], argmax[l] is the
+// first i with the greatest term or -1 if all terms are zero.
+void log2MaxPlusLanes(const double* values, const int* idx,
+                      const double* weights, int n, int stride, int lanes,
+                      double* best, int* argmax);
+
+// res[l] = log2 of the sum of 2^term for terms of lane l. Terms are stored to
+// terms[i * stride + l].
+void log2SumExpPlusLanes(const double* values, const int* idx,
+                         const double* weights, int n, int stride, int lanes,
+                         double* terms, double* res);
+
+// res[i * stride + l] = sum of 2^(terms[j * stride + l] - log2_totals[l]) for
+// j <= i. Lanes with zero total are undefined.
+void log2NormalizedCumulativeLanes(const double* terms, int n, int stride,
+                                   int lanes, const double* log2_totals,
+                                   double* res);
+
+// Instruction set used by the kernels.
+Log2KernelIsa log2KernelIsa();
+bool log2KernelIsaSupported(Log2KernelIsa isa);
+// Switches the kernels to @isa. Returns false and keeps the current
+// implementation if the CPU does not support it.
+bool setLog2KernelIsa(Log2KernelIsa isa);
+std::string log2KernelIsaName(Log2KernelIsa isa);
+
+// Log2Num stores only its exponent so an array of Log2Num can be passed to
+// the kernels as an array of exponents.
+template <typename Real>
+inline const Real* log2Exponents(const BasicLog2Num<Real>* nums) {
+  static_assert(sizeof(BasicLog2Num<Real>) == sizeof(Real),
+                "Log2Num has to contain only the exponent.");
+  return reinterpret_cast<const Real*>(nums);
+}
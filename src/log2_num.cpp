@@ -6,22 +6,27 @@
 
 const double kEpsilon = 1.0e-15;
 
-Log2Num::Log2Num(double val) { exponent_ = log2(val); }
+template <typename Real>
+BasicLog2Num<Real>::BasicLog2Num(Real val) {
+  exponent_ = log2(val);
+}
 
-double Log2Num::value() const {
+template <typename Real>
+Real BasicLog2Num<Real>::value() const {
   if (isLogZero()) return 0;
   return exp2(exponent_);
 }
 
-void Log2Num::setExponent(double exponent) { exponent_ = exponent; }
-
-Log2Num Log2Num::operator*(const Log2Num& num) const {
-  Log2Num res = *this;
+template <typename Real>
+BasicLog2Num<Real> BasicLog2Num<Real>::operator*(
+    const BasicLog2Num& num) const {
+  BasicLog2Num res = *this;
   res *= num;
   return res;
 }
 
-Log2Num& Log2Num::operator*=(const Log2Num& num) {
+template <typename Real>
+BasicLog2Num<Real>& BasicLog2Num<Real>::operator*=(const BasicLog2Num& num) {
   if (num.isLogZero() || this->isLogZero()) {
     this->exponent_ = -HUGE_VAL;
   } else {
@@ -31,13 +36,16 @@ Log2Num& Log2Num::operator*=(const Log2Num& num) {
   return *this;
 }
 
-Log2Num Log2Num::operator+(const Log2Num& num) const {
-  Log2Num res(*this);
+template <typename Real>
+BasicLog2Num<Real> BasicLog2Num<Real>::operator+(
+    const BasicLog2Num& num) const {
+  BasicLog2Num res(*this);
   res += num;
   return res;
 }
 
-Log2Num& Log2Num::operator+=(const Log2Num& num) {
+template <typename Real>
+BasicLog2Num<Real>& BasicLog2Num<Real>::operator+=(const BasicLog2Num& num) {
   if (this->isLogZero()) {
     *this = num;
   } else if (!num.isLogZero()) {
@@ -52,27 +60,34 @@ Log2Num& Log2Num::operator+=(const Log2Num& num) {
   return *this;
 }
 
-bool Log2Num::operator<(const Log2Num& num) const {
+template <typename Real>
+bool BasicLog2Num<Real>::operator<(const BasicLog2Num& num) const {
   if (isLogZero() && !num.isLogZero()) return true;
   if (num.isLogZero()) return false;
   return exponent_ < num.exponent_;
 }
 
-bool Log2Num::operator>(const Log2Num& num) const {
+template <typename Real>
+bool BasicLog2Num<Real>::operator>(const BasicLog2Num& num) const {
   if (num.isLogZero() && !isLogZero()) return true;
   if (isLogZero()) return false;
   return exponent_ > num.exponent_;
 }
 
-bool Log2Num::operator==(const Log2Num& num) const {
+template <typename Real>
+bool BasicLog2Num<Real>::operator==(const BasicLog2Num& num) const {
   double this_val = this->value();
   double num_val = num.value();
   return fabs(this_val - num_val) < kEpsilon;
 }
 
-bool Log2Num::operator!=(const Log2Num& num) const { return !(*this == num); }
+template <typename Real>
+bool BasicLog2Num<Real>::operator!=(const BasicLog2Num& num) const {
+  return !(*this == num);
+}
 
-Log2Num& Log2Num::operator/=(const Log2Num& num) {
+template <typename Real>
+BasicLog2Num<Real>& BasicLog2Num<Real>::operator/=(const BasicLog2Num& num) {
   assert(!num.isLogZero());
 
   if (!this->isLogZero()) this->exponent_ -= num.exponent_;
@@ -80,8 +95,13 @@ Log2Num& Log2Num::operator/=(const Log2Num& num) {
   return *this;
 }
 
-Log2Num Log2Num::operator/(const Log2Num& num) const {
-  Log2Num res = *this;
+template <typename Real>
+BasicLog2Num<Real> BasicLog2Num<Real>::operator/(
+    const BasicLog2Num& num) const {
+  BasicLog2Num res = *this;
   res /= num;
   return res;
 }
+
+template class BasicLog2Num<double>;
+template class BasicLog2Num<float>;
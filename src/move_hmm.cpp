@@ -1,9 +1,14 @@
 #include <cassert>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <memory>
+#include <stdexcept>
 
 #include <cstddef>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 #include <glog/logging.h>
 
@@ -14,16 +19,30 @@
 #include "log2_num.h"
 
 const int kInitialState = 0;
+// Greatest Phred quality that is output.
+const int kMaxPhredQuality = 60;
 
 std::vector<std::unique_ptr<State<double>>> constructEmissions(
     size_t k, const std::vector<GaussianParamsKmer>& kmer_gaussians) {
+  if (k < 1 || k > (size_t)kMaxKmerLength) {
+    throw std::invalid_argument("Unsupported length of kmers: " +
+                                std::to_string(k));
+  }
   size_t num_kmers = numKmersOf(k);
-  assert(num_kmers == kmer_gaussians.size());
+  if (num_kmers != kmer_gaussians.size()) {
+    throw std::invalid_argument("Expected Gaussians for " +
+                                std::to_string(num_kmers) + " kmers, got " +
+                                std::to_string(kmer_gaussians.size()) + ".");
+  }
   std::vector<std::unique_ptr<State<double>>> res(num_kmers + 1);
   res[kInitialState] =
       std::unique_ptr<State<double>>(new SilentState<double>());
   for (const GaussianParamsKmer& gaussian : kmer_gaussians) {
-    assert(gaussian.kmer_.size() == k);
+    if (gaussian.kmer_.size() != k) {
+      throw std::invalid_argument("Kmer " + gaussian.kmer_ +
+                                  " does not have length " +
+                                  std::to_string(k) + ".");
+    }
     int state = kmerToLexicographicPos(gaussian.kmer_);
     res[state] = std::unique_ptr<State<double>>(
         new GaussianState(gaussian.mu_, gaussian.sigma_));
@@ -32,6 +51,24 @@ std::vector<std::unique_ptr<State<double>>> constructEmissions(
   return res;
 }
 
+int moveHMMKmerLength(const HMM<double>& hmm) {
+  long long num_states = hmm.transitions().size();
+  const std::string error = "MoveHMM with " + std::to_string(num_states) +
+                            " states does not have one state for every kmer";
+  int k = hmm.kmerLength();
+  if (k == 0) {
+    for (k = 1; k <= kMaxKmerLength; k++) {
+      if (numKmersOf(k) + 1 == num_states) return k;
+    }
+    throw std::invalid_argument(error + ".");
+  }
+  if (k < 0 || k > kMaxKmerLength || numKmersOf(k) + 1 != num_states) {
+    throw std::invalid_argument(error + " of length " + std::to_string(k) +
+                                ".");
+  }
+  return k;
+}
+
 void TransitionConstructor::addRead(const std::vector<MoveKmer>& read) {
   if (read.empty()) return;
   // Ignore transition from initial state.
@@ -51,7 +88,22 @@ void TransitionConstructor::addRead(const std::vector<MoveKmer>& read) {
 
 std::vector<std::vector<Transition>>
 TransitionConstructor::calculateTransitions(int pseudo_count, int k) const {
+  if (k < 1 || k > kMaxKmerLength) {
+    throw std::invalid_argument("Unsupported length of kmers: " +
+                                std::to_string(k));
+  }
   int states = numKmersOf(k) + 1;
+  // Upper bound of transitions from a kmer plus the one from initial state.
+  int64_t max_out_degree = 1;
+  for (int move = 0, kmers = 1; move <= std::min(move_threshold_, k);
+       move++, kmers *= kNumBases) {
+    max_out_degree += kmers;
+  }
+  if ((states - 1) * max_out_degree > std::numeric_limits<int32_t>::max()) {
+    throw std::invalid_argument(
+        "Too many transitions for length of kmers " + std::to_string(k) +
+        " and move threshold " + std::to_string(move_threshold_) + ".");
+  }
   // Finally, calculate transition probabilities from every state.
   std::vector<std::vector<Transition>> res(states);
   for (int id = 1; id < states; id++) {
@@ -99,14 +151,81 @@ std::string stateSeqToBases(int k, const std::vector<int>& states) {
   if (states.size() < 2) return "";
 
   // First state is always the initial state - silent state.
-  std::string prev_kmer = kmerInLexicographicPos(states[1], k);
-  std::string res(prev_kmer + "|");
-  for (int idx = 2; idx < (int)states.size(); idx++) {
-    std::string next_kmer = kmerInLexicographicPos(states[idx], k);
-    int move = getSmallestMove(prev_kmer, next_kmer);
+  return stateSeqToBases(
+      k, states[0], std::vector<int>(states.begin() + 1, states.end()));
+}
+
+std::string stateSeqToBases(int k, int prev_state,
+                            const std::vector<int>& states) {
+  std::string res;
+  std::string prev_kmer;
+  if (prev_state != kInitialState) {
+    prev_kmer = kmerInLexicographicPos(prev_state, k);
+  }
+  for (int state : states) {
+    std::string next_kmer = kmerInLexicographicPos(state, k);
+    if (prev_kmer.empty()) {
+      // The first kmer after the initial state is output whole.
+      res += next_kmer + "|";
+    } else {
+      int move = getSmallestMove(prev_kmer, next_kmer);
+      // Take suffix of length move.
+      res += next_kmer.substr(next_kmer.size() - move) + "|";
+    }
+    prev_kmer = next_kmer;
+  }
 
-    // Take suffix of length move.
-    res += next_kmer.substr(next_kmer.size() - move) + "|";
+  return res;
+}
+
+char phredQualityChar(double prob_correct) {
+  double prob_error = 1 - prob_correct;
+  int quality = kMaxPhredQuality;
+  if (prob_error > 0) {
+    quality = std::min(kMaxPhredQuality,
+                       std::max(0, (int)std::round(-10 * log10(prob_error))));
+  }
+  return '!' + quality;
+}
+
+StateBand basecallerBand(const std::vector<MoveKmer>& read, int max_move,
+                         int window) {
+  if (max_move < 0 || window < 0) {
+    throw std::invalid_argument("Band has to have non-negative size.");
+  }
+  // States reachable from the kmer of every event.
+  std::vector<std::vector<int>> reachable(read.size());
+  for (size_t i = 0; i < read.size(); i++) {
+    for (const std::string& kmer : kmersUpToDist(read[i].kmer_, max_move)) {
+      reachable[i].push_back(kmerToLexicographicPos(kmer));
+    }
+  }
+
+  StateBand res;
+  res.states_.resize(read.size());
+  for (int i = 0; i < (int)read.size(); i++) {
+    std::vector<int>& band = res.states_[i];
+    int end = std::min<int>(read.size(), i + window + 1);
+    for (int j = std::max(0, i - window); j < end; j++) {
+      band.insert(band.end(), reachable[j].begin(), reachable[j].end());
+    }
+    std::sort(band.begin(), band.end());
+    band.erase(std::unique(band.begin(), band.end()), band.end());
+  }
+  return res;
+}
+
+BasecalledRead posteriorDecodingToRead(int k, const std::vector<int>& states,
+                                       const std::vector<double>& posteriors) {
+  assert(posteriors.size() + 1 == states.size() || states.empty());
+  BasecalledRead res;
+  std::string prev_kmer;
+  for (int idx = 1; idx < (int)states.size(); idx++) {
+    std::string next_kmer = kmerInLexicographicPos(states[idx], k);
+    // The first kmer after the initial state is emitted whole.
+    int move = prev_kmer.empty() ? k : getSmallestMove(prev_kmer, next_kmer);
+    res.bases_ += next_kmer.substr(next_kmer.size() - move);
+    res.qualities_ += std::string(move, phredQualityChar(posteriors[idx - 1]));
     prev_kmer = next_kmer;
   }
 
@@ -23,6 +23,12 @@ struct GaussianParamsKmer {
   double sigma_;
 };
 
+// Basecalled read with Phred qualities of bases encoded as in FASTQ.
+struct BasecalledRead {
+  std::string bases_;
+  std::string qualities_;
+};
+
 // DNA strand.
 enum Strand {
   kTemplate = 0,
@@ -32,12 +38,45 @@ enum Strand {
 // Constructs sequence of states which can be passed to HMM.
 // @k - length of kmers.
 // @kmer_gaussians - list of Gaussians for every kmer.
+// Throws std::invalid_argument if there is not one Gaussian for every kmer.
 std::vector<std::unique_ptr<State<double>>> constructEmissions(
     size_t k, const std::vector<GaussianParamsKmer>& kmer_gaussians);
 
+// Returns length of kmers of MoveHMM @hmm. Models which do not store it are
+// older models and it is derived from the number of their states. Throws
+// std::invalid_argument if @hmm does not have one state for every kmer plus
+// the initial state.
+int moveHMMKmerLength(const HMM<double>& hmm);
+
 // Converts state sequence of MoveHMM to basecalled sequence.
 std::string stateSeqToBases(int k, const std::vector<int>& states);
 
+// Converts continuation of state sequence of MoveHMM to basecalled sequence.
+// @prev_state - the last state before @states. It's the initial state if
+// @states is the beginning of the sequence.
+std::string stateSeqToBases(int k, int prev_state,
+                            const std::vector<int>& states);
+
+// Converts probability that base is correct to Phred quality encoded as
+// FASTQ character.
+char phredQualityChar(double prob_correct);
+
+// Converts posterior decoding of MoveHMM to bases with qualities. Every base
+// gets quality of the event which emitted it.
+// @states - initial state followed by one state per event.
+// @posteriors - posterior probability of the state for every event.
+BasecalledRead posteriorDecodingToRead(int k, const std::vector<int>& states,
+                                       const std::vector<double>& posteriors);
+
+// Band of MoveHMM states around the path of the basecaller for banded
+// decoding of a read. Event i can be emitted by kmers reachable by at most
+// @max_move moves from the kmer which the basecaller assigned to any event at
+// most @window events away from i. Throws std::invalid_argument if @max_move
+// or @window is negative.
+// @read - kmers of all events assigned by the basecaller.
+StateBand basecallerBand(const std::vector<MoveKmer>& read, int max_move,
+                         int window);
+
 // This class takes reads when you call addRead() and finally constructs
 // transitions when you call calculateTransitions(). Reading all reads at once
 // would take too much memory so therefore it's split into two phases.
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "move_hmm_viterbi.h"
+#include "kmers.h"
+#include "log2_kernels.h"
+#include "packed_matrix.h"
+
+MoveHMMViterbi::MoveHMMViterbi(int k, const HMM<double>& hmm)
+    : k_(k), num_kmers_(numKmersOf(k)), max_move_(0) {
+  const std::vector<std::vector<Transition>>& transitions = hmm.transitions();
+  if (hmm.initialState() != 0 ||
+      (int)transitions.size() != num_kmers_ + 1) {
+    throw std::invalid_argument(
+        "MoveHMM has to have initial state 0 and one state for every kmer of "
+        "length " + std::to_string(k) + ".");
+  }
+  for (const std::vector<Transition>& from_state : transitions) {
+    for (const Transition& transition : from_state) {
+      if (transition.to_state_ == 0) {
+        throw std::invalid_argument("No transitions can go to initial state.");
+      }
+    }
+  }
+
+  // States are 1-based positions of kmers in lexicographic order so code of
+  // kmer is its state id minus one.
+  for (int from = 0; from < num_kmers_; from++) {
+    for (const Transition& transition : transitions[from + 1]) {
+      max_move_ =
+          std::max(max_move_, smallestMove(from, transition.to_state_ - 1));
+    }
+  }
+  move_offsets_.assign(1, 0);
+  for (int move = 0; move <= max_move_; move++) {
+    move_offsets_.push_back(move_offsets_.back() + numKmersOf(move));
+    for (int prefix = 0; prefix < numKmersOf(move); prefix++) {
+      prefix_offsets_.push_back(prefix << (2 * (k_ - move)));
+    }
+    for (int code = 0; code < num_kmers_; code++) {
+      shifted_codes_.push_back(code >> (2 * move));
+    }
+  }
+
+  log2_probs_.assign((size_t)num_kmers_ * move_offsets_.back(), -HUGE_VAL);
+  for (int from = 0; from < num_kmers_; from++) {
+    for (const Transition& transition : transitions[from + 1]) {
+      int to = transition.to_state_ - 1;
+      int move = smallestMove(from, to);
+      int prefix = from >> (2 * (k_ - move));
+      double& log2_prob = log2_probs_[tableIdx(move, prefix) + to];
+      log2_prob = std::max(log2_prob, transition.prob_.exponent());
+    }
+  }
+
+  initial_log2_probs_.assign(num_kmers_, -HUGE_VAL);
+  for (const Transition& transition : transitions[0]) {
+    double& log2_prob = initial_log2_probs_[transition.to_state_ - 1];
+    log2_prob = std::max(log2_prob, transition.prob_.exponent());
+  }
+}
+
+int MoveHMMViterbi::smallestMove(int from, int to) const {
+  for (int move = 0; move < k_; move++) {
+    int overlap_mask = (1 << (2 * (k_ - move))) - 1;
+    if ((from & overlap_mask) == (to >> (2 * move))) return move;
+  }
+  return k_;
+}
+
+// The same recurrence as HMM::computeViterbiMatrix with the same floating
+// point operations. Ties are broken by the smallest id of the previous state
+// the same way as in HMM where inverse transitions are sorted by id.
+std::vector<int> MoveHMMViterbi::runViterbiReturnStateIds(
+    const std::vector<double>& emissions,
+    const std::vector<std::unique_ptr<State<double>>>& states) const {
+  if ((int)states.size() != num_kmers_ + 1 || !states[0]->isSilent()) {
+    throw std::invalid_argument(
+        "States have to be constructed by constructEmissions.");
+  }
+  StateEmissions<double> state_emissions(states);
+  for (int state = 1; state <= num_kmers_; state++) {
+    if (state_emissions.isSilent(state)) {
+      throw std::invalid_argument("Only the initial state can be silent.");
+    }
+  }
+
+  int length = emissions.size();
+  if (length == 0) return {0};
+
+  PackedMatrix backpointers(length + 1, num_kmers_,
+                            kFirstKmerBackpointer + move_offsets_.back() - 1);
+  // Rows contain log2 of probabilities of kmers. Probability of the initial
+  // state is 1 before the first emission and 0 after it.
+  std::vector<double> prev_row(num_kmers_, -HUGE_VAL);
+  std::vector<double> curr_row(num_kmers_);
+  // Code of the best predecessor of every kmer and its index in the table.
+  std::vector<int> best_from(num_kmers_);
+  std::vector<int> best_idx(num_kmers_);
+  std::vector<Log2Num> emission_probs(num_kmers_ + 1);
+  for (int row = 1; row <= length; row++) {
+    state_emissions.column(emissions[row - 1], &emission_probs);
+    std::fill(curr_row.begin(), curr_row.end(), -HUGE_VAL);
+    std::fill(best_from.begin(), best_from.end(), num_kmers_);
+    std::fill(best_idx.begin(), best_idx.end(), -1);
+    if (row == 1) {
+      for (int code = 0; code < num_kmers_; code++) {
+        if (initial_log2_probs_[code] == -HUGE_VAL) continue;
+        curr_row[code] = 0 + initial_log2_probs_[code];
+        best_from[code] = -1;
+      }
+    }
+    for (int move = 0; move <= max_move_; move++) {
+      for (int prefix = 0; prefix < numKmersOf(move); prefix++) {
+        int offset = prefix_offsets_[move_offsets_[move] + prefix];
+        log2MaxPlusUpdate(&prev_row[offset],
+                          &shifted_codes_[(size_t)move * num_kmers_],
+                          &log2_probs_[tableIdx(move, prefix)], num_kmers_,
+                          offset, move_offsets_[move] + prefix,
+                          curr_row.data(), best_from.data(), best_idx.data());
+      }
+    }
+
+    for (int code = 0; code < num_kmers_; code++) {
+      uint32_t backpointer = kFirstKmerBackpointer + best_idx[code];
+      if (curr_row[code] == -HUGE_VAL) {
+        backpointer = 0;
+      } else if (best_from[code] == -1) {
+        backpointer = 1;
+      }
+      curr_row[code] += emission_probs[code + 1].exponent();
+      backpointers.set(row, code, backpointer);
+    }
+    std::swap(prev_row, curr_row);
+  }
+
+  // The first state with the greatest probability.
+  int code = std::max_element(prev_row.begin(), prev_row.end()) -
+             prev_row.begin();
+  std::vector<int> res;
+  for (int row = length; row > 0; row--) {
+    res.push_back(code + 1);
+    uint32_t backpointer = backpointers.get(row, code);
+    if (backpointer < kFirstKmerBackpointer) break;
+    int idx = backpointer - kFirstKmerBackpointer;
+    int move = std::upper_bound(move_offsets_.begin(), move_offsets_.end(),
+                                idx) - move_offsets_.begin() - 1;
+    code = predecessor(code, move, idx - move_offsets_[move]);
+  }
+  res.push_back(0);
+
+  std::reverse(res.begin(), res.end());
+  return res;
+}
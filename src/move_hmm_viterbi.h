@@ -0,0 +1,76 @@
+// Viterbi algorithm specialized for the structure of MoveHMM.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hmm.h"
+
+// States of MoveHMM are kmers (see constructEmissions). Kmer x can only go to
+// kmer y which is x shifted by move d with d new bases at the end. Therefore
+// the predecessor of y with move d and first bases p of x is computed from the
+// 2-bit code of y and transition probabilities are kept in a dense table
+// indexed by [move][p][y] instead of lists of transitions. For fixed move and
+// p the predecessors of consecutive kmers are consecutive in the previous row
+// (each one repeated 4^d times) so one row is computed by a few batched
+// max-plus updates over all kmers.
+// The resulting path is the same as from HMM::runViterbiReturnStateIds.
+class MoveHMMViterbi {
+ public:
+  // Takes transitions of @hmm with kmers of length @k. Throws
+  // std::invalid_argument if @hmm is not MoveHMM.
+  MoveHMMViterbi(int k, const HMM<double>& hmm);
+
+  // Runs Viterbi algorithm and returns sequence of states starting with the
+  // initial state.
+  // @states - states of MoveHMM constructed by constructEmissions.
+  std::vector<int> runViterbiReturnStateIds(
+      const std::vector<double>& emissions,
+      const std::vector<std::unique_ptr<State<double>>>& states) const;
+
+  // The greatest move of a transition in the model.
+  int maxMove() const { return max_move_; }
+  // Number of bytes of the transition table.
+  size_t tableMemoryUsage() const {
+    return log2_probs_.size() * sizeof(double);
+  }
+
+ private:
+  // Backpointers: 0 - there is no path, 1 - the initial state,
+  // kFirstKmerBackpointer + move_offsets_[move] + prefix - the kmer which
+  // goes to the state with @move and starts with bases @prefix.
+  static const uint32_t kFirstKmerBackpointer = 2;
+
+  // Smallest move between kmers with codes @from and @to.
+  int smallestMove(int from, int to) const;
+  // Code of the kmer that goes to kmer @code with @move and starts with
+  // bases @prefix.
+  int predecessor(int code, int move, int prefix) const {
+    return prefix_offsets_[move_offsets_[move] + prefix] | (code >> (2 * move));
+  }
+  // Position of the first probability of transitions with @move from kmers
+  // starting with @prefix.
+  size_t tableIdx(int move, int prefix) const {
+    return (size_t)(move_offsets_[move] + prefix) * num_kmers_;
+  }
+
+  int k_;
+  int num_kmers_;
+  int max_move_;
+  // move_offsets_[d] = 4^0 + ... + 4^(d-1) for d = 0 ... max_move_+1. The
+  // last one is number of (move, new bases) pairs for one kmer.
+  std::vector<int> move_offsets_;
+  // prefix_offsets_[move_offsets_[move] + prefix] is the part of code of
+  // predecessor given by @prefix, i.e. prefix << 2*(k-move).
+  std::vector<int> prefix_offsets_;
+  // shifted_codes_[move * num_kmers_ + code] = code >> 2*move.
+  std::vector<int> shifted_codes_;
+  // log2 of probabilities of transitions going to kmers. -HUGE_VAL if there
+  // is no such transition or the move is not the smallest move between the
+  // two kmers.
+  std::vector<double> log2_probs_;
+  // log2 of probabilities of transitions from the initial state to kmers.
+  std::vector<double> initial_log2_probs_;
+};
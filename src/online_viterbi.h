@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "hmm.h"
+#include "log2_num.h"
+#include "packed_matrix.h"
+
+// Viterbi algorithm which takes emissions in chunks and outputs prefix of the
+// most probable path as soon as it cannot change. Prefix of the path is final
+// when backpointer chains of all states with non-zero probability in the last
+// column meet in one state. Only backpointers after this state are kept in
+// memory. Concatenation of all outputs is the same as the output of
+// HMM::runViterbiReturnStateIds.
+template <typename EmissionType>
+class OnlineViterbi {
+ public:
+  // @hmm and @states have to outlive the decoder.
+  OnlineViterbi(
+      const HMM<EmissionType>& hmm,
+      const std::vector<std::unique_ptr<State<EmissionType>>>& states);
+
+  // Processes next chunk of emissions. Returns states of the most probable
+  // path which became final. The first returned state is the initial state.
+  std::vector<int> addEmissions(const std::vector<EmissionType>& emissions);
+  // There are no more emissions. Returns the rest of the most probable path.
+  std::vector<int> finish();
+
+  // Number of processed emissions.
+  int processedEmissions() const { return processed_; }
+  // Number of columns for which backpointers are kept in memory.
+  int windowSize() const { return window_.rows(); }
+  // Number of columns visited by all walks back over the window.
+  long long walkedColumns() const { return walked_columns_; }
+
+ private:
+  // Backpointer for column @row which has to be in the window.
+  int previousState(int row, int state_id) const {
+    return hmm_.previousState(window_, row - fixed_row_, state_id);
+  }
+  // Replaces silent states in @nodes by their predecessors in the same
+  // @row until only non-silent states remain. Nodes are unique and they are
+  // returned in descending order.
+  void resolveSilentStates(int row, std::vector<int>* nodes) const;
+  // Finds the last column in which all backpointer chains meet and outputs
+  // the path up to it. The walk stops where it joins the walk of the
+  // previous call because from there on it would not meet either.
+  std::vector<int> outputConvergedPrefix();
+  // Path from the last fixed state (exclusive) to @state_id in column @row.
+  std::vector<int> pathFromFixedState(int row, int state_id) const;
+
+  const HMM<EmissionType>& hmm_;
+  const std::vector<std::unique_ptr<State<EmissionType>>>& states_;
+  StateEmissions<EmissionType> state_emissions_;
+  std::vector<Log2Num> emission_probs_;
+  std::vector<int> all_states_;
+
+  // Probabilities for the last processed column and buffer for the next one.
+  std::vector<Log2Num> row_;
+  std::vector<Log2Num> next_row_;
+  // Backpointers for columns fixed_row_ ... processed_.
+  PackedMatrix window_;
+  // walk_sizes_[row - fixed_row_] is number of chains in column row found by
+  // the last walk which reached it or zero. Chains of a later walk are a
+  // subset of them so the walks are the same from a column with the same
+  // number of chains.
+  std::vector<int> walk_sizes_;
+  long long walked_columns_;
+  // The last state of the path which is already final and its column.
+  int fixed_row_;
+  int fixed_state_;
+  int processed_;
+  bool initial_state_output_;
+};
+
+// Implementation of template class.
+#include "online_viterbi.tcc"
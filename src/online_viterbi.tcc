@@ -0,0 +1,145 @@
+// Implementation of templated class OnlineViterbi.
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+template <typename EmissionType>
+OnlineViterbi<EmissionType>::OnlineViterbi(
+    const HMM<EmissionType>& hmm,
+    const std::vector<std::unique_ptr<State<EmissionType>>>& states)
+    : hmm_(hmm),
+      states_(states),
+      state_emissions_(states),
+      emission_probs_(hmm.num_states_),
+      all_states_(hmm.num_states_),
+      row_(hmm.num_states_, Log2Num(0)),
+      next_row_(hmm.num_states_, Log2Num(0)),
+      window_(hmm.allocateBackpointers(1)),
+      walk_sizes_(1, 0),
+      walked_columns_(0),
+      fixed_row_(0),
+      fixed_state_(hmm.initial_state_),
+      processed_(0),
+      initial_state_output_(false) {
+  hmm_.isValid(states_);
+  std::iota(all_states_.begin(), all_states_.end(), 0);
+  row_[hmm_.initial_state_] = Log2Num(1);
+}
+
+template <typename EmissionType>
+std::vector<int> OnlineViterbi<EmissionType>::addEmissions(
+    const std::vector<EmissionType>& emissions) {
+  for (const EmissionType& emission : emissions) {
+    processed_++;
+    window_.appendRows(1);
+    walk_sizes_.push_back(0);
+    state_emissions_.column(emission, &emission_probs_);
+    hmm_.computeViterbiColumn(all_states_, state_emissions_,
+                              emission_probs_.data(), row_, &next_row_,
+                              &window_, processed_ - fixed_row_);
+    std::swap(row_, next_row_);
+  }
+
+  return outputConvergedPrefix();
+}
+
+template <typename EmissionType>
+std::vector<int> OnlineViterbi<EmissionType>::finish() {
+  Log2Num best_prob = Log2Num(0);
+  int best_terminal_state = 0;
+  for (int i = 0; i < hmm_.num_states_; ++i) {
+    if (row_[i] > best_prob) {
+      best_prob = row_[i];
+      best_terminal_state = i;
+    }
+  }
+
+  std::vector<int> res = pathFromFixedState(processed_, best_terminal_state);
+  initial_state_output_ = true;
+  fixed_row_ = processed_;
+  fixed_state_ = best_terminal_state;
+  window_.eraseFirstRows(window_.rows() - 1);
+  walk_sizes_.assign(1, 0);
+  return res;
+}
+
+template <typename EmissionType>
+void OnlineViterbi<EmissionType>::resolveSilentStates(
+    int row, std::vector<int>* nodes) const {
+  // Predecessors of silent states have lower ids. Processing states from the
+  // greatest id resolves whole chains of silent states.
+  std::priority_queue<int> pending(nodes->begin(), nodes->end());
+  nodes->clear();
+  while (!pending.empty()) {
+    int state_id = pending.top();
+    // Copies of the state are next in the queue.
+    while (!pending.empty() && pending.top() == state_id) pending.pop();
+    if (!state_emissions_.isSilent(state_id)) {
+      nodes->push_back(state_id);
+      continue;
+    }
+    int prev_state = previousState(row, state_id);
+    if (prev_state != hmm_.kNoState) pending.push(prev_state);
+  }
+}
+
+template <typename EmissionType>
+std::vector<int> OnlineViterbi<EmissionType>::outputConvergedPrefix() {
+  std::vector<int> nodes;
+  for (int state_id = 0; state_id < hmm_.num_states_; state_id++) {
+    if (!row_[state_id].isLogZero()) nodes.push_back(state_id);
+  }
+
+  // Follow all chains at once column by column until they meet.
+  for (int row = processed_; row > fixed_row_ && !nodes.empty(); row--) {
+    walked_columns_++;
+    resolveSilentStates(row, &nodes);
+    if (nodes.size() == 1) {
+      std::vector<int> res = pathFromFixedState(row, nodes[0]);
+      initial_state_output_ = true;
+      window_.eraseFirstRows(row - fixed_row_);
+      walk_sizes_.erase(walk_sizes_.begin(),
+                        walk_sizes_.begin() + (row - fixed_row_));
+      fixed_row_ = row;
+      fixed_state_ = nodes[0];
+      return res;
+    }
+    int& walk_size = walk_sizes_[row - fixed_row_];
+    if ((int)nodes.size() == walk_size) break;
+    walk_size = nodes.size();
+
+    for (int& state_id : nodes) state_id = previousState(row, state_id);
+    nodes.erase(std::remove(nodes.begin(), nodes.end(), hmm_.kNoState),
+                nodes.end());
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+  }
+
+  if (!initial_state_output_) {
+    initial_state_output_ = true;
+    return {fixed_state_};
+  }
+  return {};
+}
+
+template <typename EmissionType>
+std::vector<int> OnlineViterbi<EmissionType>::pathFromFixedState(
+    int row, int state_id) const {
+  std::vector<int> res;
+  int curr_state = state_id;
+  while (!(row == fixed_row_ && curr_state == fixed_state_)) {
+    if (curr_state == hmm_.kNoState || row < fixed_row_) {
+      throw std::logic_error("Path does not go through the fixed state.");
+    }
+    res.push_back(curr_state);
+    int next_state = previousState(row, curr_state);
+    if (!states_[curr_state]->isSilent()) row--;
+    curr_state = next_state;
+  }
+
+  if (!initial_state_output_) res.push_back(fixed_state_);
+  std::reverse(res.begin(), res.end());
+  return res;
+}
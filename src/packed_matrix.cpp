@@ -0,0 +1,25 @@
+#include <cassert>
+
+#include "packed_matrix.h"
+
+PackedMatrix::PackedMatrix(int rows, int cols, uint32_t max_value)
+    : rows_(rows), cols_(cols), bits_(1) {
+  // Number of bits needed for @max_value.
+  while (bits_ < 32 && (max_value >> bits_) > 0) bits_++;
+  cells_per_word_ = 64 / bits_;
+  words_per_row_ = (cols_ + cells_per_word_ - 1) / cells_per_word_;
+  mask_ = (((uint64_t)1) << bits_) - 1;
+  words_.assign((size_t)rows_ * words_per_row_, 0);
+}
+
+void PackedMatrix::appendRows(int count) {
+  rows_ += count;
+  words_.resize((size_t)rows_ * words_per_row_, 0);
+}
+
+void PackedMatrix::eraseFirstRows(int count) {
+  assert(count <= rows_);
+  words_.erase(words_.begin(),
+               words_.begin() + (size_t)count * words_per_row_);
+  rows_ -= count;
+}
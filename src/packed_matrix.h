@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Matrix of small non-negative integers. Every cell occupies only as many bits
+// as are needed to store the greatest value that can appear in the matrix.
+// Cells never cross boundary of 64-bit word and every row starts in a new word.
+// Therefore rows can be appended and erased without repacking the matrix.
+class PackedMatrix {
+ public:
+  PackedMatrix() : rows_(0), cols_(0), bits_(1), cells_per_word_(64),
+                   words_per_row_(0) {}
+  // All cells are initialized to zero.
+  // @max_value - the greatest value that will be stored in the matrix.
+  PackedMatrix(int rows, int cols, uint32_t max_value);
+
+  uint32_t get(int row, int col) const {
+    uint64_t word = words_[wordIdx(row, col)];
+    return (word >> bitOffset(col)) & mask_;
+  }
+
+  void set(int row, int col, uint32_t value) {
+    uint64_t& word = words_[wordIdx(row, col)];
+    int offset = bitOffset(col);
+    word &= ~(mask_ << offset);
+    word |= ((uint64_t)value & mask_) << offset;
+  }
+
+  // Appends @count rows filled with zeros at the end of the matrix.
+  void appendRows(int count);
+  // Removes first @count rows. Row i becomes row i-count.
+  void eraseFirstRows(int count);
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int bitsPerCell() const { return bits_; }
+  // Cells of a row stored in one word. Threads can write to the same row at
+  // the same time if their columns are split at multiples of this number.
+  int cellsPerWord() const { return cells_per_word_; }
+  // Number of bytes allocated for cells.
+  size_t memoryUsage() const { return words_.size() * sizeof(uint64_t); }
+
+ private:
+  size_t wordIdx(int row, int col) const {
+    return (size_t)row * words_per_row_ + col / cells_per_word_;
+  }
+  int bitOffset(int col) const { return (col % cells_per_word_) * bits_; }
+
+  int rows_;
+  int cols_;
+  int bits_;
+  int cells_per_word_;
+  int words_per_row_;
+  uint64_t mask_;
+  std::vector<uint64_t> words_;
+};
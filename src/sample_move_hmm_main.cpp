@@ -14,7 +14,10 @@
 
 #include "fast5/src/fast5.hpp"
 
+#include "src/hmm_binary.h"
 #include "src/move_hmm.h"
+#include "src/move_hmm_viterbi.h"
+#include "src/online_viterbi.h"
 #include "src/model_params_corrections.h"
 
 #include <json/value.h>
@@ -28,10 +31,145 @@ DEFINE_bool(template_strand, true,
             "Use template(true) or complement(false) strand for training.");
 
 DEFINE_string(trained_move_hmm, "",
-              "Path to JSON file containing serialized MoveHMM.");
+              "Path to JSON or binary file containing serialized MoveHMM. "
+              "Binary model is memory mapped and skips parsing of text but "
+              "its transitions are still copied into the HMM. See "
+              "convert_hmm_main.");
 
 DEFINE_int32(samples, 100, "Number of samples.");
 
+DEFINE_bool(fastq, false,
+            "Run posterior decoding and write basecalled read with base "
+            "qualities to FASTQ file.");
+
+DEFINE_int32(sampling_threads, 1,
+             "Number of threads used for sampling. Samples do not depend on "
+             "number of threads.");
+
+DEFINE_bool(batched_traceback, false,
+            "Backtrack all samples of a thread together row by row.");
+
+DEFINE_bool(scaled_forward, false,
+            "Compute forward matrix for sampling in linear space with scaling "
+            "instead of log space.");
+
+DEFINE_double(beam_log2_margin, -1,
+              "Beam pruning for Viterbi algorithm. States with probability "
+              "lower than 2^-beam_log2_margin times probability of the best "
+              "state are pruned. Negative value turns off the pruning.");
+
+DEFINE_int32(beam_max_states, 0,
+             "Beam pruning for Viterbi algorithm. Maximal number of states "
+             "that survive after every event. Zero means no limit.");
+
+DEFINE_bool(viterbi_checkpointing, false,
+            "Viterbi algorithm keeps only every sqrt(#events)-th row and "
+            "recomputes the rest during backtracking. Uses much less memory "
+            "for long reads.");
+
+DEFINE_int32(online_viterbi_chunk, 0,
+             "If positive, Viterbi algorithm is run online. Events are passed "
+             "to the decoder in chunks of this size and bases are written to "
+             "the output as soon as they are final. Online Viterbi is always "
+             "exact with double scores so it cannot be combined with beam "
+             "pruning, checkpointing, fixed point, other approximate, "
+             "batched and multithreaded Viterbi and --move_hmm_viterbi.");
+
+DEFINE_bool(move_hmm_viterbi, false,
+            "Viterbi algorithm enumerates transitions of MoveHMM from codes of "
+            "kmers instead of lists of transitions. Gives the same result. "
+            "Cannot be combined with beam pruning, checkpointing or online "
+            "Viterbi.");
+
+DEFINE_double(viterbi_fixed_point_scale, 0,
+              "If positive, Viterbi algorithm uses int32 scores equal to log2 "
+              "of probabilities multiplied by this scale. Cannot be combined "
+              "with beam pruning, checkpointing or online Viterbi.");
+
+DEFINE_bool(validate_fixed_point, false,
+            "Fixed point Viterbi runs also floating point Viterbi and logs a "
+            "warning if the paths differ.");
+
+DEFINE_int32(batch_size, 1,
+             "Number of reads decoded together with one read per SIMD lane. "
+             "Cannot be combined with approximate or online Viterbi, "
+             "--move_hmm_viterbi, --scaled_forward and float precision.");
+
+DEFINE_int32(viterbi_threads, 1,
+             "Number of threads computing every column of the Viterbi matrix "
+             "of one read. Cannot be combined with beam pruning, fixed point, "
+             "online, batched Viterbi and --move_hmm_viterbi.");
+
+DEFINE_int32(forward_threads, 1,
+             "Number of threads computing every column of the forward matrix "
+             "for sampling. Cannot be combined with --scaled_forward and "
+             "--batch_size.");
+
+DEFINE_int32(emission_table_rows, 4096,
+             "Emission probabilities of a read are computed once and shared "
+             "by Viterbi, sampling and posterior decoding if the read has at "
+             "most this many events and the tile fits into "
+             "--emission_table_max_mb. Longer reads stream them in tiles. "
+             "Zero turns the table off. Not used with "
+             "--emission_gate_sigmas and --basecaller_band which compute "
+             "emissions only of active states.");
+
+DEFINE_int32(emission_table_max_mb, 64,
+             "Memory of one tile of the emission table in MB. Models with "
+             "many states get tiles with fewer rows.");
+
+DEFINE_double(emission_bin_width, 0,
+              "If positive, emission table of a read computes probabilities "
+              "only for currents this many pA apart and interpolates log2 of "
+              "them linearly. Requires --emission_table_rows.");
+
+DEFINE_double(max_emission_log2_error, 0.01,
+              "Reads whose bound of the log2 error of interpolated emission "
+              "probabilities exceeds this use exact emission table.");
+
+DEFINE_double(emission_gate_sigmas, 0,
+              "If positive, Viterbi and sampling compute for every event only "
+              "states whose mean is within this many standard deviations of "
+              "the event. Approximate. Cannot be combined with fixed point, "
+              "online, batched and multithreaded decoding and "
+              "--move_hmm_viterbi.");
+
+DEFINE_bool(basecaller_band, false,
+            "Viterbi and sampling compute for every event only kmers near the "
+            "kmers which the basecaller assigned to nearby events. See "
+            "--band_max_move and --band_window. Cannot be combined with other "
+            "approximate, online, batched and multithreaded decoding.");
+
+DEFINE_int32(band_max_move, 2,
+             "Kmers reachable by at most this many moves from a basecalled "
+             "kmer are in the band.");
+
+DEFINE_int32(band_window, 5,
+             "Basecalled kmers of events at most this many events away are "
+             "used for the band of an event.");
+
+DEFINE_double(band_expand_log2_drop, 40,
+              "Event is decoded with all kmers if the best log2 probability "
+              "in the band drops by more than this from the previous event.");
+
+DEFINE_bool(compressed_transitions, false,
+            "Viterbi and sampling read transitions compressed to a default "
+            "probability of every state and its exceptions. Gives the same "
+            "result. Turns off --fused_decoding. Cannot be combined with "
+            "approximate, fixed point, online and batched decoding, "
+            "--scaled_forward and --move_hmm_viterbi.");
+
+DEFINE_bool(fused_decoding, true,
+            "Viterbi algorithm and forward matrix for sampling are computed "
+            "in one sweep over the events if Viterbi is exact and offline and "
+            "--scaled_forward is off. Gives the same result. Both use "
+            "max(--viterbi_threads, --forward_threads) threads.");
+
+DEFINE_string(precision, "double",
+              "Type of scores in dynamic programming: double or float. Float "
+              "halves memory of the forward matrix. Online Viterbi and "
+              "--move_hmm_viterbi always use double.");
+
 using ::fast5::File;
 using ::fast5::Event_Entry;
 using ::fast5::Model_Entry;
@@ -40,19 +178,156 @@ using std::chrono::system_clock;
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 
-const int k = 5;  // length of kmer
-
 std::string getFilenameFrom(const std::string& path) {
   size_t last_slash = path.find_last_of('/');
   if (last_slash == std::string::npos) return path;
   return path.substr(last_slash + 1);
 }
 
+// Output files of a read.
+struct ReadInfo {
+  std::string read_name_;
+  std::string out_filename_;
+};
+
+// Reads events of @strand and constructs states from the scaled model in the
+// fast5 file. The model has to have kmers of length @k. Kmers and moves
+// assigned to the events by the basecaller are stored to @basecalled. Returns
+// false if the file does not contain them.
+bool loadRead(const std::string& file_path, Strand strand, int k,
+              ReadInfo* info,
+              std::vector<double>* current_levels,
+              std::vector<std::unique_ptr<State<double>>>* states,
+              std::vector<MoveKmer>* basecalled) {
+  File file(file_path);
+  LOG(INFO) << "Processing read: " << file_path;
+
+  if (!file.have_events(strand)) {
+    LOG(ERROR) << "File " << file_path << "does not have " << strand << ".";
+    return false;
+  }
+  if (!file.have_model(strand)) {
+    LOG(ERROR) << "File " << file_path << "does not have model for " << strand
+               << ".";
+    return false;
+  }
+
+  // Get current levels.
+  std::vector<Event_Entry> events = file.get_events(strand);
+  for (const Event_Entry& event : events) {
+    current_levels->push_back(event.mean);
+    basecalled->push_back({(int)event.move, event.model_state});
+  }
+  LOG(INFO) << file_path << ": Number of events: " << current_levels->size();
+
+  // Construct states for given HMM.
+  std::vector<Model_Entry> kmer_models = file.get_model(strand);
+  Model_Parameters model_params = file.get_model_parameters(strand);
+  std::vector<GaussianParamsKmer> gaussian_kmer;
+  for (const Model_Entry& model_entry : kmer_models) {
+    Gaussian scaled_gaussian = scaleGaussianCurrentLevel(
+        {model_entry.level_mean, model_entry.level_stdv}, model_params);
+    gaussian_kmer.push_back(
+        {model_entry.kmer, scaled_gaussian.mu_, scaled_gaussian.sigma_});
+  }
+  *states = constructEmissions(k, gaussian_kmer);
+  LOG(INFO) << file_path << ": Constructed states";
+
+  // Replace .fast5 with .samples extension. That'll be the output file.
+  std::string filename = getFilenameFrom(file_path);
+  int extension_pos = filename.find_last_of('.');
+  info->read_name_ = filename.substr(0, extension_pos);
+  info->out_filename_ = filename.replace(extension_pos + 1, 5, "samples");
+  return true;
+}
+
+// Emission table of a read shared by all algorithms run on it. The table is
+// quantized if --emission_bin_width is set and its error bound is small enough
+// for the read.
+template <typename Real>
+std::unique_ptr<EmissionTable<double, Real>> makeEmissionTable(
+    const std::string& file_path, const std::vector<double>& current_levels,
+    const std::vector<std::unique_ptr<State<double>>>& states) {
+  int tile_rows = EmissionTable<double, Real>::tileRowsForBudget(
+      states.size(), FLAGS_emission_table_rows,
+      (size_t)FLAGS_emission_table_max_mb << 20);
+  if (FLAGS_emission_bin_width > 0) {
+    std::unique_ptr<EmissionTable<double, Real>> table(
+        new EmissionTable<double, Real>(current_levels, states, tile_rows,
+                                        FLAGS_emission_bin_width));
+    if (table->maxLog2Error() <= FLAGS_max_emission_log2_error) return table;
+    LOG(WARNING) << file_path << ": Error of quantized emissions "
+                 << table->maxLog2Error() << " is too big, using exact ones.";
+  }
+  return std::unique_ptr<EmissionTable<double, Real>>(
+      new EmissionTable<double, Real>(current_levels, states, tile_rows));
+}
+
+void writeFastq(int k, const std::string& read_name,
+                const PosteriorDecoding& decoding) {
+  BasecalledRead read =
+      posteriorDecodingToRead(k, decoding.state_ids_, decoding.posteriors_);
+  std::ofstream fastq_file(read_name + ".fastq");
+  fastq_file << "@" << read_name << "\n" << read.bases_ << "\n+\n"
+             << read.qualities_ << "\n";
+}
+
+// Reads waiting to be decoded together.
+struct ReadBatch {
+  std::vector<ReadInfo> infos_;
+  std::vector<std::vector<double>> current_levels_;
+  std::vector<std::vector<std::unique_ptr<State<double>>>> states_;
+};
+
+// Writes the same output files for every read of @batch as the main loop
+// does for a single read.
+void decodeBatch(int k, const ::HMM<double>& hmm,
+                 const SamplingParams& sampling_params, ReadBatch* batch) {
+  // The batch is emptied even if decoding fails.
+  ReadBatch reads = std::move(*batch);
+  *batch = ReadBatch();
+  if (reads.infos_.empty()) return;
+  auto start = system_clock::now();
+  std::vector<std::vector<int>> viterbi_seqs =
+      hmm.runViterbiBatch(reads.current_levels_, reads.states_);
+  LOG(INFO) << "Viterbi of " << reads.infos_.size() << " reads took "
+            << duration_cast<milliseconds>(system_clock::now() - start)
+                   .count() << " ms";
+
+  std::vector<std::vector<std::vector<int>>> samples;
+  if (FLAGS_samples > 0) {
+    start = system_clock::now();
+    samples = hmm.posteriorProbSampleBatch(FLAGS_samples, rand(),
+                                           reads.current_levels_,
+                                           reads.states_, sampling_params);
+    LOG(INFO) << "Sampling of " << reads.infos_.size() << " reads took "
+              << duration_cast<milliseconds>(system_clock::now() - start)
+                     .count() << " ms";
+  }
+
+  for (int read = 0; read < (int)reads.infos_.size(); read++) {
+    const ReadInfo& info = reads.infos_[read];
+    std::ofstream out_file(info.out_filename_);
+    out_file << stateSeqToBases(k, viterbi_seqs[read]) << "\n\n";
+    if (FLAGS_samples > 0) {
+      for (const auto& sample : samples[read]) {
+        out_file << stateSeqToBases(k, sample) << "\n";
+      }
+    }
+    if (FLAGS_fastq) {
+      writeFastq(k, info.read_name_,
+                 hmm.posteriorDecoding(reads.current_levels_[read],
+                                       reads.states_[read]));
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   google::SetUsageMessage(
       "Commandline tool for sampling from posterior probability of MoveHMM.");
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
+  LOG(INFO) << "Log2 kernels: " << log2KernelIsaName(log2KernelIsa());
 
   Strand strand = FLAGS_template_strand ? kTemplate : kComplement;
 
@@ -60,84 +335,297 @@ int main(int argc, char** argv) {
   std::ifstream path_list(FLAGS_list_file);
   CHECK(path_list.is_open());
 
-  // Parse json file with MoveHMM.
+  // Binary model is read from the mapped file without parsing of text. Its
+  // transitions are copied into the HMM the same way as from JSON.
+  auto load_start = system_clock::now();
+  MappedFile model_file(FLAGS_trained_move_hmm);
+  std::unique_ptr<BinaryModelView> binary_model;
   Json::Value value;
-  std::ifstream json_file(FLAGS_trained_move_hmm);
-  Json::Reader reader;
-  CHECK(reader.parse(json_file, value, false));
-  ::HMM<double> hmm = ::HMM<double>(value);
+  if (isBinaryModel(model_file.data(), model_file.size())) {
+    binary_model.reset(
+        new BinaryModelView(model_file.data(), model_file.size()));
+  } else {
+    Json::Reader reader;
+    CHECK(reader.parse(model_file.data(),
+                       model_file.data() + model_file.size(), value, false));
+  }
+  ::HMM<double> hmm = binary_model ? ::HMM<double>(*binary_model)
+                                   : ::HMM<double>(value);
+  CHECK(FLAGS_precision == "double" || FLAGS_precision == "float")
+      << "Unknown precision: " << FLAGS_precision;
+  std::unique_ptr<::HMM<double, float>> float_hmm;
+  if (FLAGS_precision == "float") {
+    // Built from the loaded model so the input is not decoded again.
+    float_hmm.reset(
+        new ::HMM<double, float>(hmm.initialState(), hmm.transitions()));
+    float_hmm->setKmerLength(hmm.kmerLength());
+  }
+  const int k = moveHMMKmerLength(hmm);
+  LOG(INFO) << "Length of kmers: " << k;
+  LOG(INFO) << "Loading of the model took: "
+            << duration_cast<milliseconds>(system_clock::now() - load_start)
+                   .count() << " ms";
+
+  ViterbiParams viterbi_params;
+  if (FLAGS_beam_log2_margin >= 0) {
+    viterbi_params.beam_log2_margin_ = FLAGS_beam_log2_margin;
+  }
+  viterbi_params.beam_max_states_ = FLAGS_beam_max_states;
+  viterbi_params.checkpointing_ = FLAGS_viterbi_checkpointing;
+  viterbi_params.fixed_point_scale_ = FLAGS_viterbi_fixed_point_scale;
+  viterbi_params.validate_fixed_point_ = FLAGS_validate_fixed_point;
+  viterbi_params.threads_ = FLAGS_viterbi_threads;
+  viterbi_params.emission_gate_sigmas_ = FLAGS_emission_gate_sigmas;
+  CHECK(FLAGS_viterbi_threads >= 1) << "Number of threads has to be positive.";
+  CHECK(FLAGS_viterbi_threads == 1 ||
+        (FLAGS_online_viterbi_chunk <= 0 && !FLAGS_move_hmm_viterbi &&
+         FLAGS_batch_size == 1))
+      << "--viterbi_threads is not supported by online, batched and MoveHMM "
+         "Viterbi.";
+  CHECK(FLAGS_online_viterbi_chunk <= 0 ||
+        (!viterbi_params.isBeamSearch() && !FLAGS_viterbi_checkpointing &&
+         FLAGS_viterbi_fixed_point_scale <= 0))
+      << "Online Viterbi does not support beam pruning, checkpointing and "
+         "fixed point scores.";
+
+  std::unique_ptr<MoveHMMViterbi> move_hmm_viterbi;
+  if (FLAGS_move_hmm_viterbi) {
+    CHECK(FLAGS_beam_log2_margin < 0 && FLAGS_beam_max_states == 0 &&
+          !FLAGS_viterbi_checkpointing && FLAGS_online_viterbi_chunk <= 0 &&
+          FLAGS_viterbi_fixed_point_scale <= 0)
+        << "--move_hmm_viterbi supports only exact offline Viterbi.";
+    move_hmm_viterbi.reset(new MoveHMMViterbi(k, hmm));
+    LOG(INFO) << "MoveHMM Viterbi: max move " << move_hmm_viterbi->maxMove()
+              << ", transition table "
+              << move_hmm_viterbi->tableMemoryUsage() << " bytes";
+  }
+
+  SamplingParams sampling_params;
+  sampling_params.threads_ = FLAGS_sampling_threads;
+  sampling_params.batched_traceback_ = FLAGS_batched_traceback;
+  sampling_params.scaled_forward_ = FLAGS_scaled_forward;
+  sampling_params.forward_threads_ = FLAGS_forward_threads;
+  sampling_params.emission_gate_sigmas_ = FLAGS_emission_gate_sigmas;
+  CHECK(FLAGS_sampling_threads >= 1)
+      << "Number of threads has to be positive.";
+  CHECK(FLAGS_emission_gate_sigmas <= 0 ||
+        (FLAGS_viterbi_fixed_point_scale <= 0 &&
+         FLAGS_online_viterbi_chunk <= 0 && FLAGS_batch_size == 1 &&
+         FLAGS_viterbi_threads == 1 && FLAGS_forward_threads == 1 &&
+         !FLAGS_move_hmm_viterbi && !FLAGS_scaled_forward))
+      << "--emission_gate_sigmas supports only single threaded offline "
+         "decoding with floating point scores.";
+  CHECK(FLAGS_forward_threads == 1 || FLAGS_batch_size == 1)
+      << "--forward_threads is not supported by batched sampling.";
+
+  // Band of the current read.
+  StateBand band;
+  if (FLAGS_basecaller_band) {
+    CHECK(!viterbi_params.isBeamSearch() && FLAGS_emission_gate_sigmas <= 0 &&
+          FLAGS_viterbi_fixed_point_scale <= 0 &&
+          FLAGS_online_viterbi_chunk <= 0 && FLAGS_batch_size == 1 &&
+          FLAGS_viterbi_threads == 1 && FLAGS_forward_threads == 1 &&
+          !FLAGS_move_hmm_viterbi && !FLAGS_scaled_forward)
+        << "--basecaller_band supports only single threaded offline "
+           "decoding with floating point scores.";
+    viterbi_params.band_ = &band;
+    sampling_params.band_ = &band;
+  }
+
+  if (FLAGS_compressed_transitions) {
+    CHECK(!viterbi_params.isBeamSearch() && FLAGS_emission_gate_sigmas <= 0 &&
+          !FLAGS_basecaller_band && FLAGS_viterbi_fixed_point_scale <= 0 &&
+          FLAGS_online_viterbi_chunk <= 0 && FLAGS_batch_size == 1 &&
+          !FLAGS_move_hmm_viterbi && !FLAGS_scaled_forward)
+        << "--compressed_transitions supports only exact offline decoding "
+           "with floating point scores.";
+    viterbi_params.compressed_transitions_ = true;
+    sampling_params.compressed_transitions_ = true;
+    const CompressedTransitions<double>& compressed =
+        hmm.compressedTransitions();
+    LOG(INFO) << "Compressed transitions: " << compressed.numExceptions()
+              << " exceptions, " << compressed.memoryUsage() << " bytes";
+  }
+
+  CHECK(FLAGS_emission_table_max_mb > 0)
+      << "Memory of emission table has to be positive.";
+  CHECK(FLAGS_emission_bin_width <= 0 || FLAGS_emission_table_rows > 0)
+      << "--emission_bin_width requires --emission_table_rows.";
+
+  CHECK(FLAGS_batch_size >= 1) << "Batch size has to be positive.";
+  CHECK(FLAGS_batch_size == 1 ||
+        (!viterbi_params.isBeamSearch() && !FLAGS_viterbi_checkpointing &&
+         FLAGS_viterbi_fixed_point_scale <= 0 &&
+         FLAGS_online_viterbi_chunk <= 0 && !FLAGS_move_hmm_viterbi &&
+         !FLAGS_scaled_forward && FLAGS_precision == "double"))
+      << "--batch_size supports only exact offline decoding with doubles.";
+  ReadBatch batch;
+
+  const bool fused_decoding =
+      FLAGS_fused_decoding && FLAGS_samples > 0 &&
+      !viterbi_params.isBeamSearch() && !FLAGS_viterbi_checkpointing &&
+      FLAGS_viterbi_fixed_point_scale <= 0 &&
+      FLAGS_online_viterbi_chunk <= 0 && !FLAGS_move_hmm_viterbi &&
+      !FLAGS_scaled_forward && FLAGS_emission_gate_sigmas <= 0 &&
+      !FLAGS_basecaller_band && !FLAGS_compressed_transitions;
+  SamplingParams fused_params = sampling_params;
+  fused_params.forward_threads_ =
+      std::max(FLAGS_viterbi_threads, FLAGS_forward_threads);
 
   srand(time(0));
   while (path_list >> file_path) {
     try {
-      File file(file_path);
-      LOG(INFO) << "Processing read: " << file_path;
-
-      if (!file.have_events(strand)) {
-        LOG(ERROR) << "File " << file_path << "does not have " << strand << ".";
+      ReadInfo info;
+      std::vector<double> current_levels;
+      std::vector<std::unique_ptr<State<double>>> states;
+      std::vector<MoveKmer> basecalled;
+      if (!loadRead(file_path, strand, k, &info, &current_levels, &states,
+                    &basecalled)) {
         continue;
       }
-      if (!file.have_model(strand)) {
-        LOG(ERROR) << "File " << file_path << "does not have model for "
-                   << strand << ".";
-        continue;
+      if (FLAGS_basecaller_band) {
+        band = basecallerBand(basecalled, FLAGS_band_max_move,
+                              FLAGS_band_window);
+        band.expand_log2_drop_ = FLAGS_band_expand_log2_drop;
       }
-
-      // Get current levels.
-      std::vector<double> current_levels;
-      std::vector<Event_Entry> events = file.get_events(strand);
-      for (const Event_Entry& event : events) {
-        current_levels.push_back(event.mean);
+      // All reads have the same silent states so the model is validated
+      // only for the first read.
+      if (!hmm.isCompiled()) {
+        hmm.compile(states);
+        if (float_hmm) float_hmm->compile(states);
       }
-      LOG(INFO) << file_path << ": Number of events: " << current_levels.size();
-
-      // Construct states for given HMM.
-      std::vector<Model_Entry> kmer_models = file.get_model(strand);
-      Model_Parameters model_params = file.get_model_parameters(strand);
-      std::vector<GaussianParamsKmer> gaussian_kmer;
-      for (const Model_Entry& model_entry : kmer_models) {
-        Gaussian scaled_gaussian = scaleGaussianCurrentLevel(
-            {model_entry.level_mean, model_entry.level_stdv}, model_params);
-        gaussian_kmer.push_back(
-            {model_entry.kmer, scaled_gaussian.mu_, scaled_gaussian.sigma_});
+      if (FLAGS_batch_size > 1) {
+        batch.infos_.push_back(info);
+        batch.current_levels_.push_back(std::move(current_levels));
+        batch.states_.push_back(std::move(states));
+        if ((int)batch.infos_.size() == FLAGS_batch_size) {
+          decodeBatch(k, hmm, sampling_params, &batch);
+        }
+        continue;
       }
-      const std::vector<std::unique_ptr<State<double>>>& states =
-          constructEmissions(k, gaussian_kmer);
-      LOG(INFO) << file_path << ": Constructed states";
 
-      // Replace .fast5 with .samples extension. That'll be the output file.
-      std::string filename = getFilenameFrom(file_path);
-      int extension_pos = filename.find_last_of('.');
-      std::string out_filename =
-          filename.replace(extension_pos + 1, 5, "samples");
+      std::ofstream out_file(info.out_filename_);
 
-      std::ofstream out_file(out_filename);
+      // Emission probabilities shared by all algorithms run on the read.
+      // Gated and banded decoding compute them only for active states.
+      std::unique_ptr<EmissionTable<double>> emission_table;
+      std::unique_ptr<EmissionTable<double, float>> float_emission_table;
+      if (FLAGS_emission_table_rows > 0 && FLAGS_online_viterbi_chunk <= 0 &&
+          FLAGS_emission_gate_sigmas <= 0 && !FLAGS_basecaller_band) {
+        if (float_hmm) {
+          float_emission_table = makeEmissionTable<float>(
+              file_path, current_levels, states);
+        } else {
+          emission_table = makeEmissionTable<double>(
+              file_path, current_levels, states);
+        }
+      }
 
       // Run Viterbi algorithm.
       auto start = system_clock::now();
-      std::vector<int> viterbi_seq =
-          hmm.runViterbiReturnStateIds(current_levels, states);
-      out_file << stateSeqToBases(k, viterbi_seq) << "\n\n";
-      LOG(INFO) << file_path << ": Viterbi took "
+      std::vector<std::vector<int>> samples;
+      if (FLAGS_online_viterbi_chunk > 0) {
+        OnlineViterbi<double> decoder(hmm, states);
+        int last_state = -1;
+        auto outputFixed = [&](const std::vector<int>& fixed) {
+          if (fixed.empty()) return;
+          std::vector<int> bases_states = fixed;
+          if (last_state == -1) {
+            // The first state is the initial state.
+            last_state = bases_states.front();
+            bases_states.erase(bases_states.begin());
+          }
+          out_file << stateSeqToBases(k, last_state, bases_states)
+                   << std::flush;
+          if (!bases_states.empty()) last_state = bases_states.back();
+        };
+        for (size_t begin = 0; begin < current_levels.size();
+             begin += FLAGS_online_viterbi_chunk) {
+          size_t end = std::min(current_levels.size(),
+                                begin + FLAGS_online_viterbi_chunk);
+          outputFixed(decoder.addEmissions(std::vector<double>(
+              current_levels.begin() + begin, current_levels.begin() + end)));
+        }
+        outputFixed(decoder.finish());
+        out_file << "\n\n";
+      } else if (fused_decoding) {
+        // Samples are computed together with Viterbi path.
+        int seed = rand();
+        ViterbiAndSamples res =
+            float_hmm
+                ? float_hmm->runViterbiAndSample(
+                      FLAGS_samples, seed, current_levels, states,
+                      fused_params, float_emission_table.get())
+                : hmm.runViterbiAndSample(FLAGS_samples, seed, current_levels,
+                                          states, fused_params,
+                                          emission_table.get());
+        out_file << stateSeqToBases(k, res.viterbi_state_ids_) << "\n\n";
+        samples = std::move(res.samples_);
+      } else {
+        std::vector<int> viterbi_seq;
+        if (move_hmm_viterbi) {
+          viterbi_seq = move_hmm_viterbi->runViterbiReturnStateIds(
+              current_levels, states);
+        } else if (float_hmm) {
+          viterbi_seq = float_hmm->runViterbiReturnStateIds(
+              current_levels, states, viterbi_params,
+              float_emission_table.get());
+        } else {
+          viterbi_seq = hmm.runViterbiReturnStateIds(
+              current_levels, states, viterbi_params, emission_table.get());
+        }
+        out_file << stateSeqToBases(k, viterbi_seq) << "\n\n";
+      }
+      LOG(INFO) << file_path
+                << (fused_decoding ? ": Viterbi and sampling took "
+                                   : ": Viterbi took ")
                 << duration_cast<milliseconds>(system_clock::now() - start)
                        .count() << " ms";
 
       // Sample from posterior probability.
-      start = system_clock::now();
-      int seed = rand();
-      std::vector<std::vector<int>> samples =
-          hmm.posteriorProbSample(FLAGS_samples, seed, current_levels, states);
+      if (FLAGS_samples > 0 && !fused_decoding) {
+        start = system_clock::now();
+        int seed = rand();
+        samples = float_hmm
+                      ? float_hmm->posteriorProbSample(
+                            FLAGS_samples, seed, current_levels, states,
+                            sampling_params, float_emission_table.get())
+                      : hmm.posteriorProbSample(FLAGS_samples, seed,
+                                                current_levels, states,
+                                                sampling_params,
+                                                emission_table.get());
+        LOG(INFO) << file_path << ": Sampling took "
+                  << duration_cast<milliseconds>(system_clock::now() - start)
+                         .count() << " ms";
+      }
       for (const auto& sample : samples) {
         out_file << stateSeqToBases(k, sample) << "\n";
       }
-      LOG(INFO) << file_path << ": Sampling took "
-                << duration_cast<milliseconds>(system_clock::now() - start)
-                       .count() << " ms";
+
+      // Posterior decoding with base qualities.
+      if (FLAGS_fastq) {
+        start = system_clock::now();
+        writeFastq(k, info.read_name_,
+                   float_hmm ? float_hmm->posteriorDecoding(
+                                   current_levels, states,
+                                   float_emission_table.get())
+                             : hmm.posteriorDecoding(current_levels, states,
+                                                     emission_table.get()));
+        LOG(INFO) << file_path << ": Posterior decoding took "
+                  << duration_cast<milliseconds>(system_clock::now() - start)
+                         .count() << " ms";
+      }
     }
     catch (std::exception& e) {
       LOG(ERROR) << e.what();
     }
   }
+  try {
+    decodeBatch(k, hmm, sampling_params, &batch);
+  }
+  catch (std::exception& e) {
+    LOG(ERROR) << e.what();
+  }
 
   return 0;
 }
@@ -0,0 +1,87 @@
+// Team of threads working on one dynamic programming matrix.
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Barrier for a fixed number of threads which spins instead of sleeping. One
+// column of a matrix takes only microseconds so waking up sleeping threads
+// after every column would cost more than the column itself. After many
+// spins the thread yields so that the team still makes progress when there
+// are more threads than cores.
+class SpinBarrier {
+ public:
+  explicit SpinBarrier(int threads)
+      : threads_(threads), waiting_(0), generation_(0) {}
+
+  // Returns when all threads called wait.
+  void wait() {
+    int generation = generation_.load(std::memory_order_acquire);
+    if (waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == threads_) {
+      waiting_.store(0, std::memory_order_relaxed);
+      generation_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    for (int spins = 0;
+         generation_.load(std::memory_order_acquire) == generation; spins++) {
+      if (spins >= kSpinsBeforeYield) std::this_thread::yield();
+    }
+  }
+
+ private:
+  static const int kSpinsBeforeYield = 1 << 10;
+
+  const int threads_;
+  std::atomic<int> waiting_;
+  std::atomic<int> generation_;
+};
+
+// Runs @steps steps with a team of @threads threads. In every step each
+// thread t calls @parallel(step, t). When all of them are done the calling
+// thread calls @sequential(step) and then the next step starts. Threads are
+// created only once for all steps. The calling thread is thread 0. If any
+// call throws, the team stops after the step and the first exception by
+// thread id is rethrown in the calling thread.
+inline void runInLockstep(int threads, int steps,
+                          const std::function<void(int, int)>& parallel,
+                          const std::function<void(int)>& sequential) {
+  SpinBarrier barrier(threads);
+  std::vector<std::exception_ptr> errors(threads);
+  // Written only by thread 0 between the barriers of a step.
+  bool stop = false;
+  auto worker = [&](int thread) {
+    for (int step = 0; step < steps; step++) {
+      try {
+        parallel(step, thread);
+      } catch (...) {
+        errors[thread] = std::current_exception();
+      }
+      barrier.wait();
+      if (thread == 0) {
+        for (const std::exception_ptr& error : errors) stop = stop || error;
+        if (!stop) {
+          try {
+            sequential(step);
+          } catch (...) {
+            errors[0] = std::current_exception();
+            stop = true;
+          }
+        }
+      }
+      barrier.wait();
+      if (stop) return;
+    }
+  };
+  std::vector<std::thread> team;
+  for (int thread = 1; thread < threads; thread++) {
+    team.emplace_back(worker, thread);
+  }
+  worker(0);
+  for (std::thread& thread : team) thread.join();
+  for (const std::exception_ptr& error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+}
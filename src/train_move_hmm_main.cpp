@@ -25,12 +25,14 @@ DEFINE_int32(move_threshold, 2,
 
 DEFINE_int32(pseudocount, 1, "Pseudocount that will be used for training.");
 
+DEFINE_int32(k, 5,
+             "Length of kmers. It has to match the pore model of the reads "
+             "and it is stored with the trained model.");
+
 DEFINE_string(suffix_filename, "",
               "Suffix of the output filename. Resulting filename will be "
               "trained_move_hmm_FLAGS_suffix_filename.json");
 
-// Kmer size.
-const int k = 5;
 const int kInitialState = 0;
 
 using fast5::File;
@@ -67,6 +69,11 @@ int main(int argc, char** argv) {
         move_kmer.push_back({(int)event.move, event.model_state});
       }
 
+      if (!move_kmer.empty() && (int)move_kmer[0].kmer_.size() != FLAGS_k) {
+        LOG(ERROR) << "Kmers of " << file_path << " do not have length "
+                   << FLAGS_k << ".";
+        continue;
+      }
       transition_constructor.addRead(move_kmer);
     }
     catch (std::exception& e) {
@@ -76,7 +83,8 @@ int main(int argc, char** argv) {
 
   ::HMM<double> move_hmm(
       kInitialState,
-      transition_constructor.calculateTransitions(FLAGS_pseudocount, k));
+      transition_constructor.calculateTransitions(FLAGS_pseudocount, FLAGS_k));
+  move_hmm.setKmerLength(FLAGS_k);
 
   std::ofstream out("trained_move_hmm_" + FLAGS_suffix_filename + ".json");
   out << move_hmm.toJsonStr();
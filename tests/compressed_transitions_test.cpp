@@ -0,0 +1,51 @@
+#include <vector>
+
+#include "src/compressed_transitions.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+// Transitions grouped by the source state. State 2 has no transitions.
+const std::vector<int> kFrom = {0, 0, 0, 0, 1, 1, 1, 3, 3};
+const std::vector<double> kLog2Probs = {-5, -1, -5, -3, -2, -4, -2, -7, -6};
+
+TEST(CompressedTransitionsTest, DefaultsAndExceptionsTest) {
+  CompressedTransitions<double> compressed(4, kFrom, kLog2Probs);
+  EXPECT_EQ(4, compressed.numStates());
+  EXPECT_EQ(-5, compressed.defaultLog2Prob(0));
+  EXPECT_EQ(-2, compressed.defaultLog2Prob(1));
+  EXPECT_EQ(0, compressed.defaultLog2Prob(2));
+  // Tie is broken by the smaller probability.
+  EXPECT_EQ(-7, compressed.defaultLog2Prob(3));
+  // -3 and -1 from state 0, -4 from state 1 and -6 from state 3.
+  EXPECT_EQ(4, compressed.numExceptions());
+  EXPECT_EQ(8, compressed.valuesSize());
+
+  const int* value_idx = compressed.valueIdx();
+  EXPECT_EQ(std::vector<int>({0, 5, 0, 4, 1, 6, 1, 3, 7}),
+            std::vector<int>(value_idx, value_idx + kFrom.size()));
+}
+
+// Every transition has to read exactly prev[from] + log2_prob.
+TEST(CompressedTransitionsTest, ExpandRowTest) {
+  CompressedTransitions<double> compressed(4, kFrom, kLog2Probs);
+  const std::vector<double> prev = {0.5, -1.25, 3, -10.75};
+  std::vector<double> values(compressed.valuesSize());
+  compressed.expandRow(prev.data(), values.data());
+  for (int i = 0; i < (int)kFrom.size(); i++) {
+    EXPECT_EQ(prev[kFrom[i]] + kLog2Probs[i],
+              values[compressed.valueIdx()[i]]) << "Transition: " << i;
+  }
+
+  CompressedTransitions<float> float_compressed(
+      4, kFrom, std::vector<float>(kLog2Probs.begin(), kLog2Probs.end()));
+  EXPECT_EQ(4, float_compressed.numExceptions());
+}
+
+TEST(CompressedTransitionsTest, MemoryUsageTest) {
+  CompressedTransitions<double> compressed(4, kFrom, kLog2Probs);
+  EXPECT_EQ(9 * sizeof(int) + 4 * sizeof(double) +
+                4 * (sizeof(int) + sizeof(double)) + 8 * sizeof(double),
+            compressed.memoryUsage());
+  EXPECT_EQ(0, CompressedTransitions<double>().valuesSize());
+}
@@ -0,0 +1,42 @@
+#include <vector>
+#include <set>
+
+#include "src/counter_rng.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+TEST(CounterRngTest, SameStreamSameNumbersTest) {
+  CounterRng rng1(42, 7);
+  CounterRng rng2(42, 7);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(rng1.next(), rng2.next());
+  }
+}
+
+TEST(CounterRngTest, DifferentStreamsTest) {
+  // First numbers of different streams and seeds are all different.
+  std::set<uint64_t> numbers;
+  for (uint64_t seed = 0; seed < 10; seed++) {
+    for (uint64_t stream = 0; stream < 100; stream++) {
+      numbers.insert(CounterRng(seed, stream).next());
+    }
+  }
+  EXPECT_EQ(1000, numbers.size());
+}
+
+TEST(CounterRngTest, UniformTest) {
+  CounterRng rng(1, 2);
+  const int kNumbers = 100000;
+  const int kBuckets = 10;
+  std::vector<int> buckets(kBuckets);
+  for (int i = 0; i < kNumbers; i++) {
+    double uniform = rng.nextUniform();
+    ASSERT_LE(0, uniform);
+    ASSERT_GT(1, uniform);
+    buckets[(int)(uniform * kBuckets)]++;
+  }
+  for (int bucket : buckets) {
+    EXPECT_NEAR(kNumbers / kBuckets, bucket, 500);
+  }
+}
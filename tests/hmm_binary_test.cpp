@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "src/hmm.h"
+#include "src/hmm_binary.h"
+
+#include <json/reader.h>
+#include <json/value.h>
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+const std::vector<std::vector<Transition>> kTransitions = {
+    {{1, Log2Num(0.3)}, {2, Log2Num(0.7)}},
+    {{1, Log2Num(1.0 / 3)}, {2, Log2Num(2.0 / 3)}},
+    {},
+    {{1, Log2Num(0.1)}, {2, Log2Num(0.2)}, {3, Log2Num(0.7)}}};
+
+void expectSameTransitions(const std::vector<std::vector<Transition>>& expected,
+                           const std::vector<std::vector<Transition>>& res) {
+  ASSERT_EQ(expected.size(), res.size());
+  for (int state = 0; state < (int)expected.size(); state++) {
+    ASSERT_EQ(expected[state].size(), res[state].size());
+    for (int i = 0; i < (int)expected[state].size(); i++) {
+      EXPECT_EQ(expected[state][i].to_state_, res[state][i].to_state_);
+      // Probabilities have to be stored exactly.
+      EXPECT_EQ(expected[state][i].prob_.exponent(),
+                res[state][i].prob_.exponent());
+    }
+  }
+}
+
+TEST(HMMBinaryTest, RoundTripTest) {
+  ::HMM<double> hmm(3, kTransitions);
+  std::string binary = hmm.toBinaryStr();
+  EXPECT_TRUE(isBinaryModel(binary.data(), binary.size()));
+
+  BinaryModelView view(binary.data(), binary.size());
+  EXPECT_EQ(3, view.initialState());
+  EXPECT_EQ(4, view.numStates());
+  EXPECT_EQ(7, (int)view.numTransitions());
+
+  ::HMM<double> loaded(view);
+  EXPECT_EQ(3, loaded.initialState());
+  expectSameTransitions(kTransitions, loaded.transitions());
+  EXPECT_EQ(hmm.toJsonStr(), loaded.toJsonStr());
+  EXPECT_EQ(binary, loaded.toBinaryStr());
+
+  ::HMM<double, float> float_hmm(view);
+  expectSameTransitions(kTransitions, float_hmm.transitions());
+}
+
+TEST(HMMBinaryTest, KmerLengthTest) {
+  ::HMM<double> hmm(3, kTransitions);
+  std::string binary = hmm.toBinaryStr();
+  EXPECT_EQ(0, BinaryModelView(binary.data(), binary.size()).kmerLength());
+  // Generic models are serialized to JSON without the length of kmers.
+  EXPECT_EQ(std::string::npos, hmm.toJsonStr().find("kmer_length"));
+
+  hmm.setKmerLength(7);
+  binary = hmm.toBinaryStr();
+  BinaryModelView view(binary.data(), binary.size());
+  EXPECT_EQ(7, view.kmerLength());
+  EXPECT_EQ(7, ::HMM<double>(view).kmerLength());
+  ::HMM<double, float> float_hmm(view);
+  EXPECT_EQ(7, float_hmm.kmerLength());
+
+  Json::Value json;
+  ASSERT_TRUE(Json::Reader().parse(hmm.toJsonStr(), json));
+  EXPECT_EQ(7, ::HMM<double>(json).kmerLength());
+}
+
+TEST(HMMBinaryTest, NotBinaryModelTest) {
+  std::string json = ::HMM<double>(3, kTransitions).toJsonStr();
+  EXPECT_FALSE(isBinaryModel(json.data(), json.size()));
+  EXPECT_FALSE(isBinaryModel(json.data(), 0));
+  EXPECT_THROW(BinaryModelView(json.data(), json.size()),
+               std::invalid_argument);
+}
+
+TEST(HMMBinaryTest, CorruptedModelTest) {
+  std::string binary = ::HMM<double>(3, kTransitions).toBinaryStr();
+
+  // Any changed byte of transitions changes the checksum.
+  for (size_t i = sizeof(BinaryModelHeader); i < binary.size(); i++) {
+    std::string corrupted = binary;
+    corrupted[i] ^= 1;
+    EXPECT_THROW(BinaryModelView(corrupted.data(), corrupted.size()),
+                 std::invalid_argument) << "Byte: " << i;
+  }
+
+  std::string truncated = binary.substr(0, binary.size() - 1);
+  EXPECT_THROW(BinaryModelView(truncated.data(), truncated.size()),
+               std::invalid_argument);
+
+  std::string other_version = binary;
+  BinaryModelHeader header;
+  memcpy(&header, other_version.data(), sizeof(header));
+  header.version_ = kBinaryModelVersion + 1;
+  memcpy(&other_version[0], &header, sizeof(header));
+  EXPECT_THROW(BinaryModelView(other_version.data(), other_version.size()),
+               std::invalid_argument);
+}
+
+TEST(HMMBinaryTest, MappedFileTest) {
+  std::string binary = ::HMM<double>(3, kTransitions).toBinaryStr();
+  char path[] = "/tmp/hmm_binary_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  std::ofstream(path, std::ios::binary) << binary;
+
+  {
+    MappedFile file(path);
+    ASSERT_EQ(binary.size(), file.size());
+    BinaryModelView view(file.data(), file.size());
+    expectSameTransitions(kTransitions, ::HMM<double>(view).transitions());
+  }
+  unlink(path);
+
+  EXPECT_THROW(MappedFile(std::string(path)), std::runtime_error);
+}
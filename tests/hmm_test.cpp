@@ -2,6 +2,9 @@
 #include <stdexcept>
 #include <sstream>
 #include <fstream>
+#include <random>
+#include <numeric>
+#include <algorithm>
 
 #include <json/value.h>
 #include <json/reader.h>
@@ -63,6 +66,161 @@ TEST(GaussianStateTest, GaussianStateDeserializeParamsTest) {
   EXPECT_DOUBLE_EQ(1, state.sigma_);
 }
 
+// Density far from mu is too small for double but not for Log2Num.
+TEST(GaussianStateTest, GaussianStateFarEmissionTest) {
+  GaussianState state = GaussianState(0, 1);
+  Log2Num prob = state.prob(100);
+  EXPECT_FALSE(prob.isLogZero());
+  EXPECT_NEAR(-0.5 * log2(2 * M_PI) - 5000 * M_LOG2E, prob.exponent(), 1e-9);
+}
+
+// Gaussian state which is not stored as parameters by StateEmissions.
+class ShiftedGaussianState : public GaussianState {
+ public:
+  ShiftedGaussianState(double mu, double sigma) : GaussianState(mu, sigma) {}
+  Log2Num prob(const double& emission) const {
+    return GaussianState::prob(emission - 1);
+  }
+};
+
+TEST(StateEmissionsTest, ColumnMatchesStateProbTest) {
+  std::vector<std::unique_ptr<State<double>>> states;
+  states.emplace_back(new SilentState<double>());
+  states.emplace_back(new GaussianState(0.5, 1.5));
+  states.emplace_back(new ShiftedGaussianState(60, 2));
+  states.emplace_back(new SilentState<double>());
+  states.emplace_back(new GaussianState(70, 0.7));
+
+  StateEmissions<double> state_emissions(states);
+  EXPECT_EQ(5, state_emissions.size());
+  for (double emission : {0.7, 61.0, 69.5}) {
+    std::vector<Log2Num> column(states.size());
+    state_emissions.column(emission, &column);
+    for (int state_id = 0; state_id < (int)states.size(); state_id++) {
+      EXPECT_EQ(states[state_id]->isSilent(),
+                state_emissions.isSilent(state_id));
+      EXPECT_NEAR(states[state_id]->prob(emission).exponent(),
+                  column[state_id].exponent(), 1e-12);
+    }
+
+    std::vector<Log2Num> partial(states.size());
+    state_emissions.column(emission, {4, 2}, &partial);
+    EXPECT_TRUE(partial[1].isLogZero());
+    EXPECT_NEAR(column[2].exponent(), partial[2].exponent(), 1e-12);
+    EXPECT_NEAR(column[4].exponent(), partial[4].exponent(), 1e-12);
+  }
+}
+
+// Rows are computed only when a row of a new tile is requested.
+TEST(StateEmissionsTest, EmissionTableTest) {
+  std::vector<std::unique_ptr<State<double>>> states;
+  states.emplace_back(new SilentState<double>());
+  states.emplace_back(new GaussianState(50, 1.5));
+  states.emplace_back(new ShiftedGaussianState(60, 2));
+  std::vector<double> emissions = {49, 52, 58, 61, 63, 55, 47};
+  StateEmissions<double> state_emissions(states);
+
+  EmissionTable<double> table(emissions, states, 3);
+  EXPECT_EQ(7, table.rows());
+  EXPECT_EQ(3, table.tileRows());
+  for (int i = 0; i < (int)emissions.size(); i++) {
+    std::vector<Log2Num> column(states.size());
+    state_emissions.column(emissions[i], &column);
+    const Log2Num* row = table.row(i);
+    for (int state_id = 0; state_id < (int)states.size(); state_id++) {
+      EXPECT_EQ(column[state_id].exponent(), row[state_id].exponent());
+    }
+  }
+  EXPECT_EQ(3, table.computedTiles());
+  table.row(6);
+  EXPECT_EQ(3, table.computedTiles());
+  table.row(2);
+  EXPECT_EQ(4, table.computedTiles());
+
+  // The whole read fits into one tile.
+  EmissionTable<double> whole(emissions, states, 100);
+  EXPECT_EQ(7, whole.tileRows());
+  for (int i = 6; i >= 0; i--) whole.row(i);
+  EXPECT_EQ(1, whole.computedTiles());
+
+  EXPECT_THROW(EmissionTable<double>(emissions, states, 0),
+               std::invalid_argument);
+}
+
+TEST(StateEmissionsTest, TileRowsForBudgetTest) {
+  const size_t row_bytes = 1000 * sizeof(Log2Num);
+  EXPECT_EQ(4096,
+            EmissionTable<double>::tileRowsForBudget(1000, 4096, 1 << 30));
+  EXPECT_EQ(10,
+            EmissionTable<double>::tileRowsForBudget(1000, 4096,
+                                                     10 * row_bytes + 1));
+  // A tile has at least one row even if it does not fit.
+  EXPECT_EQ(1, EmissionTable<double>::tileRowsForBudget(1000, 4096, 1));
+  // Tiles of float tables fit more rows.
+  EXPECT_EQ(20,
+            (EmissionTable<double, float>::tileRowsForBudget(
+                1000, 4096, 10 * row_bytes)));
+}
+
+TEST(StateEmissionsTest, QuantizedEmissionTableTest) {
+  std::vector<std::unique_ptr<State<double>>> states;
+  states.emplace_back(new SilentState<double>());
+  states.emplace_back(new GaussianState(50, 1.5));
+  states.emplace_back(new GaussianState(57, 2.5));
+  states.emplace_back(new ShiftedGaussianState(60, 2));
+  std::vector<double> emissions = {49, 52.13, 58.7, 61.05, 63, 55.55, 47.2};
+  StateEmissions<double> state_emissions(states);
+
+  const double kBinWidth = 0.25;
+  EmissionTable<double> table(emissions, states, 3, kBinWidth);
+  // Points 47.2, 47.45, ... 63.2.
+  EXPECT_EQ(65, table.gridPoints());
+  double bound = kBinWidth * kBinWidth * log2(exp(1)) / (8 * 1.5 * 1.5);
+  EXPECT_NEAR(bound, table.maxLog2Error(), 1e-12);
+  for (int i = 0; i < (int)emissions.size(); i++) {
+    std::vector<Log2Num> column(states.size());
+    state_emissions.column(emissions[i], &column);
+    const Log2Num* row = table.row(i);
+    EXPECT_EQ(0, row[0].exponent());
+    for (int state_id = 1; state_id <= 2; state_id++) {
+      // Interpolation of a concave function is below it.
+      EXPECT_LE(row[state_id].exponent(), column[state_id].exponent() + 1e-9);
+      EXPECT_GE(row[state_id].exponent(),
+                column[state_id].exponent() - table.maxLog2Error());
+    }
+    // Not Gaussian state is exact.
+    EXPECT_EQ(column[3].exponent(), row[3].exponent());
+  }
+
+  EmissionTable<double> exact(emissions, states, 3);
+  EXPECT_EQ(0, exact.maxLog2Error());
+  EXPECT_THROW(EmissionTable<double>(emissions, states, 3, 0),
+               std::invalid_argument);
+}
+
+TEST(StateEmissionsTest, ActiveStatesTest) {
+  std::vector<std::unique_ptr<State<double>>> states;
+  states.emplace_back(new SilentState<double>());
+  states.emplace_back(new GaussianState(50, 1));
+  states.emplace_back(new GaussianState(56, 3));
+  states.emplace_back(new ShiftedGaussianState(70, 2));
+  states.emplace_back(new GaussianState(52, 0.5));
+  states.emplace_back(new SilentState<double>());
+  StateEmissions<double> state_emissions(states);
+
+  std::vector<int> res;
+  state_emissions.activeStates(50.8, 2, &res);
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), res);
+  state_emissions.activeStates(52.5, 2, &res);
+  EXPECT_EQ(std::vector<int>({2, 3, 4}), res);
+  EXPECT_FALSE(state_emissions.isActive(52.5, 1, 2));
+  EXPECT_TRUE(state_emissions.isActive(52.5, 1, 2.5));
+  EXPECT_FALSE(state_emissions.isActive(52.5, 0, 100));
+  // No Gaussian state is close enough.
+  state_emissions.activeStates(100, 2, &res);
+  EXPECT_EQ(std::vector<int>({1, 2, 3, 4}), res);
+}
+
 //////////////////////////////////////////////////////////////////
 
 TEST(SilentStateTest, SilentStateComparisonEqTest) {
@@ -185,22 +343,29 @@ TEST(HMMTest, ComputeViterbiMatrixTest) {
       {{0, -1}, {0, -1}, {0.00107520, 2}, {0.0032256, 2}, {0.0032256, 3}}};
 
   ::HMM<char>::ViterbiMatrix res_matrix =
-      hmm.computeViterbiMatrix(kEmissions, allocateStates());
+      hmm.computeViterbiMatrix(kEmissions, allocateStates(), ViterbiParams(),
+                               nullptr);
 
   // Check dimensions of result matrix.
-  EXPECT_EQ(expected_matrix.size(), res_matrix.size());
-  EXPECT_EQ(expected_matrix[0].size(), res_matrix[0].size());
+  EXPECT_EQ(expected_matrix.size(), res_matrix.backpointers_.rows());
+  EXPECT_EQ(expected_matrix[0].size(), res_matrix.backpointers_.cols());
+  ASSERT_EQ(expected_matrix.back().size(), res_matrix.last_row_.size());
 
-  // Check that matrices are equal.
+  // Check that previous states are equal.
   for (int i = 0; i < (int)expected_matrix.size(); ++i) {
     for (int j = 0; j < (int)expected_matrix[0].size(); ++j) {
-      EXPECT_NEAR(expected_matrix[i][j].first,
-                  res_matrix[i][j].first.value(), kDoubleTolerance)
-          << "Probability in matrix differs at (" << i << ", " << j << ").";
-      EXPECT_EQ(expected_matrix[i][j].second, res_matrix[i][j].second)
+      EXPECT_EQ(expected_matrix[i][j].second,
+                hmm.previousState(res_matrix.backpointers_, i, j))
           << "Previous state in matrix differs at (" << i << ", " << j << ").";
     }
   }
+
+  // Only the last row of probabilities is kept.
+  for (int j = 0; j < (int)expected_matrix.back().size(); ++j) {
+    EXPECT_NEAR(expected_matrix.back()[j].first,
+                res_matrix.last_row_[j].value(), kDoubleTolerance)
+        << "Probability in the last row differs at " << j << ".";
+  }
 }
 
 TEST(HMMTest, RunViterbiReturnStateIdsTest) {
@@ -212,6 +377,442 @@ TEST(HMMTest, RunViterbiReturnStateIdsTest) {
   EXPECT_EQ(expected_states, states);
 }
 
+TEST(HMMTest, ComputeBeamViterbiMatrixNoPruningTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  ViterbiParams params;
+  params.beam_log2_margin_ = 1000;
+
+  ::HMM<char>::ViterbiMatrix expected_matrix =
+      hmm.computeViterbiMatrix(kEmissions, allocateStates(), ViterbiParams(),
+                               nullptr);
+  ::HMM<char>::ViterbiMatrix res_matrix =
+      hmm.computeViterbiMatrix(kEmissions, allocateStates(), params, nullptr);
+
+  ASSERT_EQ(expected_matrix.backpointers_.rows(),
+            res_matrix.backpointers_.rows());
+  for (int i = 0; i < expected_matrix.backpointers_.rows(); ++i) {
+    for (int j = 0; j < expected_matrix.backpointers_.cols(); ++j) {
+      EXPECT_EQ(expected_matrix.backpointers_.get(i, j),
+                res_matrix.backpointers_.get(i, j))
+          << "Previous state in matrix differs at (" << i << ", " << j << ").";
+    }
+  }
+  EXPECT_EQ(expected_matrix.last_row_, res_matrix.last_row_);
+}
+
+TEST(HMMTest, RunBeamViterbiReturnStateIdsTest) {
+  HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  ViterbiParams params;
+  params.beam_max_states_ = 1;
+
+  std::vector<int> states =
+      hmm.runViterbiReturnStateIds(kEmissions, allocateStates(), params);
+  std::vector<int> expected_states = {0, 1, 2, 2, 3};
+  EXPECT_EQ(expected_states, states);
+}
+
+// Random HMM with Gaussian emissions. State 0 is the initial state and it has
+// transition to every other state. Every other state has @out_degree
+// transitions. If @silent_period > 0 then every state with id divisible by
+// @silent_period is silent.
+std::vector<std::vector<Transition>> randomTransitions(int num_states,
+                                                       int out_degree,
+                                                       int silent_period,
+                                                       std::mt19937* gen) {
+  std::vector<std::vector<Transition>> res(num_states);
+  for (int to = 1; to < num_states; to++) {
+    res[kInitialState].push_back({to, Log2Num(1 / (double)(num_states - 1))});
+  }
+  std::uniform_int_distribution<int> next_state(1, num_states - 1);
+  std::uniform_real_distribution<double> weight(0.1, 1);
+  for (int from = 1; from < num_states; from++) {
+    std::vector<int> to_states;
+    while ((int)to_states.size() < out_degree) {
+      int to = next_state(*gen);
+      // Transition to silent state has to go to state with greater id.
+      if (silent_period > 0 && to % silent_period == 0 && to <= from) continue;
+      if (std::find(to_states.begin(), to_states.end(), to) ==
+          to_states.end()) {
+        to_states.push_back(to);
+      }
+    }
+    std::vector<double> weights;
+    for (int i = 0; i < out_degree; i++) weights.push_back(weight(*gen));
+    double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+    for (int i = 0; i < out_degree; i++) {
+      res[from].push_back({to_states[i], Log2Num(weights[i] / sum)});
+    }
+  }
+  return res;
+}
+
+std::vector<std::unique_ptr<State<double>>> randomGaussianStates(
+    int num_states, int silent_period, std::mt19937* gen) {
+  std::uniform_real_distribution<double> mu(40, 80);
+  std::uniform_real_distribution<double> sigma(1, 3);
+  std::vector<std::unique_ptr<State<double>>> res;
+  res.emplace_back(new SilentState<double>());
+  for (int state = 1; state < num_states; state++) {
+    if (silent_period > 0 && state % silent_period == 0) {
+      res.emplace_back(new SilentState<double>());
+    } else {
+      res.emplace_back(new GaussianState(mu(*gen), sigma(*gen)));
+    }
+  }
+  return res;
+}
+
+std::vector<double> randomEmissions(int length, std::mt19937* gen) {
+  std::uniform_real_distribution<double> level(40, 80);
+  std::vector<double> res;
+  for (int i = 0; i < length; i++) res.push_back(level(*gen));
+  return res;
+}
+
+// log2 of probability that the path of states emits @emissions computed with
+// doubles.
+double pathLog2Prob(const std::vector<std::vector<Transition>>& transitions,
+                    const std::vector<std::unique_ptr<State<double>>>& states,
+                    const std::vector<double>& emissions,
+                    const std::vector<int>& path) {
+  double res = 0;
+  int emission = 0;
+  for (int i = 1; i < (int)path.size(); i++) {
+    double log2_transition = -HUGE_VAL;
+    for (const Transition& transition : transitions[path[i - 1]]) {
+      if (transition.to_state_ == path[i]) {
+        log2_transition = transition.prob_.exponent();
+      }
+    }
+    res += log2_transition;
+    if (!states[path[i]]->isSilent()) {
+      res += states[path[i]]->prob(emissions[emission++]).exponent();
+    }
+  }
+  return res;
+}
+
+// Reads of a batch have different lengths and their own emission parameters.
+struct RandomBatch {
+  std::vector<std::vector<double>> emissions_;
+  std::vector<std::vector<std::unique_ptr<State<double>>>> states_;
+};
+
+// Tests on a random model which every test builds by init().
+class RandomHMMTest : public ::testing::Test {
+ protected:
+  // Model of @num_states states from randomTransitions and
+  // randomGaussianStates and a read of @length random emissions. All of them
+  // are generated from @seed.
+  void init(int seed, int num_states, int out_degree, int silent_period,
+            int length) {
+    gen_.seed(seed);
+    num_states_ = num_states;
+    silent_period_ = silent_period;
+    transitions_ =
+        randomTransitions(num_states, out_degree, silent_period, &gen_);
+    hmm_.reset(new ::HMM<double>(kInitialState, transitions_));
+    states_ = randomGaussianStates(num_states, silent_period, &gen_);
+    emissions_ = randomEmissions(length, &gen_);
+  }
+
+  // States of another read with the same silent states.
+  std::vector<std::unique_ptr<State<double>>> otherStates() {
+    return randomGaussianStates(num_states_, silent_period_, &gen_);
+  }
+
+  RandomBatch randomBatch() {
+    RandomBatch res;
+    for (int length : {30, 0, 7, 120, 1, 30, 64, 65, 2, 99, 13}) {
+      res.emissions_.push_back(randomEmissions(length, &gen_));
+      res.states_.push_back(otherStates());
+    }
+    return res;
+  }
+
+  // Ids of all non-silent states.
+  std::vector<int> nonSilentStates() const {
+    std::vector<int> res;
+    for (int state = 0; state < num_states_; state++) {
+      if (!states_[state]->isSilent()) res.push_back(state);
+    }
+    return res;
+  }
+
+  std::mt19937 gen_;
+  int num_states_;
+  int silent_period_;
+  std::vector<std::vector<Transition>> transitions_;
+  std::unique_ptr<HMM<double>> hmm_;
+  std::vector<std::unique_ptr<State<double>>> states_;
+  std::vector<double> emissions_;
+};
+
+TEST_F(RandomHMMTest, BeamViterbiWideBeamIsExactTest) {
+  init(47, 60, 8, 0, 300);
+
+  ViterbiParams params;
+  params.beam_log2_margin_ = 200;
+  EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_),
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+}
+
+// At most beam_max_states_ states survive in every column so the path is at
+// most as probable as the optimal one. Beam of all states is exact.
+TEST_F(RandomHMMTest, BeamViterbiMaxStatesTest) {
+  init(47, 60, 8, 0, 300);
+  double log2_prob =
+      pathLog2Prob(transitions_, states_, emissions_,
+                   hmm_->runViterbiReturnStateIds(emissions_, states_));
+
+  ViterbiParams params;
+  params.beam_max_states_ = 5;
+  std::vector<Log2Num> row(num_states_, Log2Num(0.0));
+  row[kInitialState] = Log2Num(1.0);
+  std::vector<std::vector<Log2Num>> columns;
+  hmm_->viterbiSweep(emissions_, states_, params, 0, emissions_.size(), &row,
+                     nullptr, &columns, 1, nullptr);
+  ASSERT_EQ(emissions_.size(), columns.size());
+  for (int i = 0; i < (int)columns.size(); i++) {
+    EXPECT_GE(5, std::count_if(columns[i].begin(), columns[i].end(),
+                               [](const Log2Num& prob) {
+                                 return !prob.isLogZero();
+                               }))
+        << "Column: " << i + 1;
+  }
+
+  std::vector<int> res =
+      hmm_->runViterbiReturnStateIds(emissions_, states_, params);
+  ASSERT_EQ(emissions_.size() + 1, res.size());
+  EXPECT_EQ(kInitialState, res[0]);
+  double beam_log2_prob = pathLog2Prob(transitions_, states_, emissions_, res);
+  EXPECT_GT(beam_log2_prob, -HUGE_VAL);
+  EXPECT_LE(beam_log2_prob, log2_prob);
+
+  params.beam_max_states_ = num_states_;
+  EXPECT_DOUBLE_EQ(
+      log2_prob,
+      pathLog2Prob(transitions_, states_, emissions_,
+                   hmm_->runViterbiReturnStateIds(emissions_, states_,
+                                                  params)));
+}
+
+TEST_F(RandomHMMTest, EmissionGatingTest) {
+  init(53, 60, 8, 7, 200);
+  EmissionTable<double> table(emissions_, states_, 64);
+
+  // All states are active so the results are exact.
+  ViterbiParams wide_params;
+  wide_params.emission_gate_sigmas_ = 1e6;
+  EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_),
+            hmm_->runViterbiReturnStateIds(emissions_, states_, wide_params));
+  wide_params.checkpointing_ = true;
+  wide_params.beam_max_states_ = 10;
+  ViterbiParams beam_params;
+  beam_params.beam_max_states_ = 10;
+  EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_, beam_params),
+            hmm_->runViterbiReturnStateIds(emissions_, states_, wide_params));
+  SamplingParams wide_sampling;
+  wide_sampling.emission_gate_sigmas_ = 1e6;
+  EXPECT_EQ(hmm_->posteriorProbSample(5, 3, emissions_, states_),
+            hmm_->posteriorProbSample(5, 3, emissions_, states_, wide_sampling,
+                                      &table));
+  ViterbiParams gated_params;
+  gated_params.emission_gate_sigmas_ = 1e6;
+  EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_),
+            hmm_->runViterbiReturnStateIds(emissions_, states_, gated_params,
+                                           &table));
+  // Gated columns compute only emissions of active states, not rows of the
+  // table.
+  EXPECT_EQ(0, table.computedTiles());
+
+  // Narrow gate still gives paths through all emissions.
+  auto emittingStates = [this](const std::vector<int>& path) {
+    int res = 0;
+    for (int state : path) res += !states_[state]->isSilent();
+    return res;
+  };
+  ViterbiParams params;
+  params.emission_gate_sigmas_ = 1;
+  std::vector<int> path =
+      hmm_->runViterbiReturnStateIds(emissions_, states_, params, &table);
+  EXPECT_EQ(path, hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+  EXPECT_EQ((int)emissions_.size(), emittingStates(path));
+  EXPECT_EQ(kInitialState, path[0]);
+  SamplingParams sampling;
+  sampling.emission_gate_sigmas_ = 1;
+  for (const std::vector<int>& sample :
+       hmm_->posteriorProbSample(5, 3, emissions_, states_, sampling)) {
+    EXPECT_EQ((int)emissions_.size(), emittingStates(sample));
+    EXPECT_EQ(kInitialState, sample[0]);
+  }
+
+  params.threads_ = 2;
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, states_, params),
+               std::invalid_argument);
+  sampling.forward_threads_ = 2;
+  EXPECT_THROW(hmm_->posteriorProbSample(5, 3, emissions_, states_, sampling),
+               std::invalid_argument);
+}
+
+TEST_F(RandomHMMTest, BandedDecodingTest) {
+  init(59, 50, 8, 6, 150);
+  std::vector<int> expected =
+      hmm_->runViterbiReturnStateIds(emissions_, states_);
+
+  // Band containing all states gives exact results.
+  StateBand full;
+  std::vector<int> non_silent = nonSilentStates();
+  full.states_.assign(emissions_.size(), non_silent);
+  ViterbiParams params;
+  params.band_ = &full;
+  EXPECT_EQ(expected,
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+  SamplingParams sampling;
+  sampling.band_ = &full;
+  EXPECT_EQ(hmm_->posteriorProbSample(4, 5, emissions_, states_),
+            hmm_->posteriorProbSample(4, 5, emissions_, states_, sampling));
+
+  auto emittingStates = [this](const std::vector<int>& path) {
+    std::vector<int> res;
+    for (int state : path) {
+      if (!states_[state]->isSilent()) res.push_back(state);
+    }
+    return res;
+  };
+
+  // Band of the Viterbi path contains the best path. Samples can differ only
+  // in silent states.
+  std::vector<int> expected_emitting = emittingStates(expected);
+  StateBand path_band;
+  for (int state : expected_emitting) {
+    path_band.states_.push_back({state});
+  }
+  ASSERT_EQ(emissions_.size(), path_band.states_.size());
+  params.band_ = &path_band;
+  params.checkpointing_ = true;
+  EXPECT_EQ(expected,
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+  sampling.band_ = &path_band;
+  for (const std::vector<int>& sample :
+       hmm_->posteriorProbSample(4, 5, emissions_, states_, sampling)) {
+    EXPECT_EQ(emittingStates(expected), emittingStates(sample));
+  }
+
+  // Columns alternate between the band of the path and all states so cells
+  // of full columns have to be reset in the following banded ones. Float rows
+  // are rescaled only in the computed states.
+  StateBand alternating = path_band;
+  for (int i = 0; i < (int)emissions_.size(); i += 2) {
+    alternating.states_[i] = non_silent;
+  }
+  params.band_ = &alternating;
+  EXPECT_EQ(expected,
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+  ::HMM<double, float> float_hmm(kInitialState, hmm_->transitions());
+  ASSERT_EQ(expected, float_hmm.runViterbiReturnStateIds(emissions_, states_));
+  EXPECT_EQ(expected,
+            float_hmm.runViterbiReturnStateIds(emissions_, states_, params));
+  sampling.band_ = &alternating;
+  for (const std::vector<int>& sample :
+       float_hmm.posteriorProbSample(4, 5, emissions_, states_, sampling)) {
+    std::vector<int> emitting = emittingStates(sample);
+    ASSERT_EQ(emissions_.size(), emitting.size());
+    for (int i = 1; i < (int)emissions_.size(); i += 2) {
+      EXPECT_EQ(expected_emitting[i], emitting[i]) << "Emission: " << i;
+    }
+  }
+
+  // Band which cannot be reached is expanded to all states.
+  StateBand unreachable;
+  unreachable.states_.assign(emissions_.size(), {1});
+  unreachable.states_[0] = {2};
+  params.band_ = &unreachable;
+  params.checkpointing_ = false;
+  EXPECT_EQ(emissions_.size(),
+            emittingStates(hmm_->runViterbiReturnStateIds(emissions_, states_,
+                                                          params)).size());
+  // Band of one state everywhere collapses if the drop is small.
+  StateBand collapsing = unreachable;
+  collapsing.expand_log2_drop_ = 0;
+  params.band_ = &collapsing;
+  EXPECT_EQ(expected,
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+
+  params.beam_max_states_ = 5;
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, states_, params),
+               std::invalid_argument);
+  StateBand short_band;
+  short_band.states_.assign(10, non_silent);
+  sampling.band_ = &short_band;
+  EXPECT_THROW(hmm_->posteriorProbSample(4, 5, emissions_, states_, sampling),
+               std::invalid_argument);
+}
+
+TEST(HMMTest, CheckpointedViterbiTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  ViterbiParams params;
+  params.checkpointing_ = true;
+
+  std::vector<int> expected_states = {0, 1, 2, 2, 3};
+  EXPECT_EQ(expected_states,
+            hmm.runViterbiReturnStateIds(kEmissions, allocateStates(), params));
+}
+
+// Checkpointing has to give exactly the same path as the full matrix. Silent
+// states are placed everywhere so that they appear also on the boundaries of
+// segments.
+TEST_F(RandomHMMTest, CheckpointedViterbiSilentStatesTest) {
+  init(13, 50, 6, 5, 0);
+
+  for (int length : {0, 1, 2, 17, 100, 101}) {
+    emissions_ = randomEmissions(length, &gen_);
+    ViterbiParams params;
+    params.checkpointing_ = true;
+    EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_),
+              hmm_->runViterbiReturnStateIds(emissions_, states_, params))
+        << "Length: " << length;
+  }
+}
+
+TEST_F(RandomHMMTest, CheckpointedBeamViterbiTest) {
+  init(5, 60, 8, 0, 250);
+
+  ViterbiParams params;
+  params.beam_log2_margin_ = 10;
+  params.beam_max_states_ = 7;
+  std::vector<int> expected =
+      hmm_->runViterbiReturnStateIds(emissions_, states_, params);
+  params.checkpointing_ = true;
+  EXPECT_EQ(expected,
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+}
+
+// Path does not depend on number of threads even if there are more threads
+// than words of backpointers in a row.
+TEST_F(RandomHMMTest, MultithreadedViterbiTest) {
+  init(29, 70, 7, 6, 200);
+
+  std::vector<int> expected =
+      hmm_->runViterbiReturnStateIds(emissions_, states_);
+  for (bool checkpointing : {false, true}) {
+    for (int threads : {2, 3, 8}) {
+      ViterbiParams params;
+      params.checkpointing_ = checkpointing;
+      params.threads_ = threads;
+      EXPECT_EQ(expected,
+                hmm_->runViterbiReturnStateIds(emissions_, states_, params))
+          << "Threads: " << threads << " checkpointing: " << checkpointing;
+    }
+  }
+
+  ViterbiParams params;
+  params.threads_ = 2;
+  params.beam_max_states_ = 10;
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, states_, params),
+               std::invalid_argument);
+}
+
 // When initial state is not silent exception has to be thrown.
 TEST(HMMTest, InitialStateSilentTest) {
   ::HMM<char> hmm = ::HMM<char>(kInitialState, {});
@@ -248,6 +849,126 @@ TEST(HMMTest, LoopInSilentTransitionsTest) {
                std::invalid_argument);
   EXPECT_THROW(hmm.posteriorProbSample(2, 0, kEmissions, states),
                std::invalid_argument);
+  EXPECT_THROW(hmm.compile(states), std::invalid_argument);
+  EXPECT_FALSE(hmm.isCompiled());
+}
+
+// Compiled HMM gives the same results and accepts only states with the
+// compiled silent states.
+TEST_F(RandomHMMTest, CompiledHMMTest) {
+  init(37, 30, 5, 4, 100);
+  ::HMM<double> reference = *hmm_;
+
+  hmm_->compile(states_);
+  ASSERT_TRUE(hmm_->isCompiled());
+  EXPECT_EQ(reference.runViterbiReturnStateIds(emissions_, states_),
+            hmm_->runViterbiReturnStateIds(emissions_, states_));
+  EXPECT_EQ(reference.posteriorProbSample(5, 1, emissions_, states_),
+            hmm_->posteriorProbSample(5, 1, emissions_, states_));
+  ViterbiParams params;
+  params.threads_ = 3;
+  EXPECT_EQ(reference.runViterbiReturnStateIds(emissions_, states_),
+            hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+
+  std::vector<std::unique_ptr<State<double>>> other_states = otherStates();
+  EXPECT_EQ(reference.runViterbiReturnStateIds(emissions_, other_states),
+            hmm_->runViterbiReturnStateIds(emissions_, other_states));
+
+  std::vector<std::unique_ptr<State<double>>> no_silent_states =
+      randomGaussianStates(num_states_, 0, &gen_);
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, no_silent_states),
+               std::invalid_argument);
+  std::vector<std::unique_ptr<State<double>>> fewer_states =
+      randomGaussianStates(num_states_ - 1, silent_period_, &gen_);
+  EXPECT_THROW(hmm_->posteriorProbSample(1, 0, emissions_, fewer_states),
+               std::invalid_argument);
+}
+
+// Algorithms give the same results with emission table of any tile size as
+// without it. The whole read in one tile is computed only once.
+TEST_F(RandomHMMTest, EmissionTableDecodingTest) {
+  init(41, 40, 6, 5, 120);
+
+  std::vector<ViterbiParams> viterbi_params(4);
+  viterbi_params[1].checkpointing_ = true;
+  viterbi_params[2].beam_max_states_ = 8;
+  viterbi_params[3].threads_ = 3;
+  std::vector<SamplingParams> sampling_params(3);
+  sampling_params[1].scaled_forward_ = true;
+  sampling_params[2].forward_threads_ = 2;
+
+  for (int tile_rows : {1, 7, 120}) {
+    EmissionTable<double> table(emissions_, states_, tile_rows);
+    for (const ViterbiParams& params : viterbi_params) {
+      EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_, params),
+                hmm_->runViterbiReturnStateIds(emissions_, states_, params,
+                                               &table))
+          << "Tile rows: " << tile_rows;
+    }
+    for (const SamplingParams& params : sampling_params) {
+      EXPECT_EQ(hmm_->posteriorProbSample(4, 7, emissions_, states_, params),
+                hmm_->posteriorProbSample(4, 7, emissions_, states_, params,
+                                          &table))
+          << "Tile rows: " << tile_rows;
+    }
+    PosteriorDecoding expected = hmm_->posteriorDecoding(emissions_, states_);
+    PosteriorDecoding res =
+        hmm_->posteriorDecoding(emissions_, states_, &table);
+    EXPECT_EQ(expected.state_ids_, res.state_ids_);
+    EXPECT_EQ(expected.posteriors_, res.posteriors_);
+    if (tile_rows == 120) {
+      EXPECT_EQ(1, table.computedTiles());
+    }
+  }
+
+  ::HMM<double, float> float_hmm(kInitialState, hmm_->transitions());
+  EmissionTable<double, float> float_table(emissions_, states_, 50);
+  EXPECT_EQ(float_hmm.runViterbiReturnStateIds(emissions_, states_),
+            float_hmm.runViterbiReturnStateIds(emissions_, states_,
+                                               ViterbiParams(), &float_table));
+
+  std::vector<double> other_emissions = randomEmissions(10, &gen_);
+  EmissionTable<double> other_table(other_emissions, states_, 10);
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, states_,
+                                              ViterbiParams(), &other_table),
+               std::invalid_argument);
+}
+
+TEST_F(RandomHMMTest, ViterbiAndSampleTest) {
+  init(43, 40, 6, 5, 150);
+  EmissionTable<double> table(emissions_, states_, 16);
+
+  for (int threads : {1, 3}) {
+    SamplingParams params;
+    params.forward_threads_ = threads;
+    std::vector<int> expected_path =
+        hmm_->runViterbiReturnStateIds(emissions_, states_);
+    std::vector<std::vector<int>> expected_samples =
+        hmm_->posteriorProbSample(5, 11, emissions_, states_, params);
+
+    ViterbiAndSamples res =
+        hmm_->runViterbiAndSample(5, 11, emissions_, states_, params);
+    EXPECT_EQ(expected_path, res.viterbi_state_ids_) << "Threads: " << threads;
+    EXPECT_EQ(expected_samples, res.samples_) << "Threads: " << threads;
+
+    res = hmm_->runViterbiAndSample(5, 11, emissions_, states_, params, &table);
+    EXPECT_EQ(expected_path, res.viterbi_state_ids_) << "Threads: " << threads;
+    EXPECT_EQ(expected_samples, res.samples_) << "Threads: " << threads;
+  }
+
+  ::HMM<double, float> float_hmm(kInitialState, hmm_->transitions());
+  ViterbiAndSamples float_res = float_hmm.runViterbiAndSample(
+      5, 11, emissions_, states_, SamplingParams());
+  EXPECT_EQ(float_hmm.runViterbiReturnStateIds(emissions_, states_),
+            float_res.viterbi_state_ids_);
+  EXPECT_EQ(float_hmm.posteriorProbSample(5, 11, emissions_, states_),
+            float_res.samples_);
+
+  SamplingParams scaled_params;
+  scaled_params.scaled_forward_ = true;
+  EXPECT_THROW(
+      hmm_->runViterbiAndSample(5, 11, emissions_, states_, scaled_params),
+      std::invalid_argument);
 }
 
 TEST(HMMTest, ForwardTrackingTest) {
@@ -262,30 +983,105 @@ TEST(HMMTest, ForwardTrackingTest) {
   ** {{}, {0}, {0, 0.0010752}, {0, 0.0032256}, {0.00032256, 0.0032256}}};
   */
 
-  ::HMM<char>::ForwardMatrix expected_matrix = {
-      {{}, {}, {}, {}, {}},
-      {{}, {1}, {}, {}, {}},
-      {{}, {}, {1, 0}, {1, 0}, {0.7368421052631578, 0.2631578947368421}},
-      {{}, {}, {0, 1}, {0, 1}, {0.6153846153846153, 0.3846153846153846}},
-      {{}, {}, {0, 1}, {0, 1}, {0.0909090909090909, 0.9090909090909090}}};
+  // Weights are cumulative and there is one weight for every transition
+  // going to the state.
+  std::vector<std::vector<std::vector<double>>> expected_matrix = {
+      {{}, {0}, {0, 0}, {0, 0}, {0, 0}},
+      {{}, {1}, {0, 0}, {0, 0}, {0, 0}},
+      {{}, {0}, {1, 1}, {1, 1}, {0.7368421052631578, 1}},
+      {{}, {0}, {0, 1}, {0, 1}, {0.6153846153846153, 1}},
+      {{}, {0}, {0, 1}, {0, 1}, {0.0909090909090909, 1}}};
 
   HMM<char>::ForwardMatrix res_matrix =
       hmm.forwardTracking(kEmissions, allocateStates());
 
-  EXPECT_EQ(expected_matrix.size(), res_matrix.size());
-  EXPECT_EQ(expected_matrix[0].size(), res_matrix[0].size());
+  EXPECT_EQ(expected_matrix.size(), res_matrix.rows_);
+  EXPECT_EQ(expected_matrix[0].size() + 1, res_matrix.inv_offsets_.size());
   for (int i = 0; i < (int)expected_matrix.size(); i++) {
     for (int j = 0; j < (int)expected_matrix[i].size(); j++) {
-      EXPECT_EQ(expected_matrix[i][j].size(), res_matrix[i][j].size());
+      EXPECT_EQ(expected_matrix[i][j].size(), hmm.inv_transitions_[j].size());
+      const double* weights = res_matrix.cumulativeWeights(i, j);
       for (int k = 0; k < (int)expected_matrix[i][j].size(); k++) {
-        EXPECT_NEAR(res_matrix[i][j][k],
-                    expected_matrix[i][j][k], kDoubleTolerance)
+        EXPECT_NEAR(expected_matrix[i][j][k], weights[k], kDoubleTolerance)
             << "Matrices differ at (" << i << ", " << j << ", " << k << ").";
       }
     }
   }
 }
 
+// Scaled linear space computation gives the same weights as log space.
+TEST_F(RandomHMMTest, ForwardTrackingScaledTest) {
+  init(23, 40, 5, 4, 300);
+
+  HMM<double>::ForwardMatrix expected =
+      hmm_->forwardTracking(emissions_, states_);
+  HMM<double>::ForwardMatrix scaled =
+      hmm_->forwardTrackingScaled(emissions_, states_, nullptr);
+  ASSERT_EQ(expected.rows_, scaled.rows_);
+  ASSERT_EQ(expected.weights_.size(), scaled.weights_.size());
+  for (int i = 0; i < (int)expected.weights_.size(); i++) {
+    EXPECT_NEAR(expected.weights_[i], scaled.weights_[i], 1e-9)
+        << "Weights differ at " << i;
+  }
+  for (int state = 0; state < num_states_; state++) {
+    EXPECT_NEAR(expected.last_state_weights_[state],
+                scaled.last_state_weights_[state], 1e-9);
+  }
+}
+
+// Every state is computed in the same way by any number of threads.
+TEST_F(RandomHMMTest, ForwardTrackingThreadsTest) {
+  init(31, 40, 5, 4, 150);
+
+  HMM<double>::ForwardMatrix expected =
+      hmm_->forwardTracking(emissions_, states_);
+  for (int threads : {2, 3, 5}) {
+    HMM<double>::ForwardMatrix res =
+        hmm_->forwardTracking(emissions_, states_, threads, nullptr);
+    EXPECT_EQ(expected.rows_, res.rows_);
+    EXPECT_EQ(expected.weights_, res.weights_) << "Threads: " << threads;
+    EXPECT_EQ(expected.last_state_weights_, res.last_state_weights_)
+        << "Threads: " << threads;
+  }
+}
+
+// Band of all states gives the same weights as the dense matrix. Narrower
+// band stores only weights of its states.
+TEST_F(RandomHMMTest, ForwardTrackingSparseTest) {
+  init(37, 40, 5, 4, 100);
+
+  StateBand full;
+  std::vector<int> non_silent = nonSilentStates();
+  full.states_.assign(emissions_.size(), non_silent);
+  HMM<double>::ForwardMatrix expected =
+      hmm_->forwardTracking(emissions_, states_);
+  HMM<double>::ForwardMatrix sparse =
+      hmm_->forwardTrackingSparse(emissions_, states_, 0, &full, nullptr);
+  ASSERT_EQ(expected.rows_, sparse.rows_);
+  EXPECT_EQ(expected.weights_.size() - hmm_->inv_offsets_.back(),
+            sparse.weights_.size());
+  for (int row = 1; row < expected.rows_; row++) {
+    for (int state = 0; state < num_states_; state++) {
+      const double* expected_weights = expected.cumulativeWeights(row, state);
+      const double* weights = sparse.cumulativeWeights(row, state);
+      for (int idx = 0; idx < (int)hmm_->inv_transitions_[state].size();
+           idx++) {
+        EXPECT_EQ(expected_weights[idx], weights[idx])
+            << "Row: " << row << " state: " << state;
+      }
+    }
+  }
+  EXPECT_EQ(expected.last_state_weights_, sparse.last_state_weights_);
+
+  StateBand narrow;
+  narrow.states_.assign(emissions_.size(),
+                        std::vector<int>(non_silent.begin(),
+                                         non_silent.begin() + 5));
+  sparse =
+      hmm_->forwardTrackingSparse(emissions_, states_, 0, &narrow, nullptr);
+  EXPECT_LT(sparse.weights_.size(), expected.weights_.size() / 2);
+}
+
 TEST(HMMTest, PosteriorProbSampleTest) {
   ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
 
@@ -296,6 +1092,456 @@ TEST(HMMTest, PosteriorProbSampleTest) {
   EXPECT_THAT(samples[1][0], 0);
 }
 
+// Every sample has to be a path in the HMM emitting all emissions.
+TEST_F(RandomHMMTest, PosteriorProbSampleValidPathsTest) {
+  init(11, 30, 5, 0, 100);
+
+  std::vector<std::vector<int>> samples =
+      hmm_->posteriorProbSample(20, 7, emissions_, states_);
+  ASSERT_EQ(20, samples.size());
+  for (const std::vector<int>& sample : samples) {
+    ASSERT_EQ(emissions_.size() + 1, sample.size());
+    EXPECT_EQ(kInitialState, sample[0]);
+    for (int i = 1; i < (int)sample.size(); i++) {
+      const std::vector<Transition>& from = transitions_[sample[i - 1]];
+      EXPECT_TRUE(std::any_of(from.begin(), from.end(),
+                              [&](const Transition& transition) {
+                    return transition.to_state_ == sample[i];
+                  }))
+          << "No transition " << sample[i - 1] << " -> " << sample[i];
+    }
+  }
+}
+
+// Samples have to be the same regardless of number of threads.
+TEST_F(RandomHMMTest, PosteriorProbSampleThreadsTest) {
+  init(11, 30, 5, 0, 100);
+
+  std::vector<std::vector<int>> expected =
+      hmm_->posteriorProbSample(50, 7, emissions_, states_);
+  for (int threads : {1, 2, 5}) {
+    SamplingParams params;
+    params.threads_ = threads;
+    EXPECT_EQ(expected, hmm_->posteriorProbSample(50, 7, emissions_, states_,
+                                                  params))
+        << "Threads: " << threads;
+  }
+
+  // Different seed gives different samples.
+  EXPECT_NE(expected, hmm_->posteriorProbSample(50, 8, emissions_, states_));
+
+  for (int threads : {0, -1}) {
+    SamplingParams params;
+    params.threads_ = threads;
+    params.batched_traceback_ = true;
+    EXPECT_THROW(hmm_->posteriorProbSample(50, 7, emissions_, states_, params),
+                 std::invalid_argument) << "Threads: " << threads;
+  }
+}
+
+// Batched traceback has to give the same samples as backtracking of samples
+// one by one. Silent states are included.
+TEST_F(RandomHMMTest, PosteriorProbSampleBatchedTest) {
+  init(17, 40, 5, 4, 150);
+
+  std::vector<std::vector<int>> expected =
+      hmm_->posteriorProbSample(60, 3, emissions_, states_);
+  for (int threads : {1, 3}) {
+    SamplingParams params;
+    params.threads_ = threads;
+    params.batched_traceback_ = true;
+    EXPECT_EQ(expected, hmm_->posteriorProbSample(60, 3, emissions_, states_,
+                                                  params))
+        << "Threads: " << threads;
+  }
+}
+
+TEST_F(RandomHMMTest, ViterbiBatchTest) {
+  init(19, 40, 5, 4, 0);
+  RandomBatch batch = randomBatch();
+
+  std::vector<std::vector<int>> paths =
+      hmm_->runViterbiBatch(batch.emissions_, batch.states_);
+  ASSERT_EQ(batch.emissions_.size(), paths.size());
+  for (int read = 0; read < (int)paths.size(); read++) {
+    EXPECT_EQ(hmm_->runViterbiReturnStateIds(batch.emissions_[read],
+                                             batch.states_[read]),
+              paths[read])
+        << "Read: " << read;
+  }
+  EXPECT_TRUE(hmm_->runViterbiBatch({}, {}).empty());
+
+  // Lanes share silent states of the first read.
+  batch.states_[3] = randomGaussianStates(num_states_, 0, &gen_);
+  EXPECT_THROW(hmm_->runViterbiBatch(batch.emissions_, batch.states_),
+               std::invalid_argument);
+  EXPECT_THROW(hmm_->posteriorProbSampleBatch(1, 0, batch.emissions_,
+                                              batch.states_, SamplingParams()),
+               std::invalid_argument);
+  batch.states_.pop_back();
+  EXPECT_THROW(hmm_->runViterbiBatch(batch.emissions_, batch.states_),
+               std::invalid_argument);
+}
+
+TEST_F(RandomHMMTest, ForwardTrackingBatchTest) {
+  init(23, 40, 5, 4, 0);
+  RandomBatch batch = randomBatch();
+
+  std::vector<HMM<double>::ForwardMatrix> matrices =
+      hmm_->forwardTrackingBatch(batch.emissions_, batch.states_);
+  ASSERT_EQ(batch.emissions_.size(), matrices.size());
+  for (int read = 0; read < (int)matrices.size(); read++) {
+    HMM<double>::ForwardMatrix expected =
+        hmm_->forwardTracking(batch.emissions_[read], batch.states_[read]);
+    EXPECT_EQ(expected.rows_, matrices[read].rows_);
+    ASSERT_EQ(expected.weights_.size(), matrices[read].weights_.size());
+    for (size_t i = 0; i < expected.weights_.size(); i++) {
+      EXPECT_NEAR(expected.weights_[i], matrices[read].weights_[i], 1e-12)
+          << "Read: " << read << ", weight: " << i;
+    }
+    ASSERT_EQ(expected.last_state_weights_.size(),
+              matrices[read].last_state_weights_.size());
+    for (size_t i = 0; i < expected.last_state_weights_.size(); i++) {
+      EXPECT_NEAR(expected.last_state_weights_[i],
+                  matrices[read].last_state_weights_[i], 1e-12);
+    }
+  }
+}
+
+// Every read is sampled from its own forward matrix and with its own seed. The
+// batched matrices differ only by rounding errors so the samples are the same
+// as from the read alone.
+TEST_F(RandomHMMTest, PosteriorProbSampleBatchTest) {
+  init(29, 40, 5, 4, 0);
+  RandomBatch batch = randomBatch();
+
+  SamplingParams params;
+  params.threads_ = 2;
+  std::vector<std::vector<std::vector<int>>> samples =
+      hmm_->posteriorProbSampleBatch(20, 5, batch.emissions_, batch.states_,
+                                     params);
+  ASSERT_EQ(batch.emissions_.size(), samples.size());
+  for (int read = 0; read < (int)samples.size(); read++) {
+    EXPECT_EQ(hmm_->posteriorProbSample(
+                  20, HMM<double>::batchReadSeed(5, read),
+                  batch.emissions_[read], batch.states_[read], params),
+              samples[read])
+        << "Read: " << read;
+  }
+  // The same read twice in a batch gets different samples.
+  std::mt19937 same_gen = gen_;
+  std::vector<std::vector<std::unique_ptr<State<double>>>> same_states;
+  same_states.push_back(otherStates());
+  same_states.push_back(
+      randomGaussianStates(num_states_, silent_period_, &same_gen));
+  samples = hmm_->posteriorProbSampleBatch(
+      20, 5, {batch.emissions_[3], batch.emissions_[3]}, same_states, params);
+  EXPECT_NE(samples[0], samples[1]);
+
+  params.scaled_forward_ = true;
+  EXPECT_THROW(hmm_->posteriorProbSampleBatch(20, 5, batch.emissions_,
+                                              batch.states_, params),
+               std::invalid_argument);
+}
+
+// Samples from scaled forward matrix follow the same distribution. With the
+// same seed almost all samples are identical.
+TEST(HMMTest, PosteriorProbSampleScaledTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  const int kSamples = 20000;
+  SamplingParams params;
+  params.scaled_forward_ = true;
+  std::vector<std::vector<int>> samples = hmm.posteriorProbSample(
+      kSamples, 5, kEmissions, allocateStates(), params);
+  std::vector<std::vector<int>> log_space_samples =
+      hmm.posteriorProbSample(kSamples, 5, kEmissions, allocateStates());
+  std::vector<std::vector<double>> posteriors =
+      hmm.statePosteriors(kEmissions, allocateStates());
+
+  int same = 0;
+  std::vector<std::vector<double>> frequencies(
+      kEmissions.size(), std::vector<double>(kTransitions.size()));
+  for (int sample = 0; sample < kSamples; sample++) {
+    if (samples[sample] == log_space_samples[sample]) same++;
+    for (int i = 0; i < (int)kEmissions.size(); i++) {
+      frequencies[i][samples[sample][i + 1]] += 1.0 / kSamples;
+    }
+  }
+  EXPECT_GE(same, 0.99 * kSamples);
+  for (int i = 0; i < (int)kEmissions.size(); i++) {
+    for (int state = 0; state < (int)kTransitions.size(); state++) {
+      EXPECT_NEAR(frequencies[i][state], posteriors[i][state], 0.02)
+          << "Emission: " << i << ", state: " << state;
+    }
+  }
+}
+
+// Posterior probabilities of states emitting the same emission sum to one.
+TEST_F(RandomHMMTest, StatePosteriorsSumToOneTest) {
+  init(19, 30, 5, 6, 80);
+
+  std::vector<std::vector<double>> posteriors =
+      hmm_->statePosteriors(emissions_, states_);
+  ASSERT_EQ(emissions_.size(), posteriors.size());
+  for (const std::vector<double>& row : posteriors) {
+    EXPECT_NEAR(1, std::accumulate(row.begin(), row.end(), 0.0), 1e-9);
+  }
+}
+
+// Posterior probabilities have to match frequencies of states in samples from
+// the posterior distribution.
+TEST(HMMTest, StatePosteriorsMatchSamplesTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  const int kSamples = 20000;
+  std::vector<std::vector<int>> samples =
+      hmm.posteriorProbSample(kSamples, 5, kEmissions, allocateStates());
+  std::vector<std::vector<double>> posteriors =
+      hmm.statePosteriors(kEmissions, allocateStates());
+
+  // Frequency of the state emitting i-th emission. Samples contain the
+  // initial state and silent state 4 only at the end.
+  std::vector<std::vector<double>> frequencies(
+      kEmissions.size(), std::vector<double>(kTransitions.size()));
+  for (const std::vector<int>& sample : samples) {
+    for (int i = 0; i < (int)kEmissions.size(); i++) {
+      frequencies[i][sample[i + 1]] += 1.0 / kSamples;
+    }
+  }
+  for (int i = 0; i < (int)kEmissions.size(); i++) {
+    for (int state = 0; state < (int)kTransitions.size(); state++) {
+      EXPECT_NEAR(frequencies[i][state], posteriors[i][state], 0.02)
+          << "Emission: " << i << ", state: " << state;
+    }
+  }
+}
+
+// The last state is sampled in proportion to the forward probability of the
+// last row, not uniformly over reachable states.
+TEST(HMMTest, LastStateSampleTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  const int kSamples = 20000;
+  std::vector<std::vector<int>> samples =
+      hmm.posteriorProbSample(kSamples, 5, kEmissions, allocateStates());
+  std::vector<double> log2_scales;
+  std::vector<Log2Num> last_row =
+      hmm.forwardProbs(kEmissions, allocateStates(), nullptr, &log2_scales)
+          .back();
+  Log2Num total = Log2Num(0);
+  for (const Log2Num& prob : last_row) total += prob;
+
+  std::vector<double> frequencies(kTransitions.size());
+  for (const std::vector<int>& sample : samples) {
+    frequencies[sample.back()] += 1.0 / kSamples;
+  }
+  for (int state = 0; state < (int)kTransitions.size(); state++) {
+    EXPECT_NEAR((last_row[state] / total).value(), frequencies[state], 0.02)
+        << "State: " << state;
+  }
+
+  // State 1 cannot emit B and it is the only state after the initial one.
+  std::vector<std::vector<Transition>> transitions = {{{1, Log2Num(1)}}, {}};
+  std::vector<std::unique_ptr<State<char>>> states;
+  states.emplace_back(new SilentState<char>());
+  states.emplace_back(new ABCState(1, 0, 0));
+  ::HMM<char> impossible(kInitialState, transitions);
+  EXPECT_THROW(impossible.posteriorProbSample(10, 5, {'B'}, states),
+               std::invalid_argument);
+}
+
+TEST(HMMTest, PosteriorDecodingTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  PosteriorDecoding decoding =
+      hmm.posteriorDecoding(kEmissions, allocateStates());
+  std::vector<std::vector<double>> posteriors =
+      hmm.statePosteriors(kEmissions, allocateStates());
+
+  ASSERT_EQ(kEmissions.size() + 1, decoding.state_ids_.size());
+  ASSERT_EQ(kEmissions.size(), decoding.posteriors_.size());
+  EXPECT_EQ(kInitialState, decoding.state_ids_[0]);
+  for (int i = 0; i < (int)kEmissions.size(); i++) {
+    EXPECT_DOUBLE_EQ(
+        *std::max_element(posteriors[i].begin(), posteriors[i].end()),
+        decoding.posteriors_[i]);
+    EXPECT_DOUBLE_EQ(posteriors[i][decoding.state_ids_[i + 1]],
+                     decoding.posteriors_[i]);
+  }
+}
+
+// Model from hmm_test.json gives the same results with float scores.
+TEST(HMMTest, FloatScoresFixtureTest) {
+  std::ifstream json_file("hmm_test.json");
+  Json::CharReaderBuilder builder;
+  Json::Value value;
+  std::string errs;
+  ASSERT_TRUE(Json::parseFromStream(builder, json_file, &value, &errs));
+  ::HMM<char> hmm(value);
+  ::HMM<char, float> float_hmm(value);
+
+  EXPECT_EQ(hmm.runViterbiReturnStateIds(kEmissions, allocateStates()),
+            float_hmm.runViterbiReturnStateIds(kEmissions, allocateStates()));
+  std::vector<std::vector<double>> posteriors =
+      hmm.statePosteriors(kEmissions, allocateStates());
+  std::vector<std::vector<double>> float_posteriors =
+      float_hmm.statePosteriors(kEmissions, allocateStates());
+  for (int i = 0; i < (int)kEmissions.size(); i++) {
+    for (int state = 0; state < (int)kTransitions.size(); state++) {
+      EXPECT_NEAR(posteriors[i][state], float_posteriors[i][state], 1e-6);
+    }
+  }
+  for (bool scaled : {false, true}) {
+    SamplingParams params;
+    params.scaled_forward_ = scaled;
+    for (const std::vector<int>& sample : float_hmm.posteriorProbSample(
+             100, 3, kEmissions, allocateStates(), params)) {
+      // The initial state, states emitting emissions and possibly silent
+      // state 4 at the end.
+      EXPECT_EQ(kInitialState, sample[0]);
+      EXPECT_EQ(kEmissions.size(), std::count_if(
+          sample.begin(), sample.end(),
+          [](int state) { return state >= 1 && state <= 3; }));
+    }
+  }
+}
+
+// On a long read the path found with float scores is as probable as the
+// optimal path up to rounding errors and posteriors are close.
+TEST_F(RandomHMMTest, FloatScoresLongReadTest) {
+  init(37, 60, 6, 10, 5000);
+  ::HMM<double, float> float_hmm(kInitialState, transitions_);
+
+  std::vector<int> path = hmm_->runViterbiReturnStateIds(emissions_, states_);
+  std::vector<int> float_path =
+      float_hmm.runViterbiReturnStateIds(emissions_, states_);
+  double log2_prob = pathLog2Prob(transitions_, states_, emissions_, path);
+  double float_log2_prob =
+      pathLog2Prob(transitions_, states_, emissions_, float_path);
+  EXPECT_LE(float_log2_prob, log2_prob);
+  EXPECT_NEAR(log2_prob, float_log2_prob, 1e-5 * fabs(log2_prob));
+
+  std::vector<std::vector<double>> posteriors =
+      hmm_->statePosteriors(emissions_, states_);
+  std::vector<std::vector<double>> float_posteriors =
+      float_hmm.statePosteriors(emissions_, states_);
+  double max_error = 0;
+  for (int i = 0; i < (int)emissions_.size(); i++) {
+    for (int state = 0; state < num_states_; state++) {
+      max_error = std::max(
+          max_error, fabs(posteriors[i][state] - float_posteriors[i][state]));
+    }
+  }
+  EXPECT_LT(max_error, 1e-4);
+}
+
+TEST(HMMTest, FixedPointViterbiTest) {
+  ::HMM<char> hmm = ::HMM<char>(kInitialState, kTransitions);
+  ViterbiParams params;
+  params.fixed_point_scale_ = 1024;
+
+  std::vector<int> expected_states = {0, 1, 2, 2, 3};
+  EXPECT_EQ(expected_states,
+            hmm.runViterbiReturnStateIds(kEmissions, allocateStates(), params));
+
+  params.checkpointing_ = true;
+  EXPECT_THROW(hmm.runViterbiReturnStateIds(kEmissions, allocateStates(),
+                                            params),
+               std::invalid_argument);
+}
+
+// Rounding of every log2 probability is at most 1/(2*scale) so the fixed point
+// path is at most about length/scale less probable than the optimal path.
+TEST_F(RandomHMMTest, FixedPointViterbiLongReadTest) {
+  init(41, 60, 6, 10, 2000);
+  double log2_prob = pathLog2Prob(
+      transitions_, states_, emissions_,
+      hmm_->runViterbiReturnStateIds(emissions_, states_));
+
+  for (double scale : {1.0, 16.0, 1024.0}) {
+    ViterbiParams params;
+    params.fixed_point_scale_ = scale;
+    params.validate_fixed_point_ = true;
+    std::vector<int> path =
+        hmm_->runViterbiReturnStateIds(emissions_, states_, params);
+    FixedPointValidation validation =
+        hmm_->validateFixedPointViterbi(emissions_, states_, params);
+    EXPECT_EQ(path, validation.state_ids_);
+    EXPECT_EQ(hmm_->runViterbiReturnStateIds(emissions_, states_),
+              validation.reference_state_ids_);
+    EXPECT_EQ(validation.differing_emissions_ == 0,
+              path == validation.reference_state_ids_);
+
+    double fixed_log2_prob =
+        pathLog2Prob(transitions_, states_, emissions_, path);
+    EXPECT_LE(fixed_log2_prob, log2_prob);
+    EXPECT_GE(fixed_log2_prob, log2_prob - 2 * emissions_.size() / scale);
+  }
+
+  ViterbiParams params;
+  params.fixed_point_scale_ = 1 << 16;
+  EXPECT_EQ(0, hmm_->validateFixedPointViterbi(emissions_, states_, params)
+                   .differing_emissions_);
+}
+
+// Compressed transitions read exactly the same numbers so decoding gives the
+// same results. Most transitions of every state have the same probability
+// like the pseudocount of trained MoveHMM.
+TEST_F(RandomHMMTest, CompressedTransitionsTest) {
+  init(53, 50, 8, 10, 150);
+  for (int from = 1; from < num_states_; from++) {
+    for (int i = 2; i < (int)transitions_[from].size(); i++) {
+      transitions_[from][i].prob_ = Log2Num(0.01);
+    }
+  }
+  hmm_.reset(new ::HMM<double>(kInitialState, transitions_));
+  // Two exceptions of every state but the initial one.
+  EXPECT_EQ(2 * (num_states_ - 1),
+            hmm_->compressedTransitions().numExceptions());
+
+  std::vector<ViterbiParams> viterbi_params(3);
+  viterbi_params[1].checkpointing_ = true;
+  viterbi_params[2].threads_ = 3;
+  for (ViterbiParams params : viterbi_params) {
+    std::vector<int> expected =
+        hmm_->runViterbiReturnStateIds(emissions_, states_, params);
+    params.compressed_transitions_ = true;
+    EXPECT_EQ(expected,
+              hmm_->runViterbiReturnStateIds(emissions_, states_, params));
+  }
+  for (int threads : {1, 2}) {
+    SamplingParams params;
+    params.forward_threads_ = threads;
+    std::vector<std::vector<int>> expected =
+        hmm_->posteriorProbSample(10, 7, emissions_, states_, params);
+    params.compressed_transitions_ = true;
+    EXPECT_EQ(expected,
+              hmm_->posteriorProbSample(10, 7, emissions_, states_, params))
+        << "Threads: " << threads;
+  }
+
+  ::HMM<double, float> float_hmm(kInitialState, transitions_);
+  ViterbiParams float_params;
+  float_params.compressed_transitions_ = true;
+  EXPECT_EQ(float_hmm.runViterbiReturnStateIds(emissions_, states_),
+            float_hmm.runViterbiReturnStateIds(emissions_, states_,
+                                               float_params));
+
+  ViterbiParams beam_params;
+  beam_params.compressed_transitions_ = true;
+  beam_params.beam_max_states_ = 5;
+  EXPECT_THROW(hmm_->runViterbiReturnStateIds(emissions_, states_, beam_params),
+               std::invalid_argument);
+  SamplingParams scaled_params;
+  scaled_params.compressed_transitions_ = true;
+  scaled_params.scaled_forward_ = true;
+  EXPECT_THROW(hmm_->posteriorProbSample(10, 7, emissions_, states_,
+                                         scaled_params),
+               std::invalid_argument);
+  SamplingParams fused_params;
+  fused_params.compressed_transitions_ = true;
+  EXPECT_THROW(
+      hmm_->runViterbiAndSample(5, 11, emissions_, states_, fused_params),
+      std::invalid_argument);
+}
+
 // Test for serialization of the whole HMM. The test json is in hmm_test.json.
 TEST(HMMTest, HMMSerializationTest) {
   ::HMM<double> hmm = ::HMM<double>(kInitialState, kTransitions);
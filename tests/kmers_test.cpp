@@ -142,6 +142,15 @@ TEST(KmersTest, KmerInLexicographicPosTest) {
   EXPECT_EQ("GGG", kmerInLexicographicPos(64, 3));
 }
 
+TEST(KmersTest, LongestKmerLexicographicPosTest) {
+  const std::string longest(kMaxKmerLength, 'G');
+  EXPECT_EQ(numKmersOf(kMaxKmerLength), kmerToLexicographicPos(longest));
+  EXPECT_EQ(longest,
+            kmerInLexicographicPos(numKmersOf(kMaxKmerLength), kMaxKmerLength));
+  EXPECT_EQ(std::string(kMaxKmerLength, 'A'),
+            kmerInLexicographicPos(1, kMaxKmerLength));
+}
+
 TEST(KmersTest, kmersUpToDist2Test) {
   std::unordered_set<std::string> res = kmersUpToDist("ACTGC", 2);
   EXPECT_THAT(
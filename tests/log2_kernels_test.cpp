@@ -0,0 +1,353 @@
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "src/log2_kernels.h"
+#include "src/log2_num.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+const std::vector<Log2KernelIsa> kAllIsas = {
+    Log2KernelIsa::kScalar, Log2KernelIsa::kAvx2, Log2KernelIsa::kAvx512};
+
+// Random exponents where every fifth number is zero and there are ties.
+std::vector<double> randomExponents(int size, std::mt19937* gen) {
+  std::uniform_int_distribution<int> dist(-40, 0);
+  std::vector<double> res(size);
+  for (int i = 0; i < size; i++) {
+    res[i] = (i % 5 == 4) ? -HUGE_VAL : dist(*gen) / 4.0;
+  }
+  return res;
+}
+
+std::vector<int> randomIdx(int size, int range, std::mt19937* gen) {
+  std::uniform_int_distribution<int> dist(0, range - 1);
+  std::vector<int> res(size);
+  for (int& idx : res) idx = dist(*gen);
+  return res;
+}
+
+// Runs @test for every instruction set supported by the CPU.
+void forAllIsas(const std::function<void()>& test) {
+  Log2KernelIsa original = log2KernelIsa();
+  for (Log2KernelIsa isa : kAllIsas) {
+    if (!setLog2KernelIsa(isa)) continue;
+    SCOPED_TRACE(log2KernelIsaName(isa));
+    test();
+  }
+  setLog2KernelIsa(original);
+}
+
+// Computed by a static initializer, which runs before the one of
+// log2_kernels.cpp because this file is linked first.
+const double kStaticMaxPlus = []() {
+  const double values[] = {-1, -2};
+  const int idx[] = {1, 0};
+  const double weights[] = {-2, -0.5};
+  int argmax;
+  return log2MaxPlus(values, idx, weights, 2, &argmax);
+}();
+
+TEST(Log2KernelsTest, StaticInitializationTest) {
+  EXPECT_EQ(-1.5, kStaticMaxPlus);
+}
+
+TEST(Log2KernelsTest, ScalarIsAlwaysSupportedTest) {
+  EXPECT_TRUE(log2KernelIsaSupported(Log2KernelIsa::kScalar));
+  EXPECT_TRUE(log2KernelIsaSupported(log2KernelIsa()));
+}
+
+TEST(Log2KernelsTest, MaxPlusTest) {
+  std::mt19937 gen(1);
+  const int kValues = 50;
+  forAllIsas([&]() {
+    for (int n = 0; n <= 40; n++) {
+      std::vector<double> values = randomExponents(kValues, &gen);
+      std::vector<double> weights = randomExponents(n, &gen);
+      std::vector<int> idx = randomIdx(n, kValues, &gen);
+
+      Log2Num expected_max(0.0);
+      int expected_argmax = -1;
+      for (int i = 0; i < n; i++) {
+        Log2Num value, weight;
+        value.setExponent(values[idx[i]]);
+        weight.setExponent(weights[i]);
+        if (expected_max < value * weight) {
+          expected_max = value * weight;
+          expected_argmax = i;
+        }
+      }
+
+      int argmax;
+      double max = log2MaxPlus(values.data(), idx.data(), weights.data(), n,
+                               &argmax);
+      EXPECT_EQ(expected_argmax, argmax);
+      EXPECT_EQ(expected_max.exponent(), max);
+    }
+  });
+}
+
+TEST(Log2KernelsTest, MaxPlusAllZeroTest) {
+  forAllIsas([]() {
+    std::vector<double> values(20, -HUGE_VAL);
+    std::vector<double> weights(20, 0);
+    std::vector<int> idx(20, 3);
+    int argmax;
+    EXPECT_EQ(-HUGE_VAL, log2MaxPlus(values.data(), idx.data(),
+                                     weights.data(), 20, &argmax));
+    EXPECT_EQ(-1, argmax);
+  });
+}
+
+TEST(Log2KernelsTest, MaxPlusUpdateTest) {
+  std::mt19937 gen(4);
+  const int kValues = 10;
+  forAllIsas([&]() {
+    for (int n = 0; n <= 40; n++) {
+      std::vector<double> best(n, -HUGE_VAL), expected_best(n, -HUGE_VAL);
+      std::vector<int> best_pos(n, kValues), expected_pos(n, kValues);
+      std::vector<int> best_arg(n, -1), expected_arg(n, -1);
+      // Sources are visited in the reverse order so that ties are broken by
+      // position and not by the order of calls.
+      for (int arg = 3; arg >= 0; arg--) {
+        std::vector<double> values = randomExponents(kValues, &gen);
+        std::vector<double> weights = randomExponents(n, &gen);
+        std::vector<int> idx = randomIdx(n, kValues / 2, &gen);
+        int offset = arg % 2 * kValues / 2;
+        for (int i = 0; i < n; i++) {
+          double term = values[idx[i]] + weights[i];
+          int pos = offset + idx[i];
+          if (term > expected_best[i] ||
+              (term == expected_best[i] && pos < expected_pos[i])) {
+            expected_best[i] = term;
+            expected_pos[i] = pos;
+            expected_arg[i] = arg;
+          }
+        }
+        log2MaxPlusUpdate(values.data(), idx.data(), weights.data(), n, offset,
+                          arg, best.data(), best_pos.data(), best_arg.data());
+      }
+      EXPECT_EQ(expected_best, best);
+      EXPECT_EQ(expected_pos, best_pos);
+      EXPECT_EQ(expected_arg, best_arg);
+    }
+  });
+}
+
+TEST(Log2KernelsTest, SumExpPlusTest) {
+  std::mt19937 gen(2);
+  const int kValues = 50;
+  forAllIsas([&]() {
+    for (int n = 0; n <= 40; n++) {
+      std::vector<double> values = randomExponents(kValues, &gen);
+      std::vector<double> weights = randomExponents(n, &gen);
+      std::vector<int> idx = randomIdx(n, kValues, &gen);
+
+      Log2Num expected_sum(0.0);
+      for (int i = 0; i < n; i++) {
+        Log2Num value, weight;
+        value.setExponent(values[idx[i]]);
+        weight.setExponent(weights[i]);
+        expected_sum += value * weight;
+      }
+
+      std::vector<double> terms(n);
+      double sum = log2SumExpPlus(values.data(), idx.data(), weights.data(), n,
+                                  terms.data());
+      if (expected_sum.isLogZero()) {
+        EXPECT_EQ(-HUGE_VAL, sum);
+      } else {
+        EXPECT_NEAR(expected_sum.exponent(), sum, 1e-13);
+      }
+      EXPECT_EQ(sum, log2SumExpPlus(values.data(), idx.data(), weights.data(),
+                                    n, nullptr));
+      for (int i = 0; i < n; i++) {
+        EXPECT_EQ(values[idx[i]] + weights[i], terms[i]);
+      }
+    }
+  });
+}
+
+TEST(Log2KernelsTest, NormalizedCumulativeTest) {
+  std::mt19937 gen(3);
+  forAllIsas([&]() {
+    for (int n = 1; n <= 40; n++) {
+      std::vector<double> terms = randomExponents(n, &gen);
+      terms[0] = -1;
+      std::vector<int> idx(n);
+      for (int i = 0; i < n; i++) idx[i] = i;
+      std::vector<double> zeros(n, 0);
+      double total =
+          log2SumExpPlus(terms.data(), idx.data(), zeros.data(), n, nullptr);
+
+      std::vector<double> res(n);
+      log2NormalizedCumulative(terms.data(), n, total, res.data());
+      double cumulative = 0;
+      for (int i = 0; i < n; i++) {
+        cumulative += exp2(terms[i] - total);
+        EXPECT_NEAR(cumulative, res[i], 1e-14);
+        // Zero term does not change cumulative weight.
+        if (terms[i] == -HUGE_VAL) {
+          EXPECT_EQ(res[i - 1], res[i]);
+        }
+      }
+      EXPECT_NEAR(1, res.back(), 1e-14);
+    }
+  });
+}
+
+// Random exponents are multiples of 1/4 so float terms are exact and
+// max-plus gives the same result as for doubles.
+TEST(Log2KernelsTest, FloatTest) {
+  std::mt19937 gen(5);
+  const int kValues = 50;
+  forAllIsas([&]() {
+    for (int n = 0; n <= 40; n++) {
+      std::vector<double> values = randomExponents(kValues, &gen);
+      std::vector<double> weights = randomExponents(n, &gen);
+      std::vector<int> idx = randomIdx(n, kValues, &gen);
+      std::vector<float> float_values(values.begin(), values.end());
+      std::vector<float> float_weights(weights.begin(), weights.end());
+
+      int argmax, float_argmax;
+      double max = log2MaxPlus(values.data(), idx.data(), weights.data(), n,
+                               &argmax);
+      EXPECT_EQ(max, log2MaxPlus(float_values.data(), idx.data(),
+                                 float_weights.data(), n, &float_argmax));
+      EXPECT_EQ(argmax, float_argmax);
+
+      std::vector<float> terms(n);
+      double sum = log2SumExpPlus(values.data(), idx.data(), weights.data(), n,
+                                  nullptr);
+      float float_sum = log2SumExpPlus(float_values.data(), idx.data(),
+                                       float_weights.data(), n, terms.data());
+      if (sum == -HUGE_VAL) {
+        EXPECT_EQ(-HUGE_VAL, float_sum);
+        continue;
+      }
+      EXPECT_NEAR(sum, float_sum, 1e-5);
+
+      std::vector<float> res(n);
+      log2NormalizedCumulative(terms.data(), n, float_sum, res.data());
+      float cumulative = 0;
+      for (int i = 0; i < n; i++) {
+        cumulative += exp2(terms[i] - float_sum);
+        EXPECT_NEAR(cumulative, res[i], 1e-6);
+      }
+    }
+  });
+}
+
+TEST(Log2KernelsTest, FixedPointMaxPlusTest) {
+  std::mt19937 gen(6);
+  const int kValues = 50;
+  const double kScale = 8;
+  forAllIsas([&]() {
+    for (int n = 0; n <= 40; n++) {
+      std::vector<double> values = randomExponents(kValues, &gen);
+      std::vector<double> weights = randomExponents(n, &gen);
+      std::vector<int> idx = randomIdx(n, kValues, &gen);
+      std::vector<int32_t> fixed_values(kValues), fixed_weights(n);
+      for (int i = 0; i < kValues; i++) {
+        fixed_values[i] = log2ToFixed(values[i], kScale);
+      }
+      for (int i = 0; i < n; i++) {
+        fixed_weights[i] = log2ToFixed(weights[i], kScale);
+      }
+
+      // Exponents are multiples of 1/4 so fixed point is exact.
+      int argmax, fixed_argmax;
+      double max = log2MaxPlus(values.data(), idx.data(), weights.data(), n,
+                               &argmax);
+      int32_t fixed_max = log2MaxPlus(fixed_values.data(), idx.data(),
+                                      fixed_weights.data(), n, &fixed_argmax);
+      EXPECT_EQ(argmax, fixed_argmax);
+      if (max == -HUGE_VAL) {
+        EXPECT_EQ(kLog2FixedZero, fixed_max);
+      } else {
+        EXPECT_EQ(max * kScale, fixed_max);
+      }
+    }
+  });
+}
+
+TEST(Log2KernelsTest, FixedPointSaturationTest) {
+  EXPECT_EQ(kLog2FixedZero, log2ToFixed(-HUGE_VAL, 100));
+  EXPECT_EQ(kLog2FixedZero + 1, log2ToFixed(-1e30, 100));
+  EXPECT_EQ(-125, log2ToFixed(-1.251, 100));
+}
+
+// Every lane gives the same result as the kernel for one read with numbers
+// of the lane.
+TEST(Log2KernelsTest, LanesTest) {
+  std::mt19937 gen(7);
+  const int kValues = 30;
+  forAllIsas([&]() {
+    for (int lanes = 0; lanes <= 19; lanes++) {
+      int stride = lanes + 3;
+      int n = lanes % 7 * 3;
+      std::vector<double> values = randomExponents(kValues * stride, &gen);
+      std::vector<double> weights = randomExponents(n, &gen);
+      std::vector<int> idx = randomIdx(n, kValues, &gen);
+      // Lane 0 has no path.
+      for (int i = 0; i < kValues; i++) values[i * stride] = -HUGE_VAL;
+
+      std::vector<double> best(lanes), sums(lanes);
+      std::vector<int> argmax(lanes);
+      std::vector<double> terms((size_t)n * stride), cumulative(terms.size());
+      log2MaxPlusLanes(values.data(), idx.data(), weights.data(), n, stride,
+                       lanes, best.data(), argmax.data());
+      log2SumExpPlusLanes(values.data(), idx.data(), weights.data(), n,
+                          stride, lanes, terms.data(), sums.data());
+      log2NormalizedCumulativeLanes(terms.data(), n, stride, lanes,
+                                    sums.data(), cumulative.data());
+      for (int lane = 0; lane < lanes; lane++) {
+        std::vector<double> lane_values(kValues);
+        for (int i = 0; i < kValues; i++) {
+          lane_values[i] = values[i * stride + lane];
+        }
+        int expected_argmax;
+        EXPECT_EQ(log2MaxPlus(lane_values.data(), idx.data(), weights.data(),
+                              n, &expected_argmax),
+                  best[lane]);
+        EXPECT_EQ(expected_argmax, argmax[lane]);
+
+        std::vector<double> expected_terms(n);
+        double sum = log2SumExpPlus(lane_values.data(), idx.data(),
+                                    weights.data(), n, expected_terms.data());
+        for (int i = 0; i < n; i++) {
+          EXPECT_EQ(expected_terms[i], terms[i * stride + lane]);
+        }
+        if (sum == -HUGE_VAL) {
+          EXPECT_EQ(-HUGE_VAL, sums[lane]);
+          continue;
+        }
+        EXPECT_NEAR(sum, sums[lane], 1e-13);
+        std::vector<double> expected_cumulative(n);
+        log2NormalizedCumulative(expected_terms.data(), n, sum,
+                                 expected_cumulative.data());
+        for (int i = 0; i < n; i++) {
+          EXPECT_NEAR(expected_cumulative[i], cumulative[i * stride + lane],
+                      1e-14);
+        }
+      }
+    }
+  });
+}
+
+TEST(Log2KernelsTest, Exp2PrecisionTest) {
+  forAllIsas([]() {
+    std::vector<double> terms;
+    for (double x = -1000; x <= 0; x += 0.37) terms.push_back(x);
+    std::vector<double> res(terms.size());
+    log2NormalizedCumulative(terms.data(), terms.size(), 0, res.data());
+    double prev = 0;
+    for (int i = 0; i < (int)terms.size(); i++) {
+      double expected = exp2(terms[i]);
+      EXPECT_NEAR(expected, res[i] - prev, expected * 1e-14);
+      prev = res[i];
+    }
+  });
+}
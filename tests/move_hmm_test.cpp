@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <stdexcept>
 
 #include "src/hmm.h"
 #include "src/move_hmm.h"
@@ -62,6 +64,16 @@ void test_for_transition(const std::vector<std::vector<Transition>>& res,
 }
 
 // Larger test with k=4.
+TEST(MoveHMMTest, ConstructEmissionsWrongKmersTest) {
+  std::vector<GaussianParamsKmer> gaussians = {
+      {"G", 1, 0.1}, {"A", 0, 0.5}, {"T", 0.5, 0.2}, {"C", 0.5, 0.1}};
+  EXPECT_THROW(constructEmissions(2, gaussians), std::invalid_argument);
+  EXPECT_THROW(constructEmissions(kMaxKmerLength + 1, gaussians),
+               std::invalid_argument);
+  gaussians[0].kmer_ = "GG";
+  EXPECT_THROW(constructEmissions(1, gaussians), std::invalid_argument);
+}
+
 TEST(MoveHMMTest, ConstructTransitionsLargeTest) {
   const int k = 4;
   const int kPseudoCount = 1;
@@ -210,6 +222,32 @@ TEST(MoveHMMTest, ConstructTransitionsSmallestMoveTest) {
               Pair(Pair(pos, pos), 1));
 }
 
+TEST(MoveHMMTest, KmerLengthTest) {
+  const int k = 3;
+  ::HMM<double> hmm(
+      0, TransitionConstructor(2).calculateTransitions(1, k));
+  // Older models do not store the length of kmers.
+  EXPECT_EQ(0, hmm.kmerLength());
+  EXPECT_EQ(k, moveHMMKmerLength(hmm));
+
+  hmm.setKmerLength(k);
+  EXPECT_EQ(k, moveHMMKmerLength(hmm));
+  hmm.setKmerLength(k + 1);
+  EXPECT_THROW(moveHMMKmerLength(hmm), std::invalid_argument);
+
+  ::HMM<double> not_move_hmm(0, {{{1, Log2Num(1)}}, {}, {}});
+  EXPECT_THROW(moveHMMKmerLength(not_move_hmm), std::invalid_argument);
+
+  // 4^13 * (1 + 4 + 16 + 64 + 1) transitions do not fit into int.
+  TransitionConstructor long_moves(3);
+  EXPECT_THROW(long_moves.calculateTransitions(1, kMaxKmerLength),
+               std::invalid_argument);
+  TransitionConstructor transition_constructor(2);
+  EXPECT_THROW(
+      transition_constructor.calculateTransitions(1, kMaxKmerLength + 1),
+      std::invalid_argument);
+}
+
 TEST(MoveHMMTest, StateSeqToBasesTest) {
   std::vector<std::string> kmers = {"CGTTC", "GTTCG", "TCGGA", "CGGAA",
                                     "GGAAG", "GGAAG", "GAAGT", "GAAGT",
@@ -228,3 +266,67 @@ TEST(MoveHMMTest, StateSeqToBasesTest) {
 TEST(MoveHMMTest, StateSeqToBasesNoStatesTest) {
   EXPECT_EQ("", stateSeqToBases(5, {}));
 }
+
+TEST(MoveHMMTest, StateSeqToBasesContinuationTest) {
+  std::vector<std::string> kmers = {"CGTTC", "GTTCG", "TCGGA", "CGGAA",
+                                    "GGAAG", "GGAAG", "GAAGT", "GAAGT",
+                                    "AAGTA", "AGTAT"};
+  std::vector<int> states;
+  for (const std::string& kmer : kmers) {
+    states.push_back(kmerToLexicographicPos(kmer));
+  }
+
+  // Sequence is split into three parts. Concatenation of outputs is the same
+  // as output for the whole sequence.
+  std::vector<int> first(states.begin(), states.begin() + 3);
+  std::vector<int> second(states.begin() + 3, states.begin() + 6);
+  std::vector<int> third(states.begin() + 6, states.end());
+  EXPECT_EQ("CGTTC|G|GA|", stateSeqToBases(5, 0, first));
+  EXPECT_EQ("A|G||", stateSeqToBases(5, first.back(), second));
+  EXPECT_EQ("T||A|T|", stateSeqToBases(5, second.back(), third));
+  EXPECT_EQ("", stateSeqToBases(5, third.back(), {}));
+}
+
+TEST(MoveHMMTest, PhredQualityCharTest) {
+  EXPECT_EQ('!', phredQualityChar(0));
+  EXPECT_EQ('+', phredQualityChar(0.9));
+  EXPECT_EQ('5', phredQualityChar(0.99));
+  EXPECT_EQ('!' + 60, phredQualityChar(1));
+}
+
+TEST(MoveHMMTest, PosteriorDecodingToReadTest) {
+  std::vector<int> states = {0, kmerToLexicographicPos("CGT"),
+                             kmerToLexicographicPos("GTT"),
+                             kmerToLexicographicPos("GTT"),
+                             kmerToLexicographicPos("TAC")};
+  std::vector<double> posteriors = {0.9, 0.99, 0.5, 0.999};
+
+  BasecalledRead read = posteriorDecodingToRead(3, states, posteriors);
+  EXPECT_EQ("CGTTAC", read.bases_);
+  EXPECT_EQ("+++5??", read.qualities_);
+}
+
+TEST(MoveHMMTest, BasecallerBandTest) {
+  std::vector<MoveKmer> read = {{0, "AC"}, {1, "CT"}, {0, "CT"}};
+  auto ids = [](const std::vector<std::string>& kmers) {
+    std::vector<int> res;
+    for (const std::string& kmer : kmers) {
+      res.push_back(kmerToLexicographicPos(kmer));
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+  };
+
+  StateBand band = basecallerBand(read, 1, 0);
+  ASSERT_EQ(3, band.states_.size());
+  EXPECT_EQ(ids({"AC", "CA", "CC", "CT", "CG"}), band.states_[0]);
+  EXPECT_EQ(ids({"CT", "TA", "TC", "TT", "TG"}), band.states_[1]);
+  EXPECT_EQ(band.states_[1], band.states_[2]);
+
+  band = basecallerBand(read, 0, 1);
+  EXPECT_EQ(ids({"AC", "CT"}), band.states_[0]);
+  EXPECT_EQ(ids({"AC", "CT"}), band.states_[1]);
+  EXPECT_EQ(ids({"CT"}), band.states_[2]);
+
+  EXPECT_THROW(basecallerBand(read, -1, 0), std::invalid_argument);
+}
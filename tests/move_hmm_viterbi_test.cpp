@@ -0,0 +1,96 @@
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/hmm.h"
+#include "src/kmers.h"
+#include "src/move_hmm.h"
+#include "src/move_hmm_viterbi.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+const int kK = 4;
+const int kMoveThreshold = 2;
+
+// Transitions of MoveHMM trained on random reads.
+std::vector<std::vector<Transition>> randomMoveHMMTransitions(
+    int reads, std::mt19937* gen) {
+  std::uniform_int_distribution<int> base(0, kNumBases - 1);
+  std::uniform_int_distribution<int> move(0, kMoveThreshold);
+  TransitionConstructor constructor(kMoveThreshold);
+  for (int read_id = 0; read_id < reads; read_id++) {
+    std::string seq;
+    for (int i = 0; i < 300; i++) seq += kBases[base(*gen)];
+    std::vector<MoveKmer> read;
+    for (int pos = 0; pos + kK <= (int)seq.size();) {
+      int next_move = read.empty() ? 0 : move(*gen);
+      pos += next_move;
+      if (pos + kK > (int)seq.size()) break;
+      read.push_back({next_move, seq.substr(pos, kK)});
+    }
+    constructor.addRead(read);
+  }
+  return constructor.calculateTransitions(1, kK);
+}
+
+std::vector<GaussianParamsKmer> randomGaussians(std::mt19937* gen) {
+  std::uniform_real_distribution<double> mu(40, 70);
+  std::uniform_real_distribution<double> sigma(0.5, 2);
+  std::vector<GaussianParamsKmer> res;
+  for (int pos = 1; pos <= numKmersOf(kK); pos++) {
+    res.push_back({kmerInLexicographicPos(pos, kK), mu(*gen), sigma(*gen)});
+  }
+  return res;
+}
+
+TEST(MoveHMMViterbiTest, SameAsHMMTest) {
+  std::mt19937 gen(29);
+  ::HMM<double> hmm(0, randomMoveHMMTransitions(20, &gen));
+  std::vector<std::unique_ptr<State<double>>> states =
+      constructEmissions(kK, randomGaussians(&gen));
+  MoveHMMViterbi viterbi(kK, hmm);
+  EXPECT_EQ(kMoveThreshold, viterbi.maxMove());
+  EXPECT_EQ(numKmersOf(kK) * (1 + 4 + 16) * sizeof(double),
+            viterbi.tableMemoryUsage());
+
+  std::uniform_real_distribution<double> level(40, 70);
+  for (int length : {0, 1, 2, 50, 400}) {
+    std::vector<double> emissions(length);
+    for (double& emission : emissions) emission = level(gen);
+    EXPECT_EQ(hmm.runViterbiReturnStateIds(emissions, states),
+              viterbi.runViterbiReturnStateIds(emissions, states))
+        << "Length: " << length;
+  }
+}
+
+// All transitions from a kmer and all emissions have the same probability so
+// there are many paths with the same probability. Ties have to be broken the
+// same way as in HMM.
+TEST(MoveHMMViterbiTest, TiesTest) {
+  ::HMM<double> hmm(
+      0, TransitionConstructor(kMoveThreshold).calculateTransitions(1, kK));
+  std::vector<GaussianParamsKmer> gaussians;
+  for (int pos = 1; pos <= numKmersOf(kK); pos++) {
+    gaussians.push_back({kmerInLexicographicPos(pos, kK), 50, 1});
+  }
+  std::vector<std::unique_ptr<State<double>>> states =
+      constructEmissions(kK, gaussians);
+  MoveHMMViterbi viterbi(kK, hmm);
+
+  std::vector<double> emissions = {50, 51, 49, 50, 50, 52};
+  EXPECT_EQ(hmm.runViterbiReturnStateIds(emissions, states),
+            viterbi.runViterbiReturnStateIds(emissions, states));
+}
+
+TEST(MoveHMMViterbiTest, InvalidModelTest) {
+  std::mt19937 gen(31);
+  ::HMM<double> hmm(0, randomMoveHMMTransitions(1, &gen));
+  EXPECT_THROW(MoveHMMViterbi(kK + 1, hmm), std::invalid_argument);
+
+  std::vector<std::vector<Transition>> transitions = {
+      {{1, Log2Num(1)}}, {{0, Log2Num(1)}}, {}, {}, {}};
+  EXPECT_THROW(MoveHMMViterbi(1, ::HMM<double>(0, transitions)),
+               std::invalid_argument);
+}
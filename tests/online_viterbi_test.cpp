@@ -0,0 +1,163 @@
+#include <vector>
+#include <random>
+#include <memory>
+
+#include "src/hmm.h"
+#include "src/online_viterbi.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+const int kInitialState = 0;
+
+// Left-to-right HMM with Gaussian emissions where every state can stay, move
+// to the next state or skip one state. State 0 is the initial state.
+std::vector<std::vector<Transition>> chainTransitions(int num_states) {
+  std::vector<std::vector<Transition>> res(num_states);
+  res[kInitialState].push_back({1, Log2Num(1)});
+  for (int state = 1; state < num_states; state++) {
+    res[state].push_back({state, Log2Num(0.5)});
+    res[state].push_back({1 + state % (num_states - 1), Log2Num(0.4)});
+    res[state].push_back({1 + (state + 1) % (num_states - 1), Log2Num(0.1)});
+  }
+  return res;
+}
+
+std::vector<std::unique_ptr<State<double>>> chainStates(int num_states,
+                                                        std::mt19937* gen) {
+  std::uniform_real_distribution<double> mu(40, 80);
+  std::vector<std::unique_ptr<State<double>>> res;
+  res.emplace_back(new SilentState<double>());
+  for (int state = 1; state < num_states; state++) {
+    res.emplace_back(new GaussianState(mu(*gen), 2));
+  }
+  return res;
+}
+
+// Emissions generated by walking through the chain.
+std::vector<double> chainEmissions(
+    int length, const std::vector<std::unique_ptr<State<double>>>& states,
+    std::mt19937* gen) {
+  std::vector<double> mus;
+  for (int state = 1; state < (int)states.size(); state++) {
+    mus.push_back(states[state]->toJsonValue()["params"]["mu"].asDouble());
+  }
+  std::normal_distribution<double> noise(0, 2);
+  std::uniform_int_distribution<int> move(0, 2);
+  std::vector<double> res;
+  int state = 0;
+  for (int i = 0; i < length; i++) {
+    state = (state + move(*gen)) % mus.size();
+    res.push_back(mus[state] + noise(*gen));
+  }
+  return res;
+}
+
+std::vector<int> decodeInChunks(const HMM<double>& hmm,
+                                const std::vector<std::unique_ptr<State<double>>>& states,
+                                const std::vector<double>& emissions,
+                                int chunk_size, int* max_window) {
+  OnlineViterbi<double> decoder(hmm, states);
+  std::vector<int> res;
+  *max_window = 0;
+  for (int begin = 0; begin < (int)emissions.size(); begin += chunk_size) {
+    int end = std::min((int)emissions.size(), begin + chunk_size);
+    std::vector<int> fixed = decoder.addEmissions(
+        std::vector<double>(emissions.begin() + begin, emissions.begin() + end));
+    res.insert(res.end(), fixed.begin(), fixed.end());
+    *max_window = std::max(*max_window, decoder.windowSize());
+  }
+  std::vector<int> rest = decoder.finish();
+  res.insert(res.end(), rest.begin(), rest.end());
+  return res;
+}
+
+TEST(OnlineViterbiTest, SameAsOfflineViterbiTest) {
+  std::mt19937 gen(3);
+  const int kStates = 40;
+  HMM<double> hmm(kInitialState, chainTransitions(kStates));
+  std::vector<std::unique_ptr<State<double>>> states = chainStates(kStates, &gen);
+  std::vector<double> emissions = chainEmissions(2000, states, &gen);
+
+  std::vector<int> expected = hmm.runViterbiReturnStateIds(emissions, states);
+  for (int chunk_size : {1, 7, 100, 5000}) {
+    int max_window;
+    EXPECT_EQ(expected,
+              decodeInChunks(hmm, states, emissions, chunk_size, &max_window))
+        << "Chunk size: " << chunk_size;
+  }
+}
+
+TEST(OnlineViterbiTest, WindowIsBoundedTest) {
+  std::mt19937 gen(3);
+  const int kStates = 40;
+  HMM<double> hmm(kInitialState, chainTransitions(kStates));
+  std::vector<std::unique_ptr<State<double>>> states = chainStates(kStates, &gen);
+  std::vector<double> emissions = chainEmissions(5000, states, &gen);
+
+  int max_window;
+  decodeInChunks(hmm, states, emissions, 10, &max_window);
+  // Chains converge quickly so the window is much shorter than the read.
+  EXPECT_LT(max_window, 500);
+}
+
+// Two chains of @half states which never meet. The last state of each chain
+// is silent and it leads back to the first state of the chain.
+std::vector<std::vector<Transition>> twoChainTransitions(int half) {
+  std::vector<std::vector<Transition>> res(2 * half + 1);
+  res[kInitialState] = {{1, Log2Num(0.5)}, {half + 1, Log2Num(0.5)}};
+  for (int first : {1, half + 1}) {
+    int silent = first + half - 1;
+    for (int state = first; state < silent; state++) {
+      int next = state + 1 < silent ? state + 1 : first;
+      res[state] = {{state, Log2Num(0.5)},
+                    {next, Log2Num(0.3)},
+                    {silent, Log2Num(0.2)}};
+    }
+    res[silent] = {{first, Log2Num(1)}};
+  }
+  return res;
+}
+
+// Chains which do not meet until the end give the same path and every call
+// walks back only over the columns which it has not walked before.
+TEST(OnlineViterbiTest, ChainsDoNotMeetTest) {
+  std::mt19937 gen(5);
+  const int kHalf = 10;
+  HMM<double> hmm(kInitialState, twoChainTransitions(kHalf));
+  std::uniform_real_distribution<double> level(40, 80);
+  std::vector<std::unique_ptr<State<double>>> states;
+  states.emplace_back(new SilentState<double>());
+  for (int state = 1; state <= 2 * kHalf; state++) {
+    if (state % kHalf == 0) {
+      states.emplace_back(new SilentState<double>());
+    } else {
+      states.emplace_back(new GaussianState(level(gen), 2));
+    }
+  }
+  std::vector<double> emissions;
+  for (int i = 0; i < 2000; i++) emissions.push_back(level(gen));
+
+  OnlineViterbi<double> decoder(hmm, states);
+  std::vector<int> res;
+  for (double emission : emissions) {
+    std::vector<int> fixed = decoder.addEmissions({emission});
+    res.insert(res.end(), fixed.begin(), fixed.end());
+  }
+  EXPECT_EQ(emissions.size() + 1, decoder.windowSize());
+  EXPECT_LT(decoder.walkedColumns(), 20 * (long long)emissions.size());
+  std::vector<int> rest = decoder.finish();
+  res.insert(res.end(), rest.begin(), rest.end());
+  EXPECT_EQ(hmm.runViterbiReturnStateIds(emissions, states), res);
+}
+
+TEST(OnlineViterbiTest, NoEmissionsTest) {
+  std::mt19937 gen(3);
+  const int kStates = 5;
+  HMM<double> hmm(kInitialState, chainTransitions(kStates));
+  std::vector<std::unique_ptr<State<double>>> states = chainStates(kStates, &gen);
+
+  OnlineViterbi<double> decoder(hmm, states);
+  EXPECT_EQ(std::vector<int>({kInitialState}), decoder.addEmissions({}));
+  EXPECT_EQ(std::vector<int>(), decoder.finish());
+}
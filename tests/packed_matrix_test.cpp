@@ -0,0 +1,63 @@
+#include <vector>
+
+#include "src/packed_matrix.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+TEST(PackedMatrixTest, BitsPerCellTest) {
+  EXPECT_EQ(1, PackedMatrix(1, 1, 0).bitsPerCell());
+  EXPECT_EQ(1, PackedMatrix(1, 1, 1).bitsPerCell());
+  EXPECT_EQ(5, PackedMatrix(1, 1, 21).bitsPerCell());
+  EXPECT_EQ(6, PackedMatrix(1, 1, 32).bitsPerCell());
+  EXPECT_EQ(32, PackedMatrix(1, 1, 0xffffffff).bitsPerCell());
+}
+
+TEST(PackedMatrixTest, SetGetTest) {
+  const int kRows = 7;
+  const int kCols = 1025;
+  const uint32_t kMaxValue = 21;
+  PackedMatrix matrix(kRows, kCols, kMaxValue);
+  for (int row = 0; row < kRows; row++) {
+    for (int col = 0; col < kCols; col++) {
+      EXPECT_EQ(0, matrix.get(row, col));
+      matrix.set(row, col, (row * 31 + col) % (kMaxValue + 1));
+    }
+  }
+
+  for (int row = 0; row < kRows; row++) {
+    for (int col = 0; col < kCols; col++) {
+      EXPECT_EQ((row * 31 + col) % (kMaxValue + 1), matrix.get(row, col))
+          << "Matrices differ at (" << row << ", " << col << ").";
+    }
+  }
+
+  // Overwriting cell does not change its neighbours.
+  matrix.set(3, 100, 0);
+  EXPECT_EQ(0, matrix.get(3, 100));
+  EXPECT_EQ((3 * 31 + 99) % (kMaxValue + 1), matrix.get(3, 99));
+  EXPECT_EQ((3 * 31 + 101) % (kMaxValue + 1), matrix.get(3, 101));
+}
+
+TEST(PackedMatrixTest, MemoryUsageTest) {
+  // 12 cells with 5 bits fit into one 64-bit word.
+  PackedMatrix matrix(10, 1025, 21);
+  EXPECT_EQ(10 * 86 * sizeof(uint64_t), matrix.memoryUsage());
+}
+
+TEST(PackedMatrixTest, AppendAndEraseRowsTest) {
+  PackedMatrix matrix(2, 10, 3);
+  matrix.set(0, 5, 1);
+  matrix.set(1, 5, 2);
+
+  matrix.appendRows(2);
+  EXPECT_EQ(4, matrix.rows());
+  EXPECT_EQ(0, matrix.get(3, 5));
+  matrix.set(3, 5, 3);
+
+  matrix.eraseFirstRows(1);
+  EXPECT_EQ(3, matrix.rows());
+  EXPECT_EQ(2, matrix.get(0, 5));
+  EXPECT_EQ(0, matrix.get(1, 5));
+  EXPECT_EQ(3, matrix.get(2, 5));
+}
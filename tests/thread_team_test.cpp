@@ -0,0 +1,80 @@
+#include <stdexcept>
+#include <vector>
+
+#include "src/thread_team.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+// Every step reads only results of the previous step so it gives the same
+// numbers as sequential computation if the steps do not overlap.
+TEST(ThreadTeamTest, LockstepTest) {
+  const int kCells = 100;
+  const int kSteps = 200;
+  for (int threads : {1, 2, 3, 5}) {
+    std::vector<long long> prev(kCells, 1), curr(kCells, 0);
+    std::vector<int> sequential_steps;
+    auto parallel = [&](int, int thread) {
+      for (int cell = thread; cell < kCells; cell += threads) {
+        curr[cell] = prev[cell] + prev[(cell + 1) % kCells];
+      }
+    };
+    auto sequential = [&](int step) {
+      sequential_steps.push_back(step);
+      // Keeps numbers small.
+      for (long long& cell : curr) cell %= 1000003;
+      std::swap(prev, curr);
+    };
+    runInLockstep(threads, kSteps, parallel, sequential);
+
+    std::vector<long long> expected(kCells, 1), next(kCells);
+    for (int step = 0; step < kSteps; step++) {
+      for (int cell = 0; cell < kCells; cell++) {
+        next[cell] = (expected[cell] + expected[(cell + 1) % kCells]) %
+                     1000003;
+      }
+      std::swap(expected, next);
+    }
+    EXPECT_EQ(expected, prev) << "Threads: " << threads;
+    ASSERT_EQ(kSteps, sequential_steps.size());
+    for (int step = 0; step < kSteps; step++) {
+      EXPECT_EQ(step, sequential_steps[step]);
+    }
+  }
+}
+
+TEST(ThreadTeamTest, NoStepsTest) {
+  int calls = 0;
+  runInLockstep(3, 0, [&](int, int) { calls++; }, [&](int) { calls++; });
+  EXPECT_EQ(0, calls);
+}
+
+// Exception of any thread stops the team after its step and it is rethrown in
+// the calling thread.
+TEST(ThreadTeamTest, ExceptionTest) {
+  const int kSteps = 50;
+  const int kThrowStep = 10;
+  for (int threads : {1, 2, 3}) {
+    for (int throwing = 0; throwing <= threads; throwing++) {
+      std::vector<int> sequential_steps;
+      auto parallel = [&](int step, int thread) {
+        if (step == kThrowStep && thread == throwing) {
+          throw std::invalid_argument("Parallel.");
+        }
+      };
+      // Thread id equal to threads means the sequential part.
+      auto sequential = [&](int step) {
+        sequential_steps.push_back(step);
+        if (step == kThrowStep && throwing == threads) {
+          throw std::invalid_argument("Sequential.");
+        }
+      };
+      EXPECT_THROW(runInLockstep(threads, kSteps, parallel, sequential),
+                   std::invalid_argument)
+          << "Threads: " << threads << ", throwing: " << throwing;
+      EXPECT_EQ(kThrowStep + (throwing == threads),
+                (int)sequential_steps.size())
+          << "Threads: " << threads << ", throwing: " << throwing;
+    }
+  }
+}